@@ -0,0 +1,215 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2012, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __VFREX_H
+#define __VFREX_H
+
+#include <stddef.h>
+#include "vfrex-share.h"
+
+#define VFREX_SUCCESS 0
+#define VFREX_INVALID 1
+#define VFREX_UNKNOWN 2
+
+#ifdef __cplusplus
+typedef void *vfrex_t;
+typedef void *vfrex_set_t;
+typedef void *vfrex_stream_t;
+#else
+typedef struct vfrex_t *vfrex_t;
+typedef struct vfrex_set_t *vfrex_set_t;
+typedef struct vfrex_stream_t *vfrex_stream_t;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* Generate a default option */
+    vfrex_option_t default_option();
+    /* Grammar sugar:  If the matching is OK, it will return vfrex.  You can
+     * use vfrex_group to extract the boundary and submatch.  Otherwise it will
+     * return NULL. */
+    vfrex_t vfrex_match(const char *text, const char *regex, vfrex_option_t option);
+
+    /* TODO Grammar sugar:  replace regex with target in text.  The return
+     * valus is the error code */
+    int vfrex_replace(char *text, const char *regex, const char *target,
+                      vfrex_option_t option);
+
+    /* Compile the regex into a vfrex engine for future use.  If regex is not
+     * valid, it will vfrex will become NULL.  The return value is the error
+     * code */
+    int vfrex_compile(vfrex_t *vfrex, const char *regex, vfrex_option_t option);
+
+    /* Make a context of vfrex, with which a thread matches as with vfrex.
+     * A context shares the compiled regex and tables of vfrex, and the lazy
+     * DFA cache, which the threads read without a lock and fill together,
+     * each taking a short lock to add a state.  It has its own results and
+     * scratch: the groups, the thread lists of the NFA, and a cache to go
+     * on in when the shared one is full.  So each thread matching with its
+     * own context of one vfrex needs neither a lock nor a compile of its
+     * own.  vfrex is matched with by one thread at a time like a context,
+     * is not being matched with while a context is made of it, and outlives
+     * its contexts, which are released by vfrex_free.  The return value is
+     * the error code */
+    int vfrex_context(vfrex_t *context, vfrex_t vfrex);
+
+    /* match text with vfrex.  The result is store in vfrex.  You can read the
+     * result of last matching by vfrex_result or vfrex_scanf. The return value
+     * is the error code */
+    int vfrex_object_match(vfrex_t vfrex, const char *text);
+
+    /* Like vfrex_object_match, on the len bytes of text, which need not end
+     * with '\0' and may contain it, like a mmap of a file or binary data.
+     * Every engine stops at len, so the text is not measured first */
+    int vfrex_match_n(vfrex_t vfrex, const void *text, size_t len);
+
+    /* Find the matches of vfrex in text from left to right, without
+     * overlapping: vfrex_find_iter starts at text, and each vfrex_find_next
+     * goes to the next match, whose groups are read with vfrex_group.  A
+     * match is searched for after the last one, or a byte later if it was
+     * empty.  The groups of a match take no allocation once the first one
+     * has made room for them.  vfrex must be compiled with
+     * REGEX_MATCH_PARTIAL_BOUNDARY or REGEX_MATCH_PARTIAL_SUBMATCH, or
+     * VFREX_INVALID_SCAN is returned.  The return value is the error code,
+     * VFREX_NOT_FOUND after the last match */
+    int vfrex_find_iter(vfrex_t vfrex, const char *text);
+    int vfrex_find_next(vfrex_t vfrex);
+    /* The same on the len bytes of text, as vfrex_match_n */
+    int vfrex_find_iter_n(vfrex_t vfrex, const void *text, size_t len);
+
+    /* Called by vfrex_scan with the whole of each match, and data.  The
+     * groups can be read with vfrex_group as well.  Return non-zero to stop
+     * the scan */
+    typedef int (*vfrex_callback_t)(const char *left, const char *right,
+                                    void *data);
+
+    /* Call callback on each match of vfrex_find_iter in text.  The return
+     * value is the error code, VFREX_NOT_FOUND if there is no match */
+    int vfrex_scan(vfrex_t vfrex, const char *text, vfrex_callback_t callback,
+                   void *data);
+
+    /* Match a stream fed chunk by chunk, like the blocks of a file or the
+     * reads of a socket, with the matches of vfrex_find_iter on the whole
+     * of it.  A match across two chunks is found as well: callback gets
+     * the [left, right) of each match as offsets from the start of the
+     * stream, and returns non-zero to stop.  A match may be reported only
+     * with a later chunk, as the bytes after it may still change it.  The
+     * chunks are matched in place and the engine goes on from where the
+     * last one left it, so only the bytes a match not reported yet may
+     * span are kept.  A match that may always go on, like the one of
+     * "a.*b", is decided at the end of the stream only, and the bytes from
+     * its start are kept until then.  vfrex must be compiled with
+     * REGEX_MATCH_PARTIAL_BOUNDARY or REGEX_MATCH_PARTIAL_SUBMATCH, or
+     * VFREX_INVALID_SCAN is returned.  Without a bound on the length of
+     * its matches, a vfrex of vfrex_load matched with the DFA has no regex
+     * to tell where one may start, nor has an approximate one, and they
+     * give VFREX_INVALID_STREAM.  The stream matches with a context of its
+     * own, so vfrex may be matched with meanwhile, and must outlive the
+     * stream.  The return value is the error code */
+    int vfrex_stream_open(vfrex_stream_t *stream, vfrex_t vfrex,
+                          int (*callback)(size_t left, size_t right,
+                                          void *data),
+                          void *data);
+    int vfrex_stream_feed(vfrex_stream_t stream, const void *chunk,
+                          size_t len);
+    /* Report the matches left at the end of the stream, and release it */
+    int vfrex_stream_close(vfrex_stream_t *stream);
+
+    /* TODO: the scanf style to view the result */
+    int vfrex_scanf(vfrex_t vfrex, char *pat, ...);
+
+    /* Get the number of groups.  The group 0 is the whole match */
+    size_t vfrex_group_number(vfrex_t vfrex);
+    int vfrex_group(size_t idx,         /* index of group number */
+                    const char **left,  /* place to save the left boundary */
+                    const char **right, /* place to save the right boundary */
+                    vfrex_t vfrex);     /* regex engine */
+
+    /* Get the index of the literal the last match found in a regex like
+     * "Andy|Grace|...", counted from 0 in the order of the alternation.  It
+     * is known when the regex is such an alternation of two or more
+     * literals, which is matched with Teddy (the packed shift-or on CPUs
+     * without pshufb) or Aho-Corasick.  The return value is the error code,
+     * VFREX_NOT_FOUND if the index is not known */
+    int vfrex_literal(size_t *idx, vfrex_t vfrex);
+
+    /* Get the number of edits of the last match of a regex compiled with
+     * option.max_error, which is at most option.max_error.  The return value
+     * is the error code, VFREX_NOT_FOUND if there was no such match */
+    int vfrex_edit_distance(size_t *edit, vfrex_t vfrex);
+
+    /* Get how many times the DFA cache of vfrex was cleared because it hit
+     * option.cache_size.  A fast growing number means the regex is too wide
+     * for the cache. */
+    size_t vfrex_cache_reset_number(vfrex_t vfrex);
+
+    /* Get how many times a match of vfrex, or of the context vfrex, found
+     * the DFA cache shared by the contexts full and went on in a cache of
+     * its own, which is warmed up for each context.  A growing number means
+     * option.cache_size is too small for the shared cache. */
+    size_t vfrex_cache_leave_number(vfrex_t vfrex);
+
+    /* Write the compiled vfrex into blob as a position independent image
+     * and return its size.  Nothing is written if size is too small, so
+     * call it with size 0 first to learn the size.  0 is returned if vfrex
+     * has no table form: the NFA, or a DFA whose table does not fit into
+     * option.cache_size */
+    size_t vfrex_serialize(vfrex_t vfrex, void *blob, size_t size);
+
+    /* Make a vfrex from a blob of vfrex_serialize without copying, so blob
+     * may be a read only mmap of a file.  blob must be 8 bytes aligned and
+     * outlive vfrex.  The return value is the error code */
+    int vfrex_load(vfrex_t *vfrex, const void *blob, size_t size);
+
+    /* release the resource */
+    void vfrex_free(vfrex_t *vfrex);
+
+    /* Compile n regexes into a set matched by one DFA of their union, so a
+     * text is scanned once for all of them.  A set only tells which regexes
+     * match: REGEX_MATCH_FULL_BOOL is kept and every other option.match is
+     * taken as REGEX_MATCH_PARTIAL_BOOL, and option.max_error is ignored.
+     * The states of the union are as large as the number of regexes, so
+     * give a large set a large option.cache_size: if the cache keeps being
+     * cleared, the regexes are matched one by one.  If a regex is not valid,
+     * set will become NULL.  The return value is the error code */
+    int vfrex_set_compile(vfrex_set_t *set, const char **regexes, size_t n,
+                          vfrex_option_t option);
+
+    /* Match text with every regex of set.  The return value is the error
+     * code, VFREX_NOT_FOUND if none of them matches */
+    int vfrex_set_match(vfrex_set_t set, const char *text);
+
+    /* Get the number of regexes the last vfrex_set_match found, and the
+     * index in regexes of the idx-th of them in increasing order */
+    size_t vfrex_set_match_number(vfrex_set_t set);
+    size_t vfrex_set_match_index(size_t idx, vfrex_set_t set);
+
+    void vfrex_set_free(vfrex_set_t *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,302 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "aho.h"
+#include "macro.h"
+#include <ctype.h>
+
+typedef struct span_t {
+    /* the literals [first, last) of a part of the alternation */
+    size_t first;
+    size_t last;
+} span_t;
+typedef array(span_t) span_a;
+
+extern void aho_free_words(word_a *word)
+{
+    arr_for(w, *word)
+        arr_free(*w);
+    arr_free(*word);
+}
+
+/* The byte ch stands for after case folding, -1 if it is a class of more
+ * than one */
+static int single_byte(range_a *ch, bool ignore_case)
+{
+    int b = -1;
+    arr_for(range, *ch)
+        for (int c = range->lower; c <= range->upper; ++c) {
+            int f = ignore_case ? tolower(c) : c;
+            if (b >= 0 && f != b)
+                return -1;
+            b = f;
+        }
+    return b;
+}
+
+/* Evaluate the RPN into the literals of the alternation in order.  A
+ * concatenation is of two literals, which are the last two of word */
+extern bool aho_words(vfrex_t vfrex, word_a *word)
+{
+    span_a stack;
+    span_t a, b;
+    arr_init(stack);
+    arr_init(*word);
+
+    arr_for(sym, vfrex->exp) {
+        switch (sym->kind) {
+        case REGEX_CHAR: {
+            word_t w;
+            int    c = single_byte(sym->ch, vfrex->option.ignore_case);
+            if (c < 0)
+                goto fail;
+            arr_init(w);
+            arr_push(w, (uchar)c);
+            arr_push(*word, w);
+            arr_push(stack, ((span_t){ word->len - 1, word->len }));
+            break;
+        }
+
+        case REGEX_CONCATE:
+            b = arr_pop(stack);
+            a = arr_pop(stack);
+            if (a.last - a.first != 1 || b.last - b.first != 1)
+                goto fail;
+            arr_for(c, word->v[b.first])
+                arr_push(word->v[a.first], *c);
+            arr_free(word->v[b.first]);
+            --word->len;
+            arr_push(stack, a);
+            break;
+
+        case REGEX_OR:
+            b = arr_pop(stack);
+            a = arr_pop(stack);
+            arr_push(stack, ((span_t){ a.first, b.last }));
+            break;
+
+        default:
+            goto fail;
+        }
+    }
+    arr_free(stack);
+    return true;
+
+fail:
+    arr_free(stack);
+    aho_free_words(word);
+    return false;
+}
+
+extern size_t aho_literal_number(vfrex_t vfrex, size_t *total)
+{
+    word_a word;
+    *total = 0;
+    if (!aho_words(vfrex, &word))
+        return 0;
+    size_t n = word.len;
+    arr_for(w, word)
+        *total += w->len;
+    aho_free_words(&word);
+    return n;
+}
+
+extern bool aho_compile(vfrex_t vfrex)
+{
+    word_a word;
+    if (!aho_words(vfrex, &word))
+        return false;
+
+    aho_t *ac = mcalloc(1, sizeof(aho_t));
+    ac->literal_number = word.len;
+
+    /* a class for each byte of the literals, and class 0 for the others */
+    bool used[256] = { false };
+    arr_for(w, word) {
+        arr_for(c, *w)
+            used[*c] = true;
+        if (w->len > ac->max_len)
+            ac->max_len = w->len;
+    }
+    uchar cls[256] = { 0 };
+    size_t K = 1;
+    for (int c = 0; c < 256; ++c)
+        if (used[c])
+            cls[c] = (uchar)K++;
+    for (int c = 0; c < 256; ++c)
+        ac->byte_class[c] = cls[vfrex->option.ignore_case ? tolower(c) : c];
+    ac->class_number = K;
+
+    /* the trie, where 0 is no child as the root is no one's child */
+    size_t capacity  = 16;
+    ac->trans        = mcalloc(capacity * K, sizeof(uint32_t));
+    ac->state        = mmalloc(capacity * sizeof(aho_state_t));
+    ac->state[0]     = (aho_state_t){ AHO_NONE, AHO_NONE, 0 };
+    ac->state_number = 1;
+    for (size_t i = 0; i < word.len; ++i) {
+        size_t s = 0;
+        arr_for(c, word.v[i]) {
+            uint32_t *t = &ac->trans[s * K + cls[*c]];
+            if (!*t) {
+                if ((ac->state_number + 1) * K > AHO_STATE) {
+                    aho_free_words(&word);
+                    vfrex->aho = ac;
+                    aho_free(vfrex);
+                    return false;
+                }
+                if (ac->state_number == capacity) {
+                    capacity *= 2;
+                    ac->trans = mrealloc(ac->trans,
+                                         capacity * K * sizeof(uint32_t));
+                    ac->state = mrealloc(ac->state,
+                                         capacity * sizeof(aho_state_t));
+                    memset(ac->trans + ac->state_number * K, 0,
+                           (capacity - ac->state_number) * K *
+                           sizeof(uint32_t));
+                }
+                ac->state[ac->state_number] = (aho_state_t){
+                    AHO_NONE, AHO_NONE, ac->state[s].depth + 1
+                };
+                /* t may have moved */
+                ac->trans[s * K + cls[*c]] = (uint32_t)ac->state_number++;
+            }
+            s = ac->trans[s * K + cls[*c]];
+        }
+        if (ac->state[s].literal == AHO_NONE)
+            ac->state[s].literal = (uint32_t)i;
+    }
+    aho_free_words(&word);
+
+    /* Fold the failure links in BFS order: a missing child of u is the
+     * child of the failure state of u, which is shallower and done */
+    uint32_t *fail  = mcalloc(ac->state_number, sizeof(uint32_t));
+    uint32_t *queue = mmalloc(ac->state_number * sizeof(uint32_t));
+    size_t    head = 0, tail = 0;
+    for (size_t c = 0; c < K; ++c)
+        if (ac->trans[c])
+            queue[tail++] = ac->trans[c];
+    while (head < tail) {
+        uint32_t  u   = queue[head++];
+        uint32_t *row = ac->trans + u * K;
+        for (size_t c = 0; c < K; ++c) {
+            uint32_t f = ac->trans[fail[u] * K + c];
+            if (row[c]) {
+                uint32_t v = row[c];
+                fail[v] = f;
+                ac->state[v].dict = ac->state[f].literal != AHO_NONE ?
+                                    f : ac->state[f].dict;
+                queue[tail++] = v;
+            } else {
+                row[c] = f;
+            }
+        }
+    }
+    mfree(fail);
+    mfree(queue);
+
+    for (size_t i = 0; i < ac->state_number * K; ++i) {
+        uint32_t t = ac->trans[i];
+        ac->trans[i] = t * (uint32_t)K;
+        if (ac->state[t].literal != AHO_NONE || ac->state[t].dict != AHO_NONE)
+            ac->trans[i] |= AHO_MATCH;
+    }
+    vfrex->aho     = ac;
+    vfrex->literal = AHO_NONE;
+    return true;
+}
+
+/* The first literal ending at state, which is the longest one */
+static uint32_t first_output(const aho_t *ac, uint32_t state)
+{
+    return ac->state[state].literal != AHO_NONE ? state : ac->state[state].dict;
+}
+
+extern bool aho_match(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_AHO_CORASICK);
+    const aho_t *ac    = vfrex->aho;
+    const uchar *cls   = ac->byte_class;
+    uint32_t     K     = (uint32_t)ac->class_number;
+    const uchar *end   = text + len;
+    const uchar *left  = NULL;
+    const uchar *right = NULL;
+    uint32_t     s     = 0;
+    uint32_t     found = AHO_NONE;
+
+    vfrex->literal = AHO_NONE;
+    if (vfrex->option.match == REGEX_MATCH_FULL_BOOL) {
+        for (const uchar *c = text; c < end; ++c)
+            s = ac->trans[(s & AHO_STATE) + cls[*c]];
+        const aho_state_t *p = &ac->state[(s & AHO_STATE) / K];
+        if (p->depth != len || p->literal == AHO_NONE)
+            return false;
+        vfrex->literal = p->literal;
+        return true;
+    }
+
+    /* The leftmost match wins, then the first alternative among the ones
+     * starting there, as in the DFA.  The literals ending at a state are
+     * the longest one first, so the ones starting no later than left come
+     * first.  Every literal starting by left has ended max_len bytes
+     * after it */
+    for (const uchar *c = text; c < end; ++c) {
+        s = ac->trans[(s & AHO_STATE) + cls[*c]];
+        if (s & AHO_MATCH) {
+            uint32_t state = first_output(ac, (s & AHO_STATE) / K);
+            if (vfrex->option.match == REGEX_MATCH_PARTIAL_BOOL) {
+                vfrex->literal = ac->state[state].literal;
+                return true;
+            }
+            for (; state != AHO_NONE; state = ac->state[state].dict) {
+                const aho_state_t *p     = &ac->state[state];
+                const uchar       *start = c + 1 - p->depth;
+                if (left && start > left)
+                    break;
+                if (!left || start < left || p->literal < found) {
+                    left  = start;
+                    right = c + 1;
+                    found = p->literal;
+                }
+            }
+        }
+        if (left && (size_t)(c + 1 - left) >= ac->max_len)
+            break;
+    }
+    if (!left)
+        return false;
+
+    vfrex->literal      = found;
+    group_reserve(vfrex, 1);
+    *vfrex->group_left  = left;
+    *vfrex->group_right = right;
+    return true;
+}
+
+extern void aho_free(vfrex_t vfrex)
+{
+    if (!vfrex->aho)
+        return;
+    cleanup(vfrex->aho->trans);
+    cleanup(vfrex->aho->state);
+    cleanup(vfrex->aho);
+}
@@ -0,0 +1,83 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef __AHO_H
+#define __AHO_H
+
+#include "common.h"
+
+/* An alternation of many literals like "Andy|Grace|..." is matched with an
+ * Aho-Corasick automaton.  The failure links are folded into a dense table
+ * over the byte classes of the literals, so each byte of the text costs one
+ * load whatever the number of literals is. */
+
+/* fewer literals than this are left to Teddy, whose buckets are too full
+ * for it to be faster past that */
+#define AHO_MIN_LITERAL 49
+
+/* the entry goes to a state where a literal ends */
+#define AHO_MATCH 0x80000000u
+#define AHO_STATE (~AHO_MATCH)
+#define AHO_NONE  0xFFFFFFFFu
+
+typedef struct aho_state_t {
+    /* the first literal of the alternation equal to the path to the state,
+     * AHO_NONE if there is none */
+    uint32_t literal;
+    /* the longest proper suffix of the path that is a literal, AHO_NONE if
+     * there is none */
+    uint32_t dict;
+    /* the length of the path */
+    uint32_t depth;
+} aho_state_t;
+
+struct aho_t {
+    size_t       literal_number;
+    /* length of the longest literal */
+    size_t       max_len;
+    uchar        byte_class[256];
+    size_t       class_number;
+    /* class_number entries for each state, the root is state 0.  An entry
+     * is the offset of the row of the target state, tagged with AHO_MATCH */
+    uint32_t    *trans;
+    aho_state_t *state;
+    size_t       state_number;
+};
+
+typedef array(uchar) word_t;
+typedef array(word_t) word_a;
+
+/* The literals of vfrex->exp in the order of the alternation, folded to
+ * lower case with ignore_case.  Return false if vfrex->exp is not an
+ * alternation of literals */
+extern bool aho_words(vfrex_t vfrex, word_a *word);
+extern void aho_free_words(word_a *word);
+/* The number of literals if vfrex->exp is an alternation of literals, 0 if
+ * it is not.  *total is the sum of their lengths */
+extern size_t aho_literal_number(vfrex_t vfrex, size_t *total);
+/* Return false if the automaton has too many states for its table.
+ * Nothing is left in vfrex in that case */
+extern bool aho_compile(vfrex_t vfrex);
+extern bool aho_match(const uchar *text, size_t len, vfrex_t vfrex);
+extern void aho_free(vfrex_t vfrex);
+
+#endif /* end of include guard: __AHO_H */
@@ -22,6 +22,7 @@
  */
 
 #include "common.h"
+#include "macro.h"
 
 /* this routine is mainly used for debug */
 char *operator_to_str(operator_t x)
@@ -74,6 +75,8 @@ char *operator_to_str(operator_t x)
         return "REGEX_WORD_BOUNDARY_LEFT";
     case REGEX_WORD_BOUNDARY_RIGHT:
         return "REGEX_WORD_BOUNDARY_RIGHT";
+    case REGEX_GROUP:
+        return "REGEX_GROUP";
     }
 #endif
     return "";
@@ -94,7 +97,39 @@ char *algorithm_to_str(algorithm_t x)
         return "REGEX_DFA";
     case REGEX_NFA:
         return "REGEX_NFA";
+    case REGEX_ONE_PASS:
+        return "REGEX_ONE_PASS";
+    case REGEX_AHO_CORASICK:
+        return "REGEX_AHO_CORASICK";
+    case REGEX_TEDDY:
+        return "REGEX_TEDDY";
+    case REGEX_SHIFT_OR_MULTI:
+        return "REGEX_SHIFT_OR_MULTI";
+    case REGEX_GLUSHKOV:
+        return "REGEX_GLUSHKOV";
+    case REGEX_SHIFT_OR_128:
+        return "REGEX_SHIFT_OR_128";
+    case REGEX_SHIFT_OR_256:
+        return "REGEX_SHIFT_OR_256";
+    case REGEX_BNDM:
+        return "REGEX_BNDM";
+    case REGEX_APPROXIMATE:
+        return "REGEX_APPROXIMATE";
+    case REGEX_TWO_WAY:
+        return "REGEX_TWO_WAY";
     }
 #endif
     return "";
 }
+
+void group_reserve(vfrex_t vfrex, size_t n)
+{
+    if (n > vfrex->group_size) {
+        cleanup(vfrex->group_left);
+        cleanup(vfrex->group_right);
+        vfrex->group_left  = mmalloc(n * sizeof(void *));
+        vfrex->group_right = mmalloc(n * sizeof(void *));
+        vfrex->group_size  = n;
+    }
+    vfrex->group_number = n;
+}
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <setjmp.h>
 #include "array.h"
 #include "vfrex-share.h"
 
@@ -59,6 +60,7 @@ typedef enum operator_t {
     REGEX_WORD_BOUNDARY,
     REGEX_WORD_BOUNDARY_LEFT,
     REGEX_WORD_BOUNDARY_RIGHT,
+    REGEX_GROUP, /* the operand is a capture group, for SUBMATCH only */
 } operator_t;
 
 #define is_symbol(x) \
@@ -105,6 +107,8 @@ typedef array(range_t) range_a;
 typedef struct symbol_t {
     range_a   *ch;
     operator_t kind;
+    /* the index of REGEX_GROUP, counted by the left parentheses from 1 */
+    uint32_t   group;
 } symbol_t;
 
 typedef enum algorithm_t {
@@ -113,13 +117,29 @@ typedef enum algorithm_t {
     REGEX_BOYER_MOORE,
     REGEX_DFA,
     REGEX_NFA,
+    REGEX_ONE_PASS,
+    REGEX_AHO_CORASICK,
+    REGEX_TEDDY,
+    REGEX_SHIFT_OR_MULTI,
+    REGEX_GLUSHKOV,
+    REGEX_SHIFT_OR_128,
+    REGEX_SHIFT_OR_256,
+    REGEX_BNDM,
+    REGEX_APPROXIMATE,
+    REGEX_TWO_WAY,
 } algorithm_t;
 
 char *operator_to_str(operator_t);
 char *algorithm_to_str(algorithm_t);
 
-typedef struct FSM_t    FSM_t;
-typedef array(symbol_t) symbol_a;
+typedef struct FSM_t     FSM_t;
+typedef struct pike_t    pike_t;
+typedef struct onepass_t onepass_t;
+typedef struct prefilter_t prefilter_t;
+typedef struct aho_t     aho_t;
+typedef struct teddy_t   teddy_t;
+typedef struct glushkov_t glushkov_t;
+typedef array(symbol_t)  symbol_a;
 
 typedef struct vfrex_t {
     /* original string */
@@ -131,28 +151,156 @@ typedef struct vfrex_t {
 
     algorithm_t  algorithm;
     void        *shift_or;
+    /* the number of chars and classes of REGEX_SHIFT_OR_32 .. 256,
+     * REGEX_BNDM and REGEX_APPROXIMATE */
+    size_t       shift_or_len;
     /* TODO:  Clean up the namespace */
     int32_t     *BM_bad_char_table;
     int32_t     *BM_good_suffix_table;
     int32_t     *BM_full_jump_table;
 
     /* FSM[0] is the forward direction FSM
-     * FSM[1] is the backward direction FSM */
-    FSM_t       *FSM[2];
+     * FSM[1] is the backward direction FSM
+     * FSM[2] is the backward direction FSM of the part before inner */
+    FSM_t       *FSM[3];
+    /* the NFA simulation, used for REGEX_NFA or when the DFA gives up */
+    pike_t      *pike;
+    /* the one-pass DFA of REGEX_ONE_PASS */
+    onepass_t   *onepass;
+    /* the literals every match starts with, for the start state of FSM[0] */
+    prefilter_t *prefilter;
+    /* a literal every match has inside, for regexes without such a prefix */
+    prefilter_t *inner;
+    /* the length of the RPN of the part before inner */
+    size_t       inner_split;
+    /* the automaton of REGEX_AHO_CORASICK, the buckets of REGEX_TEDDY, and
+     * the index of the literal the last match found in the alternation */
+    aho_t       *aho;
+    teddy_t     *teddy;
+    size_t       literal;
+    /* the edits of the last match of REGEX_APPROXIMATE */
+    size_t       edit;
+    /* the position automaton of REGEX_GLUSHKOV */
+    glushkov_t  *glushkov;
+
+    /* the number of groups in the regex, group 0 being the whole match */
+    size_t        capture_number;
+    /* the most bytes a match spans, SIZE_MAX if there is no bound */
+    size_t        max_length;
 
     size_t        group_number;
     const uchar **group_left;
     const uchar **group_right;
+    /* the room of group_left and group_right, kept from match to match */
+    size_t        group_size;
+    /* where vfrex_find_next goes on in the text of vfrex_find_iter, NULL
+     * after the last match */
+    const uchar  *find_next;
+    const uchar  *find_end;
 
     vfrex_error_t  status;
     vfrex_option_t option;
+    /* where a compile error of vfrex jumps to */
+    jmp_buf        env;
+
+    /* the blob vfrex_load made this vfrex from.  The regex and the tables
+     * point into it and are not owned by vfrex */
+    const void    *blob;
+    /* vfrex was made by vfrex_context.  It owns its groups and the scratch
+     * of the engines, and shares the rest with the vfrex it was made of */
+    bool           context;
 } *vfrex_t;
 
+typedef struct vfrex_set_t {
+    /* each pattern compiled on its own, used when the union DFA gives up */
+    vfrex_t       *pattern;
+    size_t         pattern_number;
+    /* the DFA of the union of the patterns.  The slot of an accept node is
+     * the index of its pattern */
+    FSM_t         *FSM;
+
+    /* the patterns matched by the last text, and their indices in order */
+    bool          *matched;
+    size_t        *match;
+    size_t         match_number;
+    /* counts the matches, so that a state is reported once in each */
+    uint32_t       serial;
+    /* bytes the union DFA has looked at */
+    size_t         scanned;
+
+    vfrex_option_t option;
+} *vfrex_set_t;
+
+/* What a stream carries from one chunk to the next */
+typedef enum stream_kind_t {
+    /* the state words of shift-or */
+    STREAM_SHIFT_OR,
+    /* the positions of Glushkov, and the entry of the forward FSM while it
+     * finds the boundaries of a match they found */
+    STREAM_GLUSHKOV,
+    /* the entry of the forward FSM */
+    STREAM_DFA,
+    /* nothing, for an engine without a state to carry: the bytes a match
+     * may span are kept and searched again with the next chunk */
+    STREAM_WINDOW,
+} stream_kind_t;
+
+typedef struct vfrex_stream_t {
+    /* a context of the vfrex the stream was opened with */
+    vfrex_t   vfrex;
+    int     (*callback)(size_t left, size_t right, void *data);
+    void     *data;
+    stream_kind_t kind;
+
+    /* The state of the engine after the bytes before pos: the words of
+     * shift-or, or the positions of Glushkov in d[0], and the entry of the
+     * forward FSM.  With Glushkov, the FSM only runs in decide */
+    uint64_t  d[4];
+    uint32_t  s;
+    bool      decide;
+    size_t    pos;
+    /* the FSM went through a match ending at right, which the bytes after
+     * it may still make longer */
+    bool      matched;
+    size_t    right;
+    /* no match not reported yet starts before start: the positions of
+     * Glushkov were empty there, or the search went on from it */
+    size_t    start;
+    /* tells how far back a match of a regex without a longest one may
+     * start, see DFA_stream_suffix */
+    FSM_t    *suffix;
+
+    /* With STREAM_WINDOW, the most bytes a match spans, and the bytes after
+     * a match that may still change it */
+    size_t    length;
+    size_t    reach;
+    /* The bytes fed from base on that a match may still need, len of them
+     * in size bytes of room.  kept is how many there were when they were
+     * last gone through for the ones no longer needed.  STREAM_WINDOW has
+     * room for the seam after them: the start of the next chunk, where a
+     * match starting in them is decided */
+    uchar    *buf;
+    size_t    base;
+    size_t    len;
+    size_t    size;
+    size_t    kept;
+    size_t    seam;
+    /* the stream offset the next match is searched from, and of the end of
+     * the bytes fed */
+    size_t    next;
+    size_t    fed;
+    bool      stop;
+} *vfrex_stream_t;
+
 extern void *(*mmalloc)(size_t);
 extern void  (*mfree)(void *);
 extern void *(*mrealloc)(void *, size_t);
 extern void *(*mcalloc)(size_t, size_t);
 
+/* Set the number of groups of a match, growing group_left and group_right
+ * only when the last match had room for fewer */
+void group_reserve(vfrex_t vfrex, size_t n);
+
 #ifndef NDEBUG
 #  define logff(...) fprint(stderr, __VAR_ARGS__)
 #else
@@ -26,8 +26,6 @@
 #include "common.h"
 #include <stdlib.h>
 #include <stdio.h>
-#include <setjmp.h>
-jmp_buf env;
 
 void *(*mmalloc)(size_t) = malloc;
 void  (*mfree)(void *) = free;
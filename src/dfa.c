@@ -25,8 +25,8 @@
 #include "macro.h"
 #include "qsort.h"
 #include "hash-map.h"
+#include <sched.h>
 
-uint32_t timeline = 0;
 #ifdef DEBUG
 int32_t total_index = 0;
 #endif
@@ -75,6 +75,10 @@ static void NUNUSED debug_print_node(nnode_t *node)
     case NODE_ACCEPT:
         printf("Node %d: Accept Node", total_index);
         break;
+
+    case NODE_SAVE:
+        printf("Node %d: Save Node %u", total_index, node->slot);
+        break;
     }
     printf(" %p %p\n", &node->next, &node->next0);
 #endif
@@ -92,64 +96,72 @@ static void NUNUSED debug_print_dnode(dnode_t *node)
 #endif
 }
 
-static void NUNUSED debug_print_graph(nnode_t *node)
+static void NUNUSED debug_print_graph(FSM_t *FSM)
 {
-    UNUSED(node);
+    UNUSED(FSM);
 #ifdef DEBUG
-    assert(node);
-
-    if (node->last == timeline)
-        return;
-    node->last = timeline;
-    if (node->kind == NODE_BRANCH) {
-        printf("Branch Edge1 %d to %d\n", node->index, node->next->index);
-        printf("Branch Edge2 %d to %d\n", node->index, node->next0->index);
-        debug_print_graph(node->next);
-        debug_print_graph(node->next0);
-    } else if (node->kind == NODE_CHAR) {
-        printf("Char   Edge %d to %d with %d~%d\n",
-               node->index, node->next->index,
-               node->range.v[0].lower, node->range.v[0].upper);
-        debug_print_graph(node->next);
+    arr_for(p, FSM->nodes) {
+        nnode_t *node = *p;
+        if (node->kind == NODE_BRANCH) {
+            printf("Branch Edge1 %d to %d\n", node->index, node->next->index);
+            printf("Branch Edge2 %d to %d\n", node->index, node->next0->index);
+        } else if (node->kind == NODE_CHAR) {
+            printf("Char   Edge %d to %d with %d~%d\n",
+                   node->index, node->next->index,
+                   node->range.v[0].lower, node->range.v[0].upper);
+        }
     }
 #endif
 }
 
-static nnode_t *new_null_node()
+/* every node is recorded in FSM->nodes, so that it can be indexed and freed */
+static nnode_t *new_nnode(node_kind_t kind, FSM_t *FSM)
 {
     nnode_t *ret = mmalloc(sizeof(nnode_t));
-    ret->kind    = NODE_NULL;
-    ret->last    = 0;
+    ret->kind    = kind;
+    ret->id      = (uint32_t)FSM->nodes.len;
+    arr_push(FSM->nodes, ret);
+    return ret;
+}
+
+static nnode_t *new_null_node(FSM_t *FSM)
+{
+    nnode_t *ret = new_nnode(NODE_NULL, FSM);
     debug_print_node(ret);
     return ret;
 }
 
-static nnode_t *new_char_node(range_a *ch)
+static nnode_t *new_char_node(range_a *ch, FSM_t *FSM)
 {
-    nnode_t *ret = mmalloc(sizeof(nnode_t));
-    ret->kind    = NODE_CHAR;
-    ret->range   = *ch;
-    ret->last    = 0;
+    nnode_t *ret = new_nnode(NODE_CHAR, FSM);
+    /* own a copy, so the graph does not depend on vfrex->exp */
+    arr_init(ret->range);
+    arr_for(range, *ch)
+        arr_push(ret->range, *range);
     debug_print_node(ret);
     return ret;
 }
 
-static nnode_t *new_branch_node(nnode_t *next, nnode_t *next0)
+static nnode_t *new_branch_node(nnode_t *next, nnode_t *next0, FSM_t *FSM)
 {
-    nnode_t *ret = mmalloc(sizeof(nnode_t));
-    ret->kind    = NODE_BRANCH;
+    nnode_t *ret = new_nnode(NODE_BRANCH, FSM);
     ret->next    = next;
     ret->next0   = next0;
-    ret->last    = 0;
     debug_print_node(ret);
     return ret;
 }
 
-static nnode_t *new_accept_node()
+static nnode_t *new_save_node(uint32_t slot, FSM_t *FSM)
 {
-    nnode_t *ret = mmalloc(sizeof(nnode_t));
-    ret->kind    = NODE_ACCEPT;
-    ret->last    = 0;
+    nnode_t *ret = new_nnode(NODE_SAVE, FSM);
+    ret->slot    = slot;
+    debug_print_node(ret);
+    return ret;
+}
+
+static nnode_t *new_accept_node(FSM_t *FSM)
+{
+    nnode_t *ret = new_nnode(NODE_ACCEPT, FSM);
     debug_print_node(ret);
     return ret;
 }
@@ -187,11 +199,63 @@ static void append_edges(edge_a *edges, nnode_t **edge)
     ++edges->len;
 }
 
-static void build_NFA(vfrex_t vfrex, bool flip, bool prepend, FSM_t *FSM)
+/* the chars eaten by the loop in front of a partial matching NFA.  It must
+ * eat every byte, or a match behind a byte it misses would not be found */
+static void prepend_range(range_a *range)
+{
+    arr_push(*range, ((range_t){ 0, 255 }));
+}
+
+/* Split [0, 255] at every boundary of the ranges used in the regex.  Chars
+ * falling into the same piece are never told apart by any char node, so the
+ * DFA only needs one transition for each piece instead of 256. */
+static void split_range(bool *split, range_a *ch)
+{
+    arr_for(range, *ch) {
+        split[range->lower]     = true;
+        split[range->upper + 1] = true;
+    }
+}
+
+static void split_exp(bool *split, symbol_a exp)
+{
+    arr_for(sym, exp)
+        if (sym->kind == REGEX_CHAR || sym->kind == REGEX_CHARSET)
+            split_range(split, sym->ch);
+}
+
+static void split_class(bool *split, FSM_t *FSM)
+{
+    range_a prefix;
+    arr_init(prefix);
+    prepend_range(&prefix);
+    split_range(split, &prefix);
+    arr_free(prefix);
+
+    uchar k = 0;
+    FSM->byte_class[0] = 0;
+    for (size_t c = 1; c < 256; ++c) {
+        if (split[c])
+            ++k;
+        FSM->byte_class[c] = k;
+    }
+    FSM->class_number = (size_t)k + 1;
+}
+
+extern void build_byte_class(vfrex_t vfrex, FSM_t *FSM)
+{
+    bool split[257] = { false };
+    split_exp(split, vfrex->exp);
+    split_class(split, FSM);
+}
+
+/* The graph of exp ending with an accept node of pattern */
+static nnode_t *build_graph(symbol_a expression, bool flip, uint32_t pattern,
+                            FSM_t *FSM)
 {
     stack_a stack;
-    symbol_t *exp = vfrex->exp.v;
-    size_t    len = vfrex->exp.len;
+    symbol_t *exp = expression.v;
+    size_t    len = expression.len;
 
     stack.len = 0;
     stack.v   = mmalloc(sizeof(stack_t) * len);
@@ -203,16 +267,16 @@ static void build_NFA(vfrex_t vfrex, bool flip, bool prepend, FSM_t *FSM)
         switch (exp[i].kind) {
         case REGEX_CHAR:
         case REGEX_CHARSET:
-            node = new_char_node(exp[i].ch);
+            node = new_char_node(exp[i].ch, FSM);
             push(&stack, node, new_edges(&node->next));
             break;
 
         case REGEX_NOTHING:
-            node = new_null_node();
+            node = new_null_node(FSM);
             push(&stack, node, new_edges(&node->next));
             break;
 
-            node = new_char_node(exp[i].ch);
+            node = new_char_node(exp[i].ch, FSM);
             push(&stack, node, new_edges(&node->next));
             break;
 
@@ -240,13 +304,13 @@ static void build_NFA(vfrex_t vfrex, bool flip, bool prepend, FSM_t *FSM)
             s1 = pop(&stack);
 
             combine_edges(&s1->edges, &s2->edges);
-            push(&stack, new_branch_node(s1->node, s2->node), s1->edges);
+            push(&stack, new_branch_node(s1->node, s2->node, FSM), s1->edges);
             break;
 
         case REGEX_ZERO_ONE:
             assert(stack.len >= 1);
             s1 = pop(&stack);
-            node = new_branch_node(s1->node, NULL);
+            node = new_branch_node(s1->node, NULL, FSM);
             append_edges(&s1->edges, &node->next0);
             push(&stack, node, s1->edges);
             break;
@@ -254,7 +318,7 @@ static void build_NFA(vfrex_t vfrex, bool flip, bool prepend, FSM_t *FSM)
         case REGEX_REPEAT:
             assert(stack.len >= 1);
             s1 = pop(&stack);
-            node = new_branch_node(s1->node, NULL);
+            node = new_branch_node(s1->node, NULL, FSM);
             connect_edges(&s1->edges, node);
             push(&stack, node, new_edges(&node->next0));
             break;
@@ -262,7 +326,7 @@ static void build_NFA(vfrex_t vfrex, bool flip, bool prepend, FSM_t *FSM)
         case REGEX_REPEAT_ALO:
             assert(stack.len >= 1);
             s1 = pop(&stack);
-            node = new_branch_node(s1->node, NULL);
+            node = new_branch_node(s1->node, NULL, FSM);
             connect_edges(&s1->edges, node);
             push(&stack, s1->node, new_edges(&node->next0));
             break;
@@ -270,7 +334,7 @@ static void build_NFA(vfrex_t vfrex, bool flip, bool prepend, FSM_t *FSM)
         case REGEX_ZERO_ONE_NG:
             assert(stack.len >= 1);
             s1 = pop(&stack);
-            node = new_branch_node(NULL, s1->node);
+            node = new_branch_node(NULL, s1->node, FSM);
             append_edges(&s1->edges, &node->next);
             push(&stack, node, s1->edges);
             break;
@@ -278,7 +342,7 @@ static void build_NFA(vfrex_t vfrex, bool flip, bool prepend, FSM_t *FSM)
         case REGEX_REPEAT_NG:
             assert(stack.len >= 1);
             s1 = pop(&stack);
-            node = new_branch_node(NULL, s1->node);
+            node = new_branch_node(NULL, s1->node, FSM);
             connect_edges(&s1->edges, node);
             push(&stack, node, new_edges(&node->next));
             break;
@@ -286,40 +350,64 @@ static void build_NFA(vfrex_t vfrex, bool flip, bool prepend, FSM_t *FSM)
         case REGEX_REPEAT_ALO_NG:
             assert(stack.len >= 1);
             s1 = pop(&stack);
-            node = new_branch_node(NULL, s1->node);
+            node = new_branch_node(NULL, s1->node, FSM);
             connect_edges(&s1->edges, node);
             push(&stack, s1->node, new_edges(&node->next));
             break;
 
+        case REGEX_GROUP:
+            assert(stack.len >= 1);
+            s1 = pop(&stack);
+            /* the reversed graph meets the right boundary first */
+            node = new_save_node(2 * exp[i].group + flip, FSM);
+            nnode_t *save = new_save_node(2 * exp[i].group + !flip, FSM);
+            node->next = s1->node;
+            connect_edges(&s1->edges, save);
+            push(&stack, node, new_edges(&save->next));
+            break;
+
         default:
             assert(0);
             break;
         }
     }
     assert(stack.len == 1);
-    connect_edges(&stack.v[0].edges, new_accept_node());
+    nnode_t *accept = new_accept_node(FSM);
+    accept->slot    = pattern;
+    connect_edges(&stack.v[0].edges, accept);
 
+    nnode_t *start = stack.v[0].node;
+    arr_free(stack);
+    return start;
+}
+
+static void set_start(nnode_t *start, bool prepend, FSM_t *FSM)
+{
     if (prepend) {
         range_a range;
         arr_init(range);
-        arr_push(range, ((range_t){ 32, 127 }));
-        arr_push(range, ((range_t){ '\t', '\t' }));
-        nnode_t *node = new_char_node(&range);
+        prepend_range(&range);
+        nnode_t *node = new_char_node(&range, FSM);
+        arr_free(range);
 
         nnode_t *branch;
         /* NON-Greedy */
-        branch = new_branch_node(stack.v[0].node, node);
+        branch = new_branch_node(start, node, FSM);
         node->next = branch;
         FSM->NFA = branch;
     } else {
-        FSM->NFA = stack.v[0].node;
+        FSM->NFA = start;
     }
 
 #ifdef DEBUG
-    debug_print_graph(FSM->NFA);
+    debug_print_graph(FSM);
     puts("=============");
 #endif
-    arr_free(stack);
+}
+
+extern void build_NFA(vfrex_t vfrex, bool flip, bool prepend, FSM_t *FSM)
+{
+    set_start(build_graph(vfrex->exp, flip, 0, FSM), prepend, FSM);
 }
 
 #define ptr_cmp(x, y)   (*(x) < *(y))
@@ -339,17 +427,35 @@ static uint32_t state_hash(state_a x)
 QSORT_INIT(nnode_t *, ptr_cmp, node);
 HASH_MAP_INIT(state_a, dnode_t *, state_cmp, state_hash, hash);
 
+/* Start a new visit of the nodes, in which no node is marked yet */
+static void new_visit(FSM_t *FSM)
+{
+    if (!FSM->mark)
+        FSM->mark = mcalloc(FSM->nodes.len, sizeof(uint32_t));
+    if (++FSM->visit == 0) {
+        memset(FSM->mark, 0, FSM->nodes.len * sizeof(uint32_t));
+        FSM->visit = 1;
+    }
+}
+
+/* Mark node in the current visit, return false if it was marked already */
+static bool visit_nnode(nnode_t *node, FSM_t *FSM)
+{
+    if (FSM->mark[node->id] == FSM->visit)
+        return false;
+    FSM->mark[node->id] = FSM->visit;
+    return true;
+}
+
 /* BFS to get through all the branch node to get an initial set of states */
-static void append_nnode(nnode_t *node, state_a *ret)
+static void append_nnode(nnode_t *node, state_a *ret, FSM_t *FSM)
 {
     typedef pair(nnode_t *, bool) pair_t;
     array(pair_t) stack;
 
-    if (node->last != timeline) {
-        node->last = timeline;
-        arr_init(stack);
+    arr_init(stack);
+    if (visit_nnode(node, FSM))
         arr_push(stack, ((pair_t){node, true}));
-    }
 
     while (stack.len) {
         nnode_t *cnode = arr_back(stack).a;
@@ -357,93 +463,173 @@ static void append_nnode(nnode_t *node, state_a *ret)
             /* first time */
             arr_back(stack).b = false;
 
-            if (cnode->kind != NODE_BRANCH) {
+            if (cnode->kind == NODE_NULL || cnode->kind == NODE_SAVE) {
+                /* a zero length char, go through it */
+                arr_pop(stack);
+                if (visit_nnode(cnode->next, FSM))
+                    arr_push(stack, ((pair_t){cnode->next, true}));
+            } else if (cnode->kind != NODE_BRANCH) {
                 arr_push(*ret, cnode);
                 arr_pop(stack);
             } else {
-                if (cnode->next->last != timeline) {
-                    cnode->next->last = timeline;
+                if (visit_nnode(cnode->next, FSM))
                     arr_push(stack, ((pair_t){cnode->next, true}));
-                }
             }
         } else {
             /* second time */
             arr_pop(stack);
-            if (cnode->next0->last != timeline) {
-                cnode->next0->last = timeline;
+            if (visit_nnode(cnode->next0, FSM))
                 arr_push(stack, ((pair_t){cnode->next0, true}));
-            }
         }
     }
     arr_free(stack);
 }
 
-static void handle_dnode(dnode_t *node, FSM_t *FSM)
+static dnode_t *new_dnode(FSM_t *FSM)
 {
-    hash_insert(FSM->hash, node->states, node);
-    arr_for(state, node->states)
-        if ((*state)->kind == NODE_ACCEPT) {
-            node->is_accept = true;
-            break;
-        }
+    UNUSED(FSM);
+    return mcalloc(1, sizeof(dnode_t));
 }
 
-static dnode_t *next_dnode(dnode_t *node, uchar c, FSM_t *FSM)
+/* the memory a dnode with len NFA states takes in the cache, its row of
+ * the table included */
+static size_t dnode_size(FSM_t *FSM, size_t len)
 {
-    if (node->to[c])
-        return node->to[c];
+    return sizeof(dnode_t) + FSM->stride * sizeof(uint32_t) + DFA_ACCEL_SIZE +
+           len * sizeof(nnode_t *) + sizeof(hash_node_t);
+}
 
+/* the states node goes to on c, in the order of priority */
+static state_a next_states(dnode_t *node, uchar c, FSM_t *FSM)
+{
     state_a nstates;
     arr_init(nstates);
 
-    /* clean the hash */
-    ++timeline;
+    new_visit(FSM);
     arr_for(state, node->states)
         if ((*state)->kind == NODE_CHAR)
             arr_for(range, (*state)->range)
                 if (range->lower <= c && c <= range->upper) {
-                    append_nnode((*state)->next, &nstates);
+                    append_nnode((*state)->next, &nstates, FSM);
                     break;
                 }
+    return nstates;
+}
 
-    if (nstates.len == 0)
-        return NULL;
+/* Find out whether node leaves itself on at most DFA_MAX_ACCEL bytes.  An
+ * accepting state is never accelerated, as the match loops have to look at
+ * every byte there */
+static void accel_dnode(dnode_t *node, FSM_t *FSM)
+{
+    uchar *accel = FSM->accel + node->id * DFA_ACCEL_SIZE;
+    accel[0] = DFA_NO_ACCEL;
+    if (node->is_accept)
+        return;
+    if (FSM->prefilter && node == FSM->DFA) {
+        accel[0] = DFA_PREFIX;
+        return;
+    }
 
-    /* qsort_node(nstates.v, nstates.v + nstates.len); */
+    /* 0 for unknown, 1 for a loop, 2 for an exit */
+    uchar loop[256] = { 0 };
+    uchar n         = 0;
+    for (int c = 0; c < 256; ++c) {
+        uchar k = FSM->byte_class[c];
+        if (!loop[k]) {
+            state_a nstates = next_states(node, (uchar)c, FSM);
+            bool    same    = nstates.len == node->states.len &&
+                              !memcmp(nstates.v, node->states.v,
+                                      nstates.len * sizeof(nnode_t *));
+            loop[k] = same ? 1 : 2;
+            arr_free(nstates);
+        }
+        if (loop[k] == 2) {
+            if (n == DFA_MAX_ACCEL)
+                return;
+            accel[++n] = (uchar)c;
+        }
+    }
+    accel[0] = n;
+}
 
-    dnode_t **target = hash_find(FSM->hash, nstates);
-    if (target) {
-        node->to[c] = *target;
-        arr_free(nstates);
-        return *target;
+/* Make room for more rows.  A match may still be in the old table of a
+ * shared cache, so the new one is published only once it has the old rows,
+ * and the old one is kept until the cache is freed.  So are the dnodes of
+ * the rows, which a match leaving the cache reads without its lock */
+static void grow_table(FSM_t *FSM)
+{
+    size_t capacity = FSM->capacity * 2 + 2;
+    size_t row      = FSM->stride * sizeof(uint32_t);
+    if (!FSM->concurrent) {
+        FSM->trans = mrealloc(FSM->trans, capacity * row);
+        FSM->accel = mrealloc(FSM->accel, capacity * DFA_ACCEL_SIZE);
+        FSM->capacity = capacity;
+        return;
     }
 
-    dnode_t *p = mcalloc(1, sizeof(dnode_t));
-    node->to[c] = p;
-    p->states = nstates;
-    handle_dnode(p, FSM);
-    return p;
+    uint32_t *trans = mmalloc(capacity * row);
+    uchar    *accel = mmalloc(capacity * DFA_ACCEL_SIZE);
+    dnode_t **rows  = mmalloc(capacity * sizeof(dnode_t *));
+    if (FSM->capacity) {
+        memcpy(trans, FSM->trans, FSM->capacity * row);
+        memcpy(accel, FSM->accel, FSM->capacity * DFA_ACCEL_SIZE);
+        memcpy(rows, FSM->rows.v, FSM->rows.len * sizeof(dnode_t *));
+        arr_push(FSM->retired, FSM->trans);
+        arr_push(FSM->retired, FSM->accel);
+        arr_push(FSM->retired, FSM->rows.v);
+    }
+    __atomic_store_n(&FSM->trans, trans, __ATOMIC_RELEASE);
+    __atomic_store_n(&FSM->accel, accel, __ATOMIC_RELEASE);
+    __atomic_store_n(&FSM->rows.v, rows, __ATOMIC_RELEASE);
+    FSM->rows.mem_size = capacity;
+    FSM->capacity      = capacity;
 }
 
-static dnode_t *strip_dnode(dnode_t *node, FSM_t *FSM)
+/* Give the dnode a row of unknown transitions and put it into the cache */
+static void handle_dnode(dnode_t *node, FSM_t *FSM)
 {
+    hash_insert(FSM->hash, node->states, node);
+    FSM->DFA_size += dnode_size(FSM, node->states.len);
     arr_for(state, node->states)
         if ((*state)->kind == NODE_ACCEPT) {
-            dnode_t *p = mcalloc(1, sizeof(dnode_t));
-            p->states.len = (size_t)(state - node->states.v);
-            p->states.v = mmalloc(sizeof(void *) * p->states.len);
-            memcpy(p->states.v, node->states.v, sizeof(void *) * p->states.len);
-
-            dnode_t **target = hash_find(FSM->hash, p->states);
-            if (target) {
-                arr_free(p->states);
-                return *target;
-            }
-            handle_dnode(p, FSM);
-            return p;
+            node->is_accept = true;
+            break;
         }
-    assert(0);
-    return NULL;
+
+    if (FSM->state_number == FSM->capacity)
+        grow_table(FSM);
+    node->id = (uint32_t)FSM->state_number++;
+    for (size_t k = 0; k < FSM->stride; ++k)
+        FSM->trans[node->id * FSM->stride + k] = DFA_UNKNOWN;
+    arr_push(FSM->rows, node);
+    accel_dnode(node, FSM);
+}
+
+/* free all the dnodes in the cache and the table.  All of them are in the
+ * hash */
+static void clear_cache(FSM_t *FSM)
+{
+    arr_for(table, FSM->retired)
+        mfree(*table);
+    arr_free(FSM->retired);
+    arr_init(FSM->retired);
+    if (FSM->hash) {
+        for (size_t i = 0; i < FSM->hash->hsize; ++i)
+            for (hash_node_t *p = FSM->hash->hlist[i]; p; p = p->next) {
+                arr_free(p->value->states);
+                mfree(p->value);
+            }
+        hash_free(FSM->hash);
+        cleanup(FSM->hash);
+    }
+    arr_free(FSM->rows);
+    arr_init(FSM->rows);
+    cleanup(FSM->trans);
+    cleanup(FSM->accel);
+    FSM->state_number = 0;
+    FSM->capacity     = 0;
+    FSM->DFA          = NULL;
+    FSM->DFA_size     = 0;
 }
 
 static void init_match(FSM_t *FSM)
@@ -453,176 +639,1162 @@ static void init_match(FSM_t *FSM)
         hash_init(FSM->hash);
     }
     if (!FSM->DFA) {
-        FSM->DFA_size = 1;
-
-        FSM->DFA = mcalloc(1, sizeof(dnode_t));
+        FSM->DFA = new_dnode(FSM);
         arr_init(FSM->DFA->states);
 
-        ++timeline;
-        append_nnode(FSM->NFA, &FSM->DFA->states);
+        new_visit(FSM);
+        append_nnode(FSM->NFA, &FSM->DFA->states, FSM);
         /* qsort_node(FSM->DFA->states.v, */
         /*            FSM->DFA->states.v + FSM->DFA->states.len); */
         handle_dnode(FSM->DFA, FSM);
     }
 }
 
+/* Get the dnode of states, which are owned by the cache after the call.  If
+ * the cache has no room for a new dnode, it is cleared first, so any dnode
+ * or row the caller holds is invalid afterwards unless it is the returned
+ * one. */
+static dnode_t *intern_dnode(state_a states, FSM_t *FSM)
+{
+    dnode_t **target = hash_find(FSM->hash, states);
+    if (target) {
+        arr_free(states);
+        return *target;
+    }
+
+    /* the rows have to be addressable by an entry as well */
+    if ((FSM->cache_limit &&
+         FSM->DFA_size + dnode_size(FSM, states.len) > FSM->cache_limit) ||
+        (FSM->state_number + 1) * FSM->stride > DFA_STATE) {
+        /* a match may be anywhere in a shared cache, so it is only filled */
+        if (FSM->concurrent) {
+            __atomic_store_n(&FSM->full, true, __ATOMIC_RELEASE);
+            arr_free(states);
+            return NULL;
+        }
+        clear_cache(FSM);
+        ++FSM->cache_reset;
+        init_match(FSM);
+
+        if (!FSM->stream &&
+            FSM->cache_reset - FSM->reset_mark > DFA_MAX_RESET) {
+            FSM->give_up = true;
+            arr_free(states);
+            return NULL;
+        }
+
+        target = hash_find(FSM->hash, states);
+        if (target) {
+            arr_free(states);
+            return *target;
+        }
+    }
+
+    dnode_t *p = new_dnode(FSM);
+    p->states = states;
+    handle_dnode(p, FSM);
+    return p;
+}
+
+/* The dnode of the states a dnode goes to, NULL for none */
+static dnode_t *states_dnode(state_a nstates, FSM_t *FSM)
+{
+    if (nstates.len == 0) {
+        arr_free(nstates);
+        return NULL;
+    }
+
+    /* qsort_node(nstates.v, nstates.v + nstates.len); */
+    return intern_dnode(nstates, FSM);
+}
+
+static dnode_t *next_dnode(dnode_t *node, uchar c, FSM_t *FSM)
+{
+    return states_dnode(next_states(node, c, FSM), FSM);
+}
+
+static dnode_t *strip_dnode(dnode_t *node, FSM_t *FSM)
+{
+    arr_for(state, node->states)
+        if ((*state)->kind == NODE_ACCEPT) {
+            state_a nstates;
+            nstates.len      = (size_t)(state - node->states.v);
+            nstates.mem_size = nstates.len;
+            nstates.v        = mmalloc(sizeof(void *) * nstates.len);
+            memcpy(nstates.v, node->states.v, sizeof(void *) * nstates.len);
+            return intern_dnode(nstates, FSM);
+        }
+    assert(0);
+    return NULL;
+}
+
+/* the offset of the row of state id, tagged if the state is accelerated */
+static uint32_t row_entry(uint32_t id, FSM_t *FSM)
+{
+    uint32_t accel = FSM->accel[id * DFA_ACCEL_SIZE] == DFA_NO_ACCEL ?
+                     0 : DFA_ACCEL;
+    return id * (uint32_t)FSM->stride | accel;
+}
+
+/* The entry of a transition to node.  NULL is the dead state */
+static uint32_t tag_dnode(dnode_t *node, FSM_t *FSM)
+{
+    if (!node)
+        return DFA_DEAD;
+    if (!node->is_accept)
+        return row_entry(node->id, FSM);
+    if (!FSM->boundary)
+        return DFA_MATCH | row_entry(node->id, FSM);
+    if (node->states.v[0]->kind == NODE_ACCEPT)
+        return DFA_MATCH | DFA_DEAD;
+    node = strip_dnode(node, FSM);
+    return DFA_MATCH | (node ? row_entry(node->id, FSM) : DFA_DEAD);
+}
+
+/* A shared cache is only locked to intern a state and publish an entry,
+ * the closure of the entry being taken before, so a writer spins for the
+ * lock.  After this many tries it yields the CPU between them, in case the
+ * holder was preempted */
+#define DFA_LOCK_SPIN 1024
+
+static void lock_cache(FSM_t *cache)
+{
+    for (int i = 0; ; ++i) {
+        if (!__atomic_load_n(&cache->lock, __ATOMIC_RELAXED) &&
+            !__atomic_test_and_set(&cache->lock, __ATOMIC_ACQUIRE))
+            return;
+        if (i >= DFA_LOCK_SPIN)
+            sched_yield();
+    }
+}
+
+static void unlock_cache(FSM_t *cache)
+{
+    __atomic_clear(&cache->lock, __ATOMIC_RELEASE);
+}
+
+/* the start entry of a shared cache too small to hold the start state,
+ * which is never dead without a match */
+#define DFA_NO_ROOM DFA_DEAD
+
+/* The entry of the start state of a shared cache, made by the first match.
+ * Its start field is DFA_UNKNOWN until then */
+static uint32_t shared_start(FSM_t *cache)
+{
+    uint32_t s = __atomic_load_n(&cache->start, __ATOMIC_ACQUIRE);
+    if (s != DFA_UNKNOWN)
+        return s;
+
+    lock_cache(cache);
+    s = cache->start;
+    if (s == DFA_UNKNOWN) {
+        init_match(cache);
+        s = tag_dnode(cache->DFA, cache);
+        if (cache->full)
+            s = DFA_NO_ROOM;
+        __atomic_store_n(&cache->start, s, __ATOMIC_RELEASE);
+    }
+    unlock_cache(cache);
+    return s;
+}
+
+/* fill_entry in the shared cache the match of FSM is in.  The closure is
+ * taken with the marks of FSM before the lock, which is held only to
+ * intern the states and publish the entry, and another thread may have
+ * done both meanwhile.  DFA_UNKNOWN is returned if the cache is full: a
+ * full cache takes no more entries, so the threads stop locking it */
+static uint32_t fill_shared(FSM_t *FSM, uint32_t s, uchar c)
+{
+    FSM_t *cache = FSM->table;
+    if (__atomic_load_n(&cache->full, __ATOMIC_ACQUIRE))
+        return DFA_UNKNOWN;
+    dnode_t **rows    = __atomic_load_n(&cache->rows.v, __ATOMIC_ACQUIRE);
+    state_a   nstates = next_states(rows[s / cache->stride], c, FSM);
+
+    lock_cache(cache);
+    uint32_t entry = cache->trans[s + cache->byte_class[c]];
+    if (entry == DFA_UNKNOWN && !cache->full) {
+        dnode_t *node = states_dnode(nstates, cache);
+        if (!cache->full)
+            entry = tag_dnode(node, cache);
+        /* at the index again, as the table may have grown */
+        if (cache->full)
+            entry = DFA_UNKNOWN;
+        else
+            __atomic_store_n(&cache->trans[s + cache->byte_class[c]], entry,
+                             __ATOMIC_RELEASE);
+    } else {
+        arr_free(nstates);
+    }
+    unlock_cache(cache);
+    return entry;
+}
+
+/* Move the match from the row at offset s of the shared cache to the same
+ * state in the cache of FSM, and return the offset of its row there.  If
+ * the DFA gives up, a dead entry is returned */
+static uint32_t leave_shared(FSM_t *FSM, uint32_t s)
+{
+    FSM_t    *cache = FSM->table;
+    dnode_t **rows  = __atomic_load_n(&cache->rows.v, __ATOMIC_ACQUIRE);
+    dnode_t  *node  = rows[s / cache->stride];
+    state_a   states;
+    states.len      = node->states.len;
+    states.mem_size = states.len;
+    states.v        = mmalloc(sizeof(void *) * states.len);
+    memcpy(states.v, node->states.v, sizeof(void *) * states.len);
+
+    FSM->table = FSM;
+    init_match(FSM);
+    node = intern_dnode(states, FSM);
+    return node ? node->id * (uint32_t)FSM->stride : DFA_DEAD;
+}
+
+/* The entry of the start state for a new DFA_match, in the shared cache if
+ * it has room for it */
+static uint32_t start_match(FSM_t *FSM)
+{
+    FSM->table = FSM;
+    if (FSM->complete)
+        return FSM->start;
+    FSM->reset_mark = FSM->cache_reset;
+    FSM->give_up    = false;
+    if (FSM->shared) {
+        uint32_t s = shared_start(FSM->shared);
+        if (s != DFA_NO_ROOM) {
+            FSM->table = FSM->shared;
+            return s;
+        }
+        ++FSM->cache_leave;
+    }
+    init_match(FSM);
+    return tag_dnode(FSM->DFA, FSM);
+}
+
+/* The slow path of the match loops: compute the unknown transition from the
+ * row at offset s on char c.  The entry is cached unless the cache was
+ * cleared meanwhile, in which case the returned entry is in the new table
+ * and s is gone.  If the DFA gives up, a dead entry is returned.  A match
+ * goes on in the cache of FSM when the shared cache is full. */
+static uint32_t fill_entry(FSM_t *FSM, uint32_t s, uchar c)
+{
+    assert(!FSM->complete);
+    if (FSM->table != FSM) {
+        uint32_t entry = fill_shared(FSM, s, c);
+        if (entry != DFA_UNKNOWN)
+            return entry;
+        ++FSM->cache_leave;
+        s = leave_shared(FSM, s);
+        if (s & DFA_DEAD)
+            return s;
+    }
+    size_t   reset = FSM->cache_reset;
+    dnode_t *node  = next_dnode(FSM->rows.v[s / FSM->stride], c, FSM);
+    uint32_t entry = tag_dnode(node, FSM);
+    if (reset == FSM->cache_reset)
+        FSM->trans[s + FSM->byte_class[c]] = entry;
+    return entry;
+}
+
+typedef array(uint32_t) uint32_a;
+
+/* Fill every entry of the lazy DFA reachable from the start state, and turn
+ * the table into a complete one.  Give up if the table would be larger than
+ * the cache limit. */
+static bool build_table(FSM_t *FSM)
+{
+    uchar rep[256];
+    for (int c = 255; c >= 0; --c)
+        rep[FSM->byte_class[c]] = (uchar)c;
+
+    size_t limit     = FSM->cache_limit;
+    FSM_t *shared    = FSM->shared;
+    FSM->cache_limit = 0;
+    FSM->shared      = NULL;
+    uint32_t start   = start_match(FSM);
+
+    bool ok = true;
+    for (size_t i = 0; i < FSM->state_number; ++i) {
+        if ((limit && FSM->state_number * FSM->stride * sizeof(uint32_t) > limit) ||
+            FSM->give_up) {
+            ok = false;
+            break;
+        }
+        for (size_t k = 0; k < FSM->stride; ++k)
+            if (FSM->trans[i * FSM->stride + k] == DFA_UNKNOWN)
+                fill_entry(FSM, (uint32_t)(i * FSM->stride), rep[k]);
+    }
+    FSM->cache_limit = limit;
+    FSM->shared      = shared;
+
+    if (!ok) {
+        clear_cache(FSM);
+        return false;
+    }
+    uint32_t *trans = FSM->trans;
+    size_t    n     = FSM->state_number;
+    FSM->trans = NULL;
+    clear_cache(FSM);
+    FSM->trans        = trans;
+    FSM->state_number = n;
+    FSM->capacity     = n;
+    FSM->start        = start;
+    FSM->complete     = true;
+    return true;
+}
+
+typedef struct partition_t {
+    uint32_t *elem;
+    uint32_t *loc;     /* state -> position in elem */
+    uint32_t *block;   /* state -> block */
+    uint32_t *first;   /* block -> first position in elem */
+    uint32_t *end;
+    uint32_t *mark;    /* block -> number of marked states */
+    uint32_t  size;
+} partition_t;
+
+static void mark_state(partition_t *P, uint32_t s, uint32_a *touched)
+{
+    uint32_t b = P->block[s];
+    uint32_t i = P->loc[s];
+    uint32_t j = P->first[b] + P->mark[b];
+    if (i < j)
+        return;
+    if (!P->mark[b])
+        arr_push(*touched, b);
+    uint32_t t = P->elem[j];
+    P->elem[j] = s;
+    P->loc[s]  = j;
+    P->elem[i] = t;
+    P->loc[t]  = i;
+    ++P->mark[b];
+}
+
+/* Split the touched blocks into the marked and the unmarked part.  Without
+ * work the new blocks are not queued, which is used for the initial
+ * partition. */
+static void split_marked(partition_t *P, uint32_a *touched,
+                         bool *pending, uint32_a *work)
+{
+    arr_for(pb, *touched) {
+        uint32_t b = *pb;
+        uint32_t m = P->mark[b];
+        P->mark[b] = 0;
+        if (m == P->end[b] - P->first[b])
+            continue;
+
+        uint32_t nb = P->size++;
+        P->first[nb] = P->first[b];
+        P->end[nb]   = P->first[b] + m;
+        P->mark[nb]  = 0;
+        P->first[b]  = P->end[nb];
+        for (uint32_t i = P->first[nb]; i < P->end[nb]; ++i)
+            P->block[P->elem[i]] = nb;
+
+        if (!work)
+            continue;
+        /* Hopcroft's trick: if b is still waiting, both halves have to be
+         * processed, otherwise the smaller half is enough */
+        uint32_t x = nb;
+        if (!pending[b] && P->end[b] - P->first[b] < m)
+            x = b;
+        if (!pending[x]) {
+            pending[x] = true;
+            arr_push(*work, x);
+        }
+    }
+    touched->len = 0;
+}
+
+/* Where state s goes on class k, the dead state is sink */
+#define table_next(FSM, s, k, sink) ({                                  \
+    uint32_t _v = (FSM)->trans[(s) * (FSM)->stride + (k)];              \
+    (_v & DFA_DEAD) ? (sink) : (_v & DFA_STATE) / (uint32_t)(FSM)->stride; \
+})
+
+/* Minimize the table with Hopcroft's algorithm and renumber the states in
+ * BFS order from the start state, so that the states used most often sit
+ * next to each other. */
+static void minimize_table(FSM_t *FSM)
+{
+    uint32_t n    = (uint32_t)FSM->state_number;
+    uint32_t N    = n + 1;      /* the dead state is n */
+    uint32_t K    = (uint32_t)FSM->stride;
+    uint32_t sink = n;
+
+    /* predecessors of each state on each class */
+    uint32_t *head = mcalloc((size_t)K * N + 1, sizeof(uint32_t));
+    uint32_t *pred = mmalloc((size_t)K * N * sizeof(uint32_t));
+    for (uint32_t s = 0; s < N; ++s)
+        for (uint32_t k = 0; k < K; ++k) {
+            uint32_t t = s == sink ? sink : table_next(FSM, s, k, sink);
+            ++head[k * N + t + 1];
+        }
+    for (size_t i = 1; i <= (size_t)K * N; ++i)
+        head[i] += head[i-1];
+    uint32_t *fill = mmalloc((size_t)K * N * sizeof(uint32_t));
+    memcpy(fill, head, (size_t)K * N * sizeof(uint32_t));
+    for (uint32_t s = 0; s < N; ++s)
+        for (uint32_t k = 0; k < K; ++k) {
+            uint32_t t = s == sink ? sink : table_next(FSM, s, k, sink);
+            pred[fill[k * N + t]++] = s;
+        }
+    mfree(fill);
+
+    partition_t P;
+    P.elem  = mmalloc(N * sizeof(uint32_t));
+    P.loc   = mmalloc(N * sizeof(uint32_t));
+    P.block = mcalloc(N, sizeof(uint32_t));
+    P.first = mcalloc(N, sizeof(uint32_t));
+    P.end   = mcalloc(N, sizeof(uint32_t));
+    P.mark  = mcalloc(N, sizeof(uint32_t));
+    P.size  = 1;
+    P.end[0] = N;
+    for (uint32_t s = 0; s < N; ++s)
+        P.elem[s] = P.loc[s] = s;
+
+    uint32_a touched, work, splitter;
+    arr_init(touched);
+    arr_init(work);
+    arr_init(splitter);
+    bool *pending = mcalloc(N, sizeof(bool));
+
+    /* states are only equivalent if they match on the same classes */
+    for (uint32_t k = 0; k < K; ++k) {
+        for (uint32_t s = 0; s < n; ++s)
+            if (FSM->trans[s * K + k] & DFA_MATCH)
+                mark_state(&P, s, &touched);
+        split_marked(&P, &touched, NULL, NULL);
+    }
+    for (uint32_t b = 0; b < P.size; ++b) {
+        pending[b] = true;
+        arr_push(work, b);
+    }
+
+    while (work.len) {
+        uint32_t A = arr_pop(work);
+        pending[A] = false;
+        splitter.len = 0;
+        for (uint32_t i = P.first[A]; i < P.end[A]; ++i)
+            arr_push(splitter, P.elem[i]);
+
+        for (uint32_t k = 0; k < K; ++k) {
+            arr_for(t, splitter)
+                for (uint32_t i = head[k * N + *t]; i < head[k * N + *t + 1]; ++i)
+                    mark_state(&P, pred[i], &touched);
+            split_marked(&P, &touched, pending, &work);
+        }
+    }
+
+    /* renumber the blocks in BFS order from the start state */
+    uint32_t sink_block = P.block[sink];
+    uint32_t *id        = mmalloc(P.size * sizeof(uint32_t));
+    for (uint32_t b = 0; b < P.size; ++b)
+        id[b] = UINT32_MAX;
+
+    uint32_a queue;
+    arr_init(queue);
+    uint32_t start = FSM->start & DFA_DEAD ? sink_block :
+                     P.block[(FSM->start & DFA_STATE) / K];
+    if (start != sink_block) {
+        id[start] = 0;
+        arr_push(queue, start);
+    }
+    for (size_t i = 0; i < queue.len; ++i) {
+        uint32_t s = P.elem[P.first[queue.v[i]]];
+        for (uint32_t k = 0; k < K; ++k) {
+            uint32_t b = P.block[table_next(FSM, s, k, sink)];
+            if (b != sink_block && id[b] == UINT32_MAX) {
+                id[b] = (uint32_t)queue.len;
+                arr_push(queue, b);
+            }
+        }
+    }
+
+#define retag(v, b) (((v) & DFA_MATCH) | \
+                     ((b) == sink_block ? DFA_DEAD : id[b] * K))
+    uint32_t *trans = mmalloc(queue.len * K * sizeof(uint32_t));
+    for (size_t i = 0; i < queue.len; ++i) {
+        uint32_t s = P.elem[P.first[queue.v[i]]];
+        for (uint32_t k = 0; k < K; ++k)
+            trans[i * K + k] = retag(FSM->trans[s * K + k],
+                                     P.block[table_next(FSM, s, k, sink)]);
+    }
+    FSM->start = retag(FSM->start, start);
+#undef retag
+
+    mfree(FSM->trans);
+    FSM->trans        = trans;
+    FSM->state_number = queue.len;
+    FSM->capacity     = queue.len;
+
+    arr_free(queue);
+    arr_free(touched);
+    arr_free(work);
+    arr_free(splitter);
+    mfree(id);
+    mfree(pending);
+    mfree(head);
+    mfree(pred);
+    mfree(P.elem);
+    mfree(P.loc);
+    mfree(P.block);
+    mfree(P.first);
+    mfree(P.end);
+    mfree(P.mark);
+}
+
+/* Find the accelerated rows of a complete table from the table itself, and
+ * tag the entries going to them */
+static void accel_table(FSM_t *FSM)
+{
+    uint32_t  K     = (uint32_t)FSM->stride;
+    uint32_t *trans = FSM->trans;
+
+    FSM->accel = mrealloc(FSM->accel, FSM->state_number * DFA_ACCEL_SIZE);
+    for (uint32_t i = 0; i < FSM->state_number; ++i) {
+        uchar *accel = FSM->accel + i * DFA_ACCEL_SIZE;
+        uchar  n     = 0;
+        accel[0] = DFA_NO_ACCEL;
+        for (int c = 0; c < 256; ++c)
+            if ((trans[i * K + FSM->byte_class[c]] & ~DFA_ACCEL) != i * K) {
+                if (n == DFA_MAX_ACCEL)
+                    goto next;
+                accel[++n] = (uchar)c;
+            }
+        accel[0] = n;
+    next:
+        ;
+    }
+    if (FSM->prefilter && !(FSM->start & DFA_DEAD))
+        FSM->accel[(FSM->start & DFA_STATE) / K * DFA_ACCEL_SIZE] = DFA_PREFIX;
+
+    for (size_t i = 0; i < FSM->state_number * K; ++i)
+        if (!(trans[i] & DFA_DEAD))
+            trans[i] = (trans[i] & DFA_MATCH) |
+                       row_entry((trans[i] & DFA_STATE) / K, FSM);
+    if (!(FSM->start & DFA_DEAD))
+        FSM->start = (FSM->start & DFA_MATCH) |
+                     row_entry((FSM->start & DFA_STATE) / K, FSM);
+}
+
+/* Skip the bytes on which the accelerated state at entry s loops: return
+ * the first exit byte of it in [p, end), or end.  The start state with a
+ * prefilter skips to the next place one of the literals starts instead */
+static const uchar *accel_scan(FSM_t *FSM, uint32_t s,
+                               const uchar *p, const uchar *end)
+{
+    const uchar *accel = __atomic_load_n(&FSM->table->accel, __ATOMIC_ACQUIRE);
+    accel += (s & DFA_STATE) / FSM->stride * DFA_ACCEL_SIZE;
+    size_t n = accel[0];
+    if (n == DFA_PREFIX)
+        return FSM->prefilter ? prefilter_scan(FSM->prefilter, p, end) : p;
+    if (n == 0)
+        return end;
+    return scan_bytes(accel + 1, n, p, end);
+}
+
+/* The match loops over the table.  An unknown entry has the dead tag, so
+ * the fast path is one load and one test of the tags.  When the loops enter
+ * an accelerated state, they jump to the byte before its next exit.  The
+ * entries are loaded with acquire, which is a plain load on x86, since
+ * another thread may be filling a shared cache. */
+
+/* the table the current match is in, which a shared cache may have moved */
+static uint32_t *match_table(FSM_t *FSM)
+{
+    return __atomic_load_n(&FSM->table->trans, __ATOMIC_ACQUIRE);
+}
+
+#define load_entry(trans, s, c) \
+    __atomic_load_n(&(trans)[((s) & DFA_STATE) + (c)], __ATOMIC_ACQUIRE)
+
+static bool table_full(FSM_t *FSM, const uchar *text, const uchar *end)
+{
+    uint32_t     s     = start_match(FSM);
+    uint32_t    *trans = match_table(FSM);
+    const uchar *cls   = FSM->byte_class;
+    const uchar *c     = text;
+
+    if (s & DFA_DEAD)
+        return c == end && (s & DFA_MATCH);
+    if (s & DFA_ACCEL)
+        c = accel_scan(FSM, s, c, end);
+    for (; c < end; ++c) {
+        uint32_t t = load_entry(trans, s, cls[*c]);
+        if (t & DFA_TAG) {
+            if (t == DFA_UNKNOWN) {
+                t     = fill_entry(FSM, s & DFA_STATE, *c);
+                trans = match_table(FSM);
+            }
+            if (t & DFA_DEAD)
+                return c+1 == end && (t & DFA_MATCH);
+            if (t & DFA_ACCEL)
+                c = accel_scan(FSM, t, c+1, end) - 1;
+        }
+        s = t;
+    }
+    return s & DFA_MATCH;
+}
+
+static bool table_partial(FSM_t *FSM, const uchar *text, const uchar *end)
+{
+    uint32_t     s     = start_match(FSM);
+    uint32_t    *trans = match_table(FSM);
+    const uchar *cls   = FSM->byte_class;
+    const uchar *c     = text;
+
+    if (s & (DFA_MATCH | DFA_DEAD))
+        return s & DFA_MATCH;
+    if (s & DFA_ACCEL)
+        c = accel_scan(FSM, s, c, end);
+    for (; c < end; ++c) {
+        uint32_t t = load_entry(trans, s, cls[*c]);
+        if (t & DFA_TAG) {
+            if (t == DFA_UNKNOWN) {
+                t     = fill_entry(FSM, s & DFA_STATE, *c);
+                trans = match_table(FSM);
+            }
+            if (t & (DFA_MATCH | DFA_DEAD))
+                return t & DFA_MATCH;
+            if (t & DFA_ACCEL)
+                c = accel_scan(FSM, t, c+1, end) - 1;
+        }
+        s = t;
+    }
+    return false;
+}
+
+/* the end of the leftmost match, NULL for not found */
+static const uchar *table_forward(FSM_t *FSM, const uchar *text,
+                                  const uchar *end)
+{
+    uint32_t     s     = start_match(FSM);
+    uint32_t    *trans = match_table(FSM);
+    const uchar *cls   = FSM->byte_class;
+    const uchar *right = NULL;
+    const uchar *c     = text;
+
+    if (s & DFA_MATCH)
+        right = text;
+    if (s & DFA_DEAD)
+        return right;
+    if (s & DFA_ACCEL)
+        c = accel_scan(FSM, s, c, end);
+    for (; c < end; ++c) {
+        uint32_t t = load_entry(trans, s, cls[*c]);
+        if (t & DFA_TAG) {
+            if (t == DFA_UNKNOWN) {
+                t     = fill_entry(FSM, s & DFA_STATE, *c);
+                trans = match_table(FSM);
+            }
+            if (t & DFA_MATCH)
+                right = c+1;
+            if (t & DFA_DEAD)
+                break;
+            if (t & DFA_ACCEL)
+                c = accel_scan(FSM, t, c+1, end) - 1;
+        }
+        s = t;
+    }
+    return right;
+}
+
+/* the start of the longest match ending at right.  The match is short in
+ * general, so this one is not accelerated */
+static const uchar *table_backward(FSM_t *FSM, const uchar *text,
+                                   const uchar *right)
+{
+    uint32_t     s     = start_match(FSM);
+    uint32_t    *trans = match_table(FSM);
+    const uchar *cls   = FSM->byte_class;
+    const uchar *left  = NULL;
+
+    if (s & DFA_MATCH)
+        left = right;
+    if (s & DFA_DEAD)
+        return left;
+    for (const uchar *c = right-1; c >= text; --c) {
+        uint32_t t = load_entry(trans, s, cls[*c]);
+        if (t & (DFA_MATCH | DFA_DEAD)) {
+            if (t == DFA_UNKNOWN) {
+                t     = fill_entry(FSM, s & DFA_STATE, *c);
+                trans = match_table(FSM);
+            }
+            if (t & DFA_MATCH)
+                left = c;
+            if (t & DFA_DEAD)
+                break;
+        }
+        s = t;
+    }
+    return left;
+}
+
+/* No match starts before the returned position, which is NULL if there is
+ * no match at all.  The first occurrence i of the inner literal at or after
+ * a match start is where the literal of that match is, as the part before
+ * it never has its first byte.  So the leftmost start of the part before i
+ * is no later than the first match, and if there is none, no match starts
+ * up to i */
+static const uchar *inner_start(vfrex_t vfrex, const uchar *text,
+                                const uchar *end)
+{
+    for (;;) {
+        const uchar *i = prefilter_scan(vfrex->inner, text, end);
+        if (i == end)
+            return NULL;
+        const uchar *s = table_backward(vfrex->FSM[2], text, i);
+        if (vfrex->FSM[2]->give_up)
+            return NULL;
+        if (s)
+            return s;
+        text = i + 1;
+    }
+}
+
+/* An empty shared cache of the FSM, which has an empty cache as well */
+static FSM_t *share_cache(const FSM_t *FSM)
+{
+    FSM_t *cache = mmalloc(sizeof(FSM_t));
+    *cache = *FSM;
+    cache->borrow_graph = true;
+    cache->concurrent   = true;
+    cache->start        = DFA_UNKNOWN;
+    /* the matches take their closures with marks of their own */
+    cache->mark         = NULL;
+    cache->visit        = 0;
+    return cache;
+}
+
 /* compile current regular expression into a NFA graph */
 extern void DFA_compile(vfrex_t vfrex)
 {
-    assert(vfrex->algorithm == REGEX_DFA);
+    assert(vfrex->algorithm == REGEX_DFA ||
+           vfrex->algorithm == REGEX_ONE_PASS ||
+           vfrex->algorithm == REGEX_GLUSHKOV);
     assert(vfrex->exp.len);
 
     switch (vfrex->option.match) {
     case REGEX_MATCH_FULL_BOOL:
         vfrex->FSM[0] = mcalloc(1, sizeof(FSM_t));
+        build_byte_class(vfrex, vfrex->FSM[0]);
         build_NFA(vfrex, false, false, vfrex->FSM[0]);
         break;
 
     case REGEX_MATCH_PARTIAL_BOOL:
         vfrex->FSM[0] = mcalloc(1, sizeof(FSM_t));
+        build_byte_class(vfrex, vfrex->FSM[0]);
         build_NFA(vfrex, false, true, vfrex->FSM[0]);
         break;
 
     case REGEX_MATCH_PARTIAL_BOUNDARY:
+    /* the one-pass DFA looks for the groups in the boundary found here */
+    case REGEX_MATCH_PARTIAL_SUBMATCH:
         vfrex->FSM[0] = mcalloc(1, sizeof(FSM_t));
         vfrex->FSM[1] = mcalloc(1, sizeof(FSM_t));
+        build_byte_class(vfrex, vfrex->FSM[0]);
+        build_byte_class(vfrex, vfrex->FSM[1]);
         build_NFA(vfrex, false, true, vfrex->FSM[0]);
         build_NFA(vfrex, true, false, vfrex->FSM[1]);
+        vfrex->FSM[0]->boundary = true;
         break;
 
     case REGEX_MATCH_FULL_SUBMATCH:
-    case REGEX_MATCH_PARTIAL_SUBMATCH:
         assert(0);
         break;
     }
-    ++timeline;
+    /* the forward FSM of a partial match restarts in its start state, so
+     * that state may skip to where a match can start */
+    if (vfrex->option.match != REGEX_MATCH_FULL_BOOL) {
+        if (!vfrex->prefilter)
+            vfrex->prefilter = prefilter_build(vfrex);
+        vfrex->FSM[0]->prefilter = vfrex->prefilter;
+    }
+    /* otherwise a literal inside the regex is searched for, and the part
+     * before it is matched backward from there to find where to start */
+    if (vfrex->option.match != REGEX_MATCH_FULL_BOOL && !vfrex->prefilter &&
+        !vfrex->inner)
+        vfrex->inner = prefilter_inner(vfrex, &vfrex->inner_split);
+    if (vfrex->inner) {
+        size_t len     = vfrex->exp.len;
+        vfrex->exp.len = vfrex->inner_split;
+        vfrex->FSM[2]  = mcalloc(1, sizeof(FSM_t));
+        build_byte_class(vfrex, vfrex->FSM[2]);
+        build_NFA(vfrex, true, false, vfrex->FSM[2]);
+        vfrex->exp.len = len;
+    }
+    for (size_t i = 0; i < 3; ++i)
+        if (vfrex->FSM[i]) {
+            vfrex->FSM[i]->cache_limit = vfrex->option.cache_size;
+            vfrex->FSM[i]->stride      = vfrex->FSM[i]->class_number;
+            vfrex->FSM[i]->shared      = share_cache(vfrex->FSM[i]);
+        }
+    if (vfrex->option.full_DFA)
+        DFA_build_table(vfrex);
 }
 
-extern bool DFA_match(const uchar *text, size_t len, vfrex_t vfrex)
+extern bool DFA_build_table(vfrex_t vfrex)
 {
-    assert(vfrex->algorithm == REGEX_DFA);
-    UNUSED(len);
+    assert(vfrex->algorithm == REGEX_DFA ||
+           vfrex->algorithm == REGEX_ONE_PASS ||
+           vfrex->algorithm == REGEX_GLUSHKOV);
+    for (size_t i = 0; i < 3; ++i) {
+        FSM_t *FSM = vfrex->FSM[i];
+        if (!FSM || FSM->complete)
+            continue;
+        if (!build_table(FSM))
+            return false;
+        minimize_table(FSM);
+        accel_table(FSM);
+    }
+    return true;
+}
 
-    dnode_t *node;
+extern bool DFA_match(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_DFA ||
+           vfrex->algorithm == REGEX_ONE_PASS ||
+           vfrex->algorithm == REGEX_GLUSHKOV);
+    FSM_t       *FSM = vfrex->FSM[0];
+    const uchar *end = text + len;
+    const uchar *left, *right;
+    if (vfrex->inner && vfrex->option.match != REGEX_MATCH_FULL_BOOL) {
+        text = inner_start(vfrex, text, end);
+        if (!text)
+            return false;
+    }
     switch (vfrex->option.match) {
     case REGEX_MATCH_FULL_BOOL:
-        init_match(vfrex->FSM[0]);
-        node = vfrex->FSM[0]->DFA;
-        debug_print_dnode(node);
-        for (const uchar *c = text; *c; ++c) {
-            node = next_dnode(node, *c, vfrex->FSM[0]);
-            if (!node)
-                return false;
-            debug_print_dnode(node);
-        }
-        return node->is_accept;
+        return table_full(FSM, text, end);
 
     case REGEX_MATCH_PARTIAL_BOOL:
-        init_match(vfrex->FSM[0]);
-        node = vfrex->FSM[0]->DFA;
-        if (node->is_accept)
-            return true;
-        debug_print_dnode(node);
-        for (const uchar *c = text; *c; ++c) {
-            node = next_dnode(node, *c, vfrex->FSM[0]);
-            debug_print_dnode(node);
-            if (node->is_accept)
-                return true;
-        }
-        return false;
+        return table_partial(FSM, text, end);
 
     case REGEX_MATCH_PARTIAL_BOUNDARY:
-        init_match(vfrex->FSM[0]);
-        node = vfrex->FSM[0]->DFA;
-
-        const uchar *left, *right;
-        bool found = false;
-
-        debug_print_dnode(node);
-        if (node->is_accept) {
-            found = true;
-            right = text;
-            if (node->states.v[0]->kind == NODE_ACCEPT) {
-                vfrex->group_number = 1;
-                vfrex->group_left   = mmalloc(sizeof(void *));
-                vfrex->group_right  = mmalloc(sizeof(void *));
-                *vfrex->group_left  = text;
-                *vfrex->group_right = text;
-                return true;
-            }
-            node = strip_dnode(node, vfrex->FSM[0]);
-            debug_print_dnode(node);
-        }
-        for (const uchar *c = text; *c; ++c) {
-            node = next_dnode(node, *c, vfrex->FSM[0]);
-            if (!node)
-                break;
-            debug_print_dnode(node);
-            if (node->is_accept) {
-                found = true;
-                right = c+1;
-                if (node->states.v[0]->kind == NODE_ACCEPT)
-                    break;
-                node = strip_dnode(node, vfrex->FSM[0]);
-                debug_print_dnode(node);
-            }
-        }
-        if (!found)
+    case REGEX_MATCH_PARTIAL_SUBMATCH:
+        right = table_forward(FSM, text, end);
+        if (!right || FSM->give_up)
             return false;
-
 #ifdef DEBUG
         puts("<><><><><><><>");
 #endif
-        init_match(vfrex->FSM[1]);
-        node = vfrex->FSM[1]->DFA;
-        found = false;
-
-        if (node->is_accept) {
-            found = true;
-            left = right;
-        }
-        debug_print_dnode(node);
-        for (const uchar *c = right-1; c >= text; --c) {
-            node = next_dnode(node, *c, vfrex->FSM[1]);
-            if (!node)
-                break;
-            debug_print_dnode(node);
-            if (node->is_accept) {
-                found = true;
-                left = c;
-            }
-        }
-        assert(found);
+        left = table_backward(vfrex->FSM[1], text, right);
+        if (vfrex->FSM[1]->give_up)
+            return false;
+        assert(left);
 
-        vfrex->group_number = 1;
-        vfrex->group_left   = mmalloc(sizeof(void *));
-        vfrex->group_right  = mmalloc(sizeof(void *));
+        group_reserve(vfrex, 1);
         *vfrex->group_left  = left;
         *vfrex->group_right = right;
         return true;
 
     case REGEX_MATCH_FULL_SUBMATCH:
-    case REGEX_MATCH_PARTIAL_SUBMATCH:
         assert(0);
         break;
     }
     return false;
 }
 
-/* TODO */
+extern bool DFA_give_up(vfrex_t vfrex)
+{
+    for (size_t i = 0; i < 3; ++i)
+        if (vfrex->FSM[i] && vfrex->FSM[i]->give_up)
+            return true;
+    return false;
+}
+
+extern void free_NFA(FSM_t *FSM)
+{
+    if (!FSM->borrow_graph) {
+        arr_for(node, FSM->nodes) {
+            if ((*node)->kind == NODE_CHAR)
+                arr_free((*node)->range);
+            mfree(*node);
+        }
+        arr_free(FSM->nodes);
+    }
+    arr_init(FSM->nodes);
+    FSM->NFA = NULL;
+    cleanup(FSM->mark);
+}
+
+static void free_FSM(FSM_t **FSM)
+{
+    if (!*FSM)
+        return;
+    if ((*FSM)->borrow_table) {
+        (*FSM)->trans = NULL;
+        (*FSM)->accel = NULL;
+    }
+    /* the shared cache belongs to the FSM of the vfrex */
+    if (!(*FSM)->borrow_graph)
+        free_FSM(&(*FSM)->shared);
+    clear_cache(*FSM);
+    free_NFA(*FSM);
+    cleanup(*FSM);
+}
+
+extern void DFA_stream_open(vfrex_t context)
+{
+    assert(context->context);
+    for (size_t i = 0; i < 3; ++i)
+        if (context->FSM[i])
+            context->FSM[i]->stream = true;
+}
+
+extern FSM_t *DFA_stream_suffix(vfrex_t vfrex)
+{
+    if (!vfrex->exp.len)
+        return NULL;
+    FSM_t *FSM = mcalloc(1, sizeof(FSM_t));
+    build_byte_class(vfrex, FSM);
+    build_NFA(vfrex, true, false, FSM);
+    /* A branch to every char node and to the accept node.  Their order
+     * does not matter, as only the accepting places are looked at */
+    size_t   n     = FSM->nodes.len;
+    nnode_t *start = NULL;
+    for (size_t i = 0; i < n; ++i) {
+        nnode_t *node = FSM->nodes.v[i];
+        if (node->kind == NODE_CHAR || node->kind == NODE_ACCEPT)
+            start = start ? new_branch_node(node, start, FSM) : node;
+    }
+    FSM->NFA         = start;
+    FSM->cache_limit = vfrex->option.cache_size;
+    FSM->stride      = FSM->class_number;
+    FSM->stream      = true;
+    return FSM;
+}
+
+extern void DFA_stream_free(FSM_t **suffix)
+{
+    free_FSM(suffix);
+}
+
+extern uint32_t DFA_stream_start(vfrex_t vfrex)
+{
+    return start_match(vfrex->FSM[0]);
+}
+
+/* accel_scan for a stream.  A literal of the prefilter may go on in the
+ * next chunk, so the start state leaves the last bytes to the loop if none
+ * starts before end */
+static const uchar *stream_accel(FSM_t *FSM, uint32_t s,
+                                 const uchar *p, const uchar *end)
+{
+    const uchar *accel = __atomic_load_n(&FSM->table->accel, __ATOMIC_ACQUIRE);
+    accel += (s & DFA_STATE) / FSM->stride * DFA_ACCEL_SIZE;
+    if (accel[0] == DFA_PREFIX && FSM->prefilter)
+        return prefilter_stream_scan(FSM->prefilter, p, end);
+    return accel_scan(FSM, s, p, end);
+}
+
+/* table_forward from the entry of the chunks before */
+extern const uchar *DFA_stream_forward(const uchar *text, const uchar *end,
+                                       uint32_t *s, const uchar **right,
+                                       vfrex_t vfrex)
+{
+    FSM_t       *FSM   = vfrex->FSM[0];
+    uint32_t    *trans = match_table(FSM);
+    const uchar *cls   = FSM->byte_class;
+    const uchar *c     = text;
+    uint32_t     e     = *s;
+
+    assert(!(e & DFA_DEAD));
+    if (e & DFA_ACCEL)
+        c = stream_accel(FSM, e, c, end);
+    for (; c < end; ++c) {
+        uint32_t t = load_entry(trans, e, cls[*c]);
+        if (t & DFA_TAG) {
+            if (t == DFA_UNKNOWN) {
+                t     = fill_entry(FSM, e & DFA_STATE, *c);
+                trans = match_table(FSM);
+            }
+            if (t & DFA_MATCH)
+                *right = c+1;
+            if (t & DFA_DEAD) {
+                *s = t;
+                return c;
+            }
+            if (t & DFA_ACCEL)
+                c = stream_accel(FSM, t, c+1, end) - 1;
+        }
+        e = t;
+    }
+    *s = e;
+    return end;
+}
+
+extern const uchar *DFA_stream_left(const uchar *text, const uchar *right,
+                                    vfrex_t vfrex)
+{
+    return table_backward(vfrex->FSM[1], text, right);
+}
+
+/* table_backward, which tells as well if it ran out of bytes */
+extern const uchar *DFA_stream_keep(const uchar *text, const uchar *end,
+                                    bool *more, FSM_t *suffix)
+{
+    FSM_t       *FSM   = suffix;
+    uint32_t     s     = start_match(FSM);
+    uint32_t    *trans = match_table(FSM);
+    const uchar *cls   = FSM->byte_class;
+    const uchar *left  = end;
+
+    assert(s & DFA_MATCH);
+    *more = !(s & DFA_DEAD);
+    if (!*more)
+        return left;
+    for (const uchar *c = end-1; c >= text; --c) {
+        uint32_t t = load_entry(trans, s, cls[*c]);
+        if (t & (DFA_MATCH | DFA_DEAD)) {
+            if (t == DFA_UNKNOWN) {
+                t     = fill_entry(FSM, s & DFA_STATE, *c);
+                trans = match_table(FSM);
+            }
+            if (t & DFA_MATCH)
+                left = c;
+            if (t & DFA_DEAD) {
+                *more = false;
+                break;
+            }
+        }
+        s = t;
+    }
+    return left;
+}
+
 extern void DFA_free(vfrex_t vfrex)
 {
-    /* TODO TOTALLy Wrong free to eliminate warning */
-    if (vfrex->FSM[0]) {
-        hash_free(vfrex->FSM[0]->hash);
-        vfrex->FSM[0]->hash = NULL;
-        cleanup(vfrex->FSM[0]);
+    for (size_t i = 0; i < 3; ++i)
+        free_FSM(&vfrex->FSM[i]);
+    prefilter_free(&vfrex->prefilter);
+    prefilter_free(&vfrex->inner);
+}
+
+extern void DFA_context(vfrex_t context)
+{
+    for (size_t i = 0; i < 3; ++i) {
+        const FSM_t *FSM = context->FSM[i];
+        if (!FSM)
+            continue;
+        FSM_t *own = mcalloc(1, sizeof(FSM_t));
+        own->NFA          = FSM->NFA;
+        own->nodes        = FSM->nodes;
+        own->cache_limit  = FSM->cache_limit;
+        own->boundary     = FSM->boundary;
+        own->class_number = FSM->class_number;
+        own->stride       = FSM->stride;
+        own->prefilter    = FSM->prefilter;
+        own->borrow_graph = true;
+        memcpy(own->byte_class, FSM->byte_class, sizeof(FSM->byte_class));
+        arr_init(own->rows);
+        /* a complete table is never written by the match loops */
+        if (FSM->complete) {
+            own->trans        = FSM->trans;
+            own->accel        = FSM->accel;
+            own->state_number = FSM->state_number;
+            own->capacity     = FSM->capacity;
+            own->start        = FSM->start;
+            own->complete     = true;
+            own->borrow_table = true;
+        } else {
+            own->shared = FSM->shared;
+        }
+        context->FSM[i] = own;
     }
-    if (vfrex->FSM[1]) {
-        hash_free(vfrex->FSM[1]->hash);
-        vfrex->FSM[1]->hash = NULL;
-        cleanup(vfrex->FSM[1]);
+}
+
+extern void DFA_context_free(vfrex_t context)
+{
+    for (size_t i = 0; i < 3; ++i)
+        free_FSM(&context->FSM[i]);
+}
+
+extern void DFA_set_compile(vfrex_set_t set)
+{
+    bool   split[257] = { false };
+    FSM_t *FSM        = set->FSM = mcalloc(1, sizeof(FSM_t));
+
+    /* the union is a chain of branch nodes, one for each pattern */
+    nnode_t *start = NULL;
+    for (size_t i = set->pattern_number; i-- > 0; ) {
+        symbol_a exp  = set->pattern[i]->exp;
+        nnode_t *node = build_graph(exp, false, (uint32_t)i, FSM);
+        start = start ? new_branch_node(node, start, FSM) : node;
+        split_exp(split, exp);
+    }
+    split_class(split, FSM);
+    set_start(start, set->option.match != REGEX_MATCH_FULL_BOOL, FSM);
+    FSM->cache_limit = set->option.cache_size;
+    FSM->stride      = FSM->class_number;
+}
+
+/* Mark the patterns accepted by the state at entry s */
+static void report_state(vfrex_set_t set, uint32_t s)
+{
+    FSM_t   *FSM  = set->FSM;
+    dnode_t *node = FSM->rows.v[(s & DFA_STATE) / FSM->stride];
+    if (node->reported == set->serial)
+        return;
+    node->reported = set->serial;
+    arr_for(state, node->states)
+        if ((*state)->kind == NODE_ACCEPT && !set->matched[(*state)->slot]) {
+            set->matched[(*state)->slot] = true;
+            ++set->match_number;
+        }
+}
+
+/* Like table_partial and table_full, but a partial match goes on to the
+ * end of text, or until every pattern has matched.  The states are looked
+ * up in FSM->rows, so the table is never built into a complete one */
+extern bool DFA_set_match(const uchar *text, size_t len, vfrex_set_t set)
+{
+    FSM_t       *FSM   = set->FSM;
+    bool         full  = set->option.match == REGEX_MATCH_FULL_BOOL;
+    uint32_t     s     = start_match(FSM);
+    uint32_t    *trans = FSM->trans;
+    const uchar *cls   = FSM->byte_class;
+    const uchar *c     = text;
+    const uchar *end   = text + len;
+
+    ++set->serial;
+    if (!full && (s & DFA_MATCH))
+        report_state(set, s);
+    if (s & DFA_ACCEL)
+        c = accel_scan(FSM, s, c, end);
+    for (; c < end; ++c) {
+        uint32_t t = trans[(s & DFA_STATE) + cls[*c]];
+        if (t & DFA_TAG) {
+            if (t == DFA_UNKNOWN) {
+                t     = fill_entry(FSM, s & DFA_STATE, *c);
+                trans = FSM->trans;
+            }
+            if (t & DFA_DEAD)
+                break;
+            if (!full && (t & DFA_MATCH)) {
+                report_state(set, t);
+                if (set->match_number == set->pattern_number)
+                    break;
+            }
+            if (t & DFA_ACCEL)
+                c = accel_scan(FSM, t, c+1, end) - 1;
+        }
+        s = t;
     }
+    if (full && c == end && (s & DFA_MATCH))
+        report_state(set, s);
+
+    set->scanned += (size_t)(c - text);
+    if (FSM->cache_reset > DFA_MAX_RESET &&
+        set->scanned / FSM->cache_reset < DFA_SET_RESET_BYTES)
+        FSM->give_up = true;
+    return set->match_number > 0;
+}
+
+extern void DFA_set_free(vfrex_set_t set)
+{
+    free_FSM(&set->FSM);
 }
 
 #ifdef DEBUG_MAIN
@@ -654,9 +1826,11 @@ int main(void)
     vfrex.option.style = REGEX_STYLE_POSIX;
     vfrex.option.match = REGEX_MATCH_FULL_BOOL;
 
-    int jmp = setjmp(env);
+    int jmp = setjmp(vfrex.env);
     if (0 == jmp) {
         parser_parse(&vfrex);
+        /* an alternation of literals would go to Teddy */
+        vfrex.algorithm = REGEX_DFA;
         DFA_compile(&vfrex);
         assert( DFA_match((const uchar *)"a", 1, &vfrex));
         assert(!DFA_match((const uchar *)"abcc", 4, &vfrex));
@@ -672,7 +1846,7 @@ int main(void)
     vfrex.regex = (uchar *)"ab*|c";
     vfrex.regex_len = strlen((char *)vfrex.regex);
 
-    jmp = setjmp(env);
+    jmp = setjmp(vfrex.env);
     if (0 == jmp) {
         parser_parse(&vfrex);
         DFA_compile(&vfrex);
@@ -700,7 +1874,7 @@ int main(void)
     vfrex.regex = (uchar *)"a*b*";
     vfrex.regex_len = strlen((char *)vfrex.regex);
 
-    jmp = setjmp(env);
+    jmp = setjmp(vfrex.env);
     if (0 == jmp) {
         parser_parse(&vfrex);
         DFA_compile(&vfrex);
@@ -719,7 +1893,7 @@ int main(void)
     vfrex.regex = (uchar *)"c*ab+c";
     vfrex.regex_len = strlen((char *)vfrex.regex);
 
-    jmp = setjmp(env);
+    jmp = setjmp(vfrex.env);
     if (0 == jmp) {
         parser_parse(&vfrex);
         DFA_compile(&vfrex);
@@ -736,7 +1910,7 @@ int main(void)
     vfrex.regex = (uchar *)"(cabde)+|a.*";
     vfrex.regex_len = strlen((char *)vfrex.regex);
 
-    jmp = setjmp(env);
+    jmp = setjmp(vfrex.env);
     if (0 == jmp) {
         parser_parse(&vfrex);
         DFA_compile(&vfrex);
@@ -751,7 +1925,7 @@ int main(void)
     vfrex.regex = (uchar *)"(cabde)+|c.*";
     vfrex.regex_len = strlen((char *)vfrex.regex);
 
-    jmp = setjmp(env);
+    jmp = setjmp(vfrex.env);
     if (0 == jmp) {
         parser_parse(&vfrex);
         DFA_compile(&vfrex);
@@ -768,7 +1942,7 @@ int main(void)
     vfrex.regex = (uchar *)"(caBDe)+|C.*";
     vfrex.regex_len = strlen((char *)vfrex.regex);
 
-    jmp = setjmp(env);
+    jmp = setjmp(vfrex.env);
     if (0 == jmp) {
         parser_parse(&vfrex);
         DFA_compile(&vfrex);
@@ -785,7 +1959,7 @@ int main(void)
     vfrex.regex = (uchar *)"\\d*";
     vfrex.regex_len = strlen((char *)vfrex.regex);
 
-    jmp = setjmp(env);
+    jmp = setjmp(vfrex.env);
     if (0 == jmp) {
         parser_parse(&vfrex);
         DFA_compile(&vfrex);
@@ -794,6 +1968,203 @@ int main(void)
     } else {
         printf("Runtime error %d\n", jmp);
     }
+
+    /* a cache with room for only a few states has to be cleared again and
+     * again, but the result must not change */
+    vfrex.option.style = REGEX_STYLE_POSIX;
+    vfrex.option.match = REGEX_MATCH_PARTIAL_BOUNDARY;
+    vfrex.option.ignore_case = false;
+    vfrex.option.cache_size = 1024;
+    vfrex.regex = (uchar *)"(a|b)*a(a|b)(a|b)(a|b)c";
+    vfrex.regex_len = strlen((char *)vfrex.regex);
+
+    jmp = setjmp(vfrex.env);
+    if (0 == jmp) {
+        parser_parse(&vfrex);
+        DFA_compile(&vfrex);
+        test_partial(&vfrex, "xxabbabbabaabbbabbbc", true, 3, 20);
+        test_partial(&vfrex, "xxabbabbabaabbbbbc", false, 0, 0);
+        assert(vfrex.FSM[0]->cache_reset > 0);
+        assert(vfrex.FSM[0]->DFA_size <= 1024);
+        DFA_free(&vfrex);
+    } else {
+        printf("Runtime error %d\n", jmp);
+    }
+    vfrex.option.cache_size = VFREX_UNLIMITED_CACHE;
+
+    /* the minimized table must give the same answers as the lazy DFA */
+    vfrex.option.full_DFA = true;
+    vfrex.option.match = REGEX_MATCH_FULL_BOOL;
+    vfrex.regex = (uchar *)"ab*|c|ab*b";
+    vfrex.regex_len = strlen((char *)vfrex.regex);
+
+    jmp = setjmp(vfrex.env);
+    if (0 == jmp) {
+        parser_parse(&vfrex);
+        DFA_compile(&vfrex);
+        assert(vfrex.FSM[0]->complete);
+        /* the start and ab*, after c nothing can match any more */
+        assert(vfrex.FSM[0]->state_number == 2);
+        assert( DFA_match((const uchar *)"abbbb", 5, &vfrex));
+        assert( DFA_match((const uchar *)"c", 1, &vfrex));
+        assert( DFA_match((const uchar *)"a", 1, &vfrex));
+        assert(!DFA_match((const uchar *)"", 0, &vfrex));
+        assert(!DFA_match((const uchar *)"ca", 2, &vfrex));
+        assert(!DFA_match((const uchar *)"abbc", 4, &vfrex));
+        DFA_free(&vfrex);
+    } else {
+        printf("Runtime error %d\n", jmp);
+    }
+
+    vfrex.option.match = REGEX_MATCH_PARTIAL_BOOL;
+    vfrex.regex = (uchar *)"a(b|c)d";
+    vfrex.regex_len = strlen((char *)vfrex.regex);
+
+    jmp = setjmp(vfrex.env);
+    if (0 == jmp) {
+        parser_parse(&vfrex);
+        DFA_compile(&vfrex);
+        assert(vfrex.FSM[0]->complete);
+        assert( DFA_match((const uchar *)"xxaacdxx", 8, &vfrex));
+        assert(!DFA_match((const uchar *)"xxaadxx", 7, &vfrex));
+        DFA_free(&vfrex);
+    } else {
+        printf("Runtime error %d\n", jmp);
+    }
+
+    vfrex.option.match = REGEX_MATCH_PARTIAL_BOUNDARY;
+    vfrex.regex = (uchar *)"(a|b)*a(a|b)(a|b)(a|b)c";
+    vfrex.regex_len = strlen((char *)vfrex.regex);
+
+    jmp = setjmp(vfrex.env);
+    if (0 == jmp) {
+        parser_parse(&vfrex);
+        DFA_compile(&vfrex);
+        assert(vfrex.FSM[0]->complete && vfrex.FSM[1]->complete);
+        test_partial(&vfrex, "xxabbabbabaabbbabbbc", true, 3, 20);
+        test_partial(&vfrex, "xxabbabbabaabbbbbc", false, 0, 0);
+        DFA_free(&vfrex);
+    } else {
+        printf("Runtime error %d\n", jmp);
+    }
+
+    vfrex.regex = (uchar *)"(cabde)+|c.*";
+    vfrex.regex_len = strlen((char *)vfrex.regex);
+
+    jmp = setjmp(vfrex.env);
+    if (0 == jmp) {
+        parser_parse(&vfrex);
+        DFA_compile(&vfrex);
+        test_partial(&vfrex, "ffffcabdfcabdekkkkkkkkk", true, 5, 23);
+        test_partial(&vfrex, "ffffCabdfCabdekkkkkkkkk", false, 5, 23);
+        test_partial(&vfrex, "cabdecabde", true, 1, 10);
+        DFA_free(&vfrex);
+    } else {
+        printf("Runtime error %d\n", jmp);
+    }
+
+    vfrex.regex = (uchar *)"a*b*";
+    vfrex.regex_len = strlen((char *)vfrex.regex);
+
+    jmp = setjmp(vfrex.env);
+    if (0 == jmp) {
+        parser_parse(&vfrex);
+        DFA_compile(&vfrex);
+        test_partial(&vfrex, "zhouyichao", true, 1, 0);
+        test_partial(&vfrex, "aaaaabxbbb", true, 1, 6);
+        DFA_free(&vfrex);
+    } else {
+        printf("Runtime error %d\n", jmp);
+    }
+
+    /* the table does not fit, so the lazy DFA is used */
+    vfrex.option.cache_size = 64;
+    vfrex.regex = (uchar *)"(a|b)*a(a|b)(a|b)c";
+    vfrex.regex_len = strlen((char *)vfrex.regex);
+
+    jmp = setjmp(vfrex.env);
+    if (0 == jmp) {
+        parser_parse(&vfrex);
+        DFA_compile(&vfrex);
+        assert(!vfrex.FSM[0]->complete);
+        vfrex.option.cache_size = VFREX_UNLIMITED_CACHE;
+        vfrex.FSM[0]->cache_limit = vfrex.FSM[1]->cache_limit = 0;
+        test_partial(&vfrex, "xxabbabbabaabbbabbc", true, 3, 19);
+        DFA_free(&vfrex);
+    } else {
+        printf("Runtime error %d\n", jmp);
+    }
+    vfrex.option.full_DFA = false;
+
+    /* the start state skips to "xyza", "xyzb" or "xyzq", and the prepended
+     * loop eats the bytes outside of printable ASCII as well */
+    vfrex.option.match = REGEX_MATCH_PARTIAL_BOUNDARY;
+    vfrex.regex = (uchar *)"xyz(a|b)*q";
+    vfrex.regex_len = strlen((char *)vfrex.regex);
+
+    for (int full = 0; full < 2; ++full) {
+        vfrex.option.full_DFA = full;
+        jmp = setjmp(vfrex.env);
+        if (0 == jmp) {
+            parser_parse(&vfrex);
+            DFA_compile(&vfrex);
+            test_partial(&vfrex, "\n\xff\x01xyxyyz\nxyzabbaqxyzq", true, 11, 18);
+            test_partial(&vfrex, "xyzabbab\nxyzq", true, 10, 13);
+            test_partial(&vfrex, "xyzabbab\nxyq", false, 0, 0);
+            uint32_t start = start_match(vfrex.FSM[0]);
+            assert(start & DFA_ACCEL);
+            const uchar *text = (uchar *)"aaxyaaxyzbq";
+            assert(accel_scan(vfrex.FSM[0], start, text, text + 11) == text + 6);
+            assert(accel_scan(vfrex.FSM[0], start, text, text + 9) == text + 9);
+            DFA_free(&vfrex);
+        } else {
+            printf("Runtime error %d\n", jmp);
+        }
+    }
+    vfrex.option.full_DFA = false;
+
+    /* "@example" is searched for and "\w+" is matched backward from it,
+     * while "a" in "(a|b)*ab" may be part of the loop before it */
+    vfrex.regex = (uchar *)"\\w+@example.com";
+    vfrex.regex_len = strlen((char *)vfrex.regex);
+    jmp = setjmp(vfrex.env);
+    if (0 == jmp) {
+        parser_parse(&vfrex);
+        DFA_compile(&vfrex);
+        assert(vfrex.inner && vfrex.FSM[2]);
+        test_partial(&vfrex, "ab@example.co x@example.com", true, 15, 27);
+        test_partial(&vfrex, "@example.com a@example.com", true, 14, 26);
+        test_partial(&vfrex, "a @example.com", false, 0, 0);
+        DFA_free(&vfrex);
+    } else {
+        printf("Runtime error %d\n", jmp);
+    }
+
+    vfrex.regex = (uchar *)"\\d+ms";
+    vfrex.regex_len = strlen((char *)vfrex.regex);
+    jmp = setjmp(vfrex.env);
+    if (0 == jmp) {
+        parser_parse(&vfrex);
+        DFA_compile(&vfrex);
+        assert(vfrex.inner);
+        test_partial(&vfrex, "ms 12 ms 3ms", true, 10, 12);
+        DFA_free(&vfrex);
+    } else {
+        printf("Runtime error %d\n", jmp);
+    }
+
+    vfrex.regex = (uchar *)"(a|b)*ab";
+    vfrex.regex_len = strlen((char *)vfrex.regex);
+    jmp = setjmp(vfrex.env);
+    if (0 == jmp) {
+        parser_parse(&vfrex);
+        DFA_compile(&vfrex);
+        assert(!vfrex.inner && !vfrex.FSM[2]);
+        test_partial(&vfrex, "xbaaab", true, 2, 6);
+        DFA_free(&vfrex);
+    } else {
+        printf("Runtime error %d\n", jmp);
+    }
     return 0;
 }
 #endif
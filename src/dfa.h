@@ -24,13 +24,15 @@
 #define __DFA_H
 
 #include "common.h"
-#include <setjmp.h>
+#include "prefilter.h"
 
 typedef enum node_kind_t {
     NODE_NULL,
     NODE_CHAR,
     NODE_BRANCH,
     NODE_ACCEPT,
+    /* a zero length char recording the position in slot */
+    NODE_SAVE,
 } node_kind_t;
 
 typedef struct nnode_t nnode_t;
@@ -40,7 +42,11 @@ typedef struct nnode_t {
     node_kind_t  kind;
     nnode_t     *next;
     nnode_t     *next0;
-    uint32_t     last;
+    /* index in FSM->nodes */
+    uint32_t     id;
+    /* for NODE_SAVE, group i is saved in slot 2i and 2i+1.  For NODE_ACCEPT,
+     * the pattern of a regex set it accepts */
+    uint32_t     slot;
 #ifdef DEBUG
     int32_t      index;
 #endif
@@ -51,25 +57,178 @@ typedef array(nnode_t *) state_a;
 typedef struct dnode_t dnode_t;
 typedef struct dnode_t {
     state_a  states;
-    dnode_t *to[256];
     /* current state contains an accept node */
     bool     is_accept;
+    /* the row of the state in FSM->trans */
+    uint32_t id;
+    /* the serial of the set match that reported the patterns it accepts */
+    uint32_t reported;
 } dnode_t;
 
+typedef array(dnode_t *) dnode_a;
+
 typedef struct hash_t hash_t;
 typedef struct FSM_t {
     nnode_t *NFA;
+    /* all the nodes of the NFA graph */
+    state_a  nodes;
     dnode_t *DFA;
     hash_t  *hash;
-    size_t   DFA_size;   /* TODO */
+    /* row -> dnode of the lazy DFA */
+    dnode_a  rows;
+
+    /* bytes used by the DFA cache, never exceed cache_limit unless it is 0 */
+    size_t   DFA_size;
+    size_t   cache_limit;
+    /* number of times the cache was cleared for hitting cache_limit */
+    size_t   cache_reset;
+    /* number of times a match left the full shared cache for this one */
+    size_t   cache_leave;
+    /* cache_reset when the current DFA_match started */
+    size_t   reset_mark;
+    /* the cache is cleared too often for the DFA to be faster than NFA */
+    bool     give_up;
+    /* the FSM carries a stream from chunk to chunk, its state being all the
+     * stream has of the chunks before, so it never gives up */
+    bool     stream;
+    /* an accepting transition goes to the state without the lower priority
+     * threads, which is what PARTIAL_BOUNDARY wants of the forward FSM */
+    bool     boundary;
+
+    /* chars in the same class can never be told apart by the NFA */
+    uchar    byte_class[256];
+    size_t   class_number;
+
+    /* The transitions of the DFA.  An entry is the offset of the row of the
+     * target state (row times stride) plus the tags below.  The lazy DFA
+     * fills the entries on demand.  A complete table has no unknown entry
+     * and no dnode behind it, and start is its start state. */
+    uint32_t *trans;
+    size_t    stride;
+    size_t    state_number;
+    /* rows allocated in trans */
+    size_t    capacity;
+    uint32_t  start;
+    bool      complete;
+    /* DFA_ACCEL_SIZE bytes for each row: the number of exit bytes and the
+     * exit bytes of an accelerated state, DFA_NO_ACCEL if it is not */
+    uchar    *accel;
+    /* the start state of a FSM with a prefilter is accelerated by it */
+    const prefilter_t *prefilter;
+
+    /* node id -> the visit a closure last saw the node in.  The closures
+     * of a match in a shared cache are taken with the marks of its FSM */
+    uint32_t *mark;
+    uint32_t  visit;
+    /* A FSM of a context made by DFA_context borrows the NFA graph, and the
+     * table if it was complete, from the FSM of the vfrex it was made of */
+    bool      borrow_graph;
+    bool      borrow_table;
+
+    /* The lazy DFA cache the FSMs of a vfrex and of all its contexts fill
+     * together, made by DFA_compile and owned by the FSM of the vfrex.  The
+     * match loops read it without a lock, as a state is made under the lock
+     * of the cache and published by an atomic store of the entries going to
+     * it.  It is never cleared: when it is full, a match goes on in the
+     * cache of its FSM, which is cleared as before */
+    FSM_t    *shared;
+    /* the FSM whose table the current match is in, shared or this one */
+    FSM_t    *table;
+    /* the FSM is a shared cache, with the lock of its writers */
+    bool      concurrent;
+    bool      lock;
+    /* the shared cache had no room for a state, and takes no more entries */
+    bool      full;
+    /* the tables a shared cache grew out of, which a match may still be in
+     * until the cache is freed */
+    array(void *) retired;
 } FSM_t;
 
-extern jmp_buf env;
-extern uint32_t timeline;
+/* the transition reaches an accept state.  With boundary, the target is the
+ * state without the lower priority threads, or dead if there is none */
+#define DFA_MATCH   0x80000000u
+/* the transition can never lead to a match, the target is meaningless */
+#define DFA_DEAD    0x40000000u
+/* the target leaves itself on at most DFA_MAX_ACCEL bytes, so the match
+ * loops may skip to the next of them at once */
+#define DFA_ACCEL   0x20000000u
+#define DFA_TAG     (DFA_MATCH | DFA_DEAD | DFA_ACCEL)
+#define DFA_STATE   (~DFA_TAG)
+/* the lazy DFA has not computed the transition yet */
+#define DFA_UNKNOWN (DFA_DEAD | DFA_STATE)
+
+#define DFA_MAX_ACCEL  3
+#define DFA_ACCEL_SIZE (DFA_MAX_ACCEL + 1)
+#define DFA_NO_ACCEL   0xFF
+/* in place of the number of exit bytes: the state skips to the next place
+ * FSM->prefilter finds */
+#define DFA_PREFIX     0xFE
+
+/* DFA_match gives up if the cache is cleared more times than this in one
+ * call, and leaves the text to the NFA simulation */
+#define DFA_MAX_RESET 8
+/* A set is matched against many short texts, so DFA_set_match gives up as
+ * well if the cache was cleared more than DFA_MAX_RESET times in all and
+ * less than this many bytes were scanned for each time */
+#define DFA_SET_RESET_BYTES (64 << 10)
+
+/* Build the NFA graph of vfrex->exp into FSM.  flip builds the graph of the
+ * reversed regex and prepend puts a loop eating any char in front of it */
+extern void build_NFA(vfrex_t vfrex, bool flip, bool prepend, FSM_t *FSM);
+/* Split the bytes into the classes the NFA of vfrex->exp can not tell apart */
+extern void build_byte_class(vfrex_t vfrex, FSM_t *FSM);
+extern void free_NFA(FSM_t *FSM);
 
 extern void DFA_compile(vfrex_t vfrex);
+/* Build the minimized table for the FSMs without one.  It fails if a table
+ * would be larger than option.cache_size */
+extern bool DFA_build_table(vfrex_t vfrex);
 /* The return value just means whether we find a match */
 extern bool DFA_match(const uchar *text, size_t len, vfrex_t vfrex);
+/* whether the last DFA_match gave up because of thrashing */
+extern bool DFA_give_up(vfrex_t vfrex);
+extern void DFA_free(vfrex_t vfrex);
+/* Give the context its own FSMs, which share the lazy DFA cache and borrow
+ * the rest from the FSMs it was copied with */
+extern void DFA_context(vfrex_t context);
+/* Free the FSMs of a context, and nothing they borrow */
+extern void DFA_context_free(vfrex_t context);
+
+/* A stream goes on from chunk to chunk with the entry of the forward FSM of
+ * a context of its own.  Make the FSMs of the context keep to the DFA
+ * however often their cache is cleared */
+extern void DFA_stream_open(vfrex_t context);
+/* The FSM of a stream telling where the bytes a match may still need
+ * start: the graph of the reversed regex entered at any node, which
+ * accepts, read backward from the end of the bytes, where a prefix of a
+ * match starts.  NULL if vfrex has no regex to build it of, like one loaded
+ * from a blob */
+extern FSM_t *DFA_stream_suffix(vfrex_t vfrex);
+extern void DFA_stream_free(FSM_t **suffix);
+/* The entry of the start state of the forward FSM, which a stream is in at
+ * its start and after each match */
+extern uint32_t DFA_stream_start(vfrex_t vfrex);
+/* Go on over [text, end) from the entry *s of the forward FSM, which is
+ * left in *s.  *right is set to the end of each match gone through, and
+ * the byte the FSM died on is returned, or end if it is still alive */
+extern const uchar *DFA_stream_forward(const uchar *text, const uchar *end,
+                                       uint32_t *s, const uchar **right,
+                                       vfrex_t vfrex);
+/* The start of the longest match in [text, right) ending at right */
+extern const uchar *DFA_stream_left(const uchar *text, const uchar *right,
+                                    vfrex_t vfrex);
+/* The first byte in [text, end) where a prefix of a match ending at end
+ * starts, end itself if there is none.  *more tells that the suffix FSM
+ * was still alive at text, so that one may start before it as well */
+extern const uchar *DFA_stream_keep(const uchar *text, const uchar *end,
+                                    bool *more, FSM_t *suffix);
+
+/* Build the NFA of the union of the patterns of set */
+extern void DFA_set_compile(vfrex_set_t set);
+/* Mark every pattern matching text in set->matched with one pass of the
+ * lazy DFA, whose give_up tells if the pass did not finish */
+extern bool DFA_set_match(const uchar *text, size_t len, vfrex_set_t set);
+extern void DFA_set_free(vfrex_set_t set);
 
 #endif /* end of include guard: __DFA_H */
 
@@ -0,0 +1,300 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "glushkov.h"
+#include "dfa.h"
+#include "prefilter.h"
+#include "macro.h"
+
+typedef struct term_t {
+    uint64_t first;
+    uint64_t last;
+    bool     nullable;
+} term_t;
+
+extern bool glushkov_fit(vfrex_t vfrex)
+{
+    size_t position = 0;
+    arr_for(sym, vfrex->exp)
+        switch (sym->kind) {
+        case REGEX_CHAR:
+        case REGEX_CHARSET:
+            ++position;
+            break;
+
+        case REGEX_NOTHING:
+        case REGEX_CONCATE:
+        case REGEX_OR:
+        case REGEX_ZERO_ONE:
+        case REGEX_REPEAT:
+        case REGEX_REPEAT_ALO:
+        case REGEX_ZERO_ONE_NG:
+        case REGEX_REPEAT_NG:
+        case REGEX_REPEAT_ALO_NG:
+        case REGEX_GROUP:
+            break;
+
+        default:
+            return false;
+        }
+    return position <= GLUSHKOV_POSITION;
+}
+
+static void add_follow(glushkov_t *g, uint64_t from, uint64_t to)
+{
+    for (; from; from &= from - 1)
+        g->follow[0][__builtin_ctzll(from)] |= to;
+}
+
+/* follow[0][i] holds the set following position i while the expression is
+ * walked, spread into the tables of 8 positions here */
+static void spread_follow(glushkov_t *g)
+{
+    uint64_t one[GLUSHKOV_POSITION];
+    memcpy(one, g->follow[0], sizeof(one));
+    memset(g->follow, 0, sizeof(g->follow));
+    for (size_t k = 0; k < GLUSHKOV_CHUNK; ++k)
+        for (size_t b = 1; b < 256; ++b) {
+            size_t i = (size_t)__builtin_ctz((unsigned)b);
+            g->follow[k][b] = g->follow[k][b & (b - 1)] | one[8*k + i];
+        }
+}
+
+extern bool glushkov_compile(vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_GLUSHKOV);
+    assert(glushkov_fit(vfrex));
+
+    /* a partial match skips to where one may start.  The DFA does better
+     * when there is only a literal inside to skip to, and keeps it */
+    if (vfrex->option.match != REGEX_MATCH_FULL_BOOL) {
+        if (!vfrex->prefilter)
+            vfrex->prefilter = prefilter_build(vfrex);
+        if (!vfrex->prefilter &&
+            (vfrex->inner = prefilter_inner(vfrex, &vfrex->inner_split)))
+            return false;
+    }
+
+    glushkov_t *g     = mcalloc(1, sizeof(glushkov_t));
+    term_t     *stack = mmalloc(sizeof(term_t) * vfrex->exp.len);
+    size_t      top   = 0;
+    term_t      a, b;
+
+    arr_for(sym, vfrex->exp) {
+        switch (sym->kind) {
+        case REGEX_CHAR:
+        case REGEX_CHARSET: {
+            uint64_t bit = 1ull << g->position_number++;
+            arr_for(range, *sym->ch)
+                for (unsigned c = range->lower; c <= range->upper; ++c)
+                    g->B[c] |= bit;
+            stack[top++] = (term_t){ bit, bit, false };
+            break;
+        }
+
+        case REGEX_NOTHING:
+            stack[top++] = (term_t){ 0, 0, true };
+            break;
+
+        case REGEX_CONCATE:
+            assert(top >= 2);
+            b = stack[--top];
+            a = stack[--top];
+            add_follow(g, a.last, b.first);
+            stack[top++] = (term_t){
+                a.first | (a.nullable ? b.first : 0),
+                b.last | (b.nullable ? a.last : 0),
+                a.nullable && b.nullable
+            };
+            break;
+
+        case REGEX_OR:
+            assert(top >= 2);
+            b = stack[--top];
+            a = stack[--top];
+            stack[top++] = (term_t){
+                a.first | b.first, a.last | b.last, a.nullable || b.nullable
+            };
+            break;
+
+        /* whether there is a match does not depend on the greediness */
+        case REGEX_ZERO_ONE:
+        case REGEX_ZERO_ONE_NG:
+            assert(top >= 1);
+            stack[top-1].nullable = true;
+            break;
+
+        case REGEX_REPEAT:
+        case REGEX_REPEAT_NG:
+            assert(top >= 1);
+            add_follow(g, stack[top-1].last, stack[top-1].first);
+            stack[top-1].nullable = true;
+            break;
+
+        case REGEX_REPEAT_ALO:
+        case REGEX_REPEAT_ALO_NG:
+            assert(top >= 1);
+            add_follow(g, stack[top-1].last, stack[top-1].first);
+            break;
+
+        case REGEX_GROUP:
+            break;
+
+        default:
+            assert(0);
+            break;
+        }
+    }
+    assert(top == 1);
+    g->first    = stack[0].first;
+    g->last     = stack[0].last;
+    g->nullable = stack[0].nullable;
+    mfree(stack);
+    spread_follow(g);
+
+    for (unsigned c = 0; c < 256; ++c)
+        if (g->B[c] & g->first) {
+            if (g->start_number == 3) {
+                g->start_number = 0;
+                break;
+            }
+            g->start[g->start_number++] = (uchar)c;
+        }
+
+    vfrex->glushkov = g;
+    return true;
+}
+
+/* The positions following all those in D */
+static inline uint64_t follow(const glushkov_t *g, uint64_t D)
+{
+    uint64_t next = g->follow[0][D & 0xFF];
+    for (size_t k = 1; D >>= 8; ++k)
+        next |= g->follow[k][D & 0xFF];
+    return next;
+}
+
+/* The first byte in [p, end) where a match may start, or end */
+static const uchar *skip(const glushkov_t *g, const prefilter_t *pf,
+                         const uchar *p, const uchar *end)
+{
+    if (pf)
+        return prefilter_scan(pf, p, end);
+    if (g->start_number)
+        return scan_bytes(g->start, g->start_number, p, end);
+    while (p < end && !(g->B[*p] & g->first))
+        ++p;
+    return p;
+}
+
+static bool full(const glushkov_t *g, const uchar *p, const uchar *end)
+{
+    if (p == end)
+        return g->nullable;
+    uint64_t D = g->first & g->B[*p++];
+    while (D && p < end)
+        D = follow(g, D) & g->B[*p++];
+    return D & g->last;
+}
+
+static bool partial(const glushkov_t *g, const prefilter_t *pf,
+                    const uchar *p, const uchar *end)
+{
+    if (g->nullable)
+        return true;
+    uint64_t D = 0;
+    while (p < end) {
+        if (!D && (p = skip(g, pf, p, end)) == end)
+            return false;
+        D = (follow(g, D) | g->first) & g->B[*p++];
+        if (D & g->last)
+            return true;
+    }
+    return false;
+}
+
+extern bool glushkov_match(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_GLUSHKOV);
+    const glushkov_t *g   = vfrex->glushkov;
+    const uchar      *end = text + len;
+
+    switch (vfrex->option.match) {
+    case REGEX_MATCH_FULL_BOOL:
+        return full(g, text, end);
+
+    case REGEX_MATCH_PARTIAL_BOOL:
+        return partial(g, vfrex->prefilter, text, end);
+
+    case REGEX_MATCH_PARTIAL_BOUNDARY:
+        return partial(g, vfrex->prefilter, text, end) &&
+               DFA_match(text, len, vfrex);
+
+    case REGEX_MATCH_FULL_SUBMATCH:
+    case REGEX_MATCH_PARTIAL_SUBMATCH:
+        assert(0);
+        break;
+    }
+    return false;
+}
+
+extern const uchar *glushkov_stream(const uchar *p, const uchar *end,
+                                    uint64_t *D, const uchar **empty,
+                                    vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_GLUSHKOV);
+    const glushkov_t  *g     = vfrex->glushkov;
+    const prefilter_t *pf    = vfrex->prefilter;
+    const uchar       *match = NULL;
+    uint64_t           d     = *D;
+    assert(!g->nullable);
+    while (p < end) {
+        if (!d) {
+            /* a literal of the prefilter may go on in the next chunk */
+            p = pf ? prefilter_stream_scan(pf, p, end)
+                   : skip(g, NULL, p, end);
+            *empty = p;
+            if (p == end)
+                break;
+        }
+        d = (follow(g, d) | g->first) & g->B[*p++];
+        if (d & g->last) {
+            match = p;
+            break;
+        }
+    }
+    if (!d)
+        *empty = p;
+    *D = d;
+    return match;
+}
+
+extern bool glushkov_valid(const glushkov_t *g)
+{
+    return g->position_number <= GLUSHKOV_POSITION && g->start_number <= 3;
+}
+
+extern void glushkov_free(vfrex_t vfrex)
+{
+    cleanup(vfrex->glushkov);
+}
@@ -0,0 +1,78 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef __GLUSHKOV_H
+#define __GLUSHKOV_H
+
+#include "common.h"
+
+/* A small regex like "ab*(c|d)?e" is matched with the position automaton of
+ * Glushkov, kept as a bit set in one word.  Each char of the regex is a
+ * position, B[c] is the set of positions that can match c, and follow maps
+ * a set of positions to the ones that may come right after them, looked up
+ * 8 positions at a time.  A byte of the text costs a few loads and ANDs,
+ * with no DFA state to build first.
+ *
+ * The positions cannot tell which thread has the priority, so the
+ * boundaries of PARTIAL_BOUNDARY are left to the DFA once it is known that
+ * there is a match. */
+
+#define GLUSHKOV_POSITION 64
+#define GLUSHKOV_CHUNK    (GLUSHKOV_POSITION / 8)
+
+/* The whole of it is one block of fixed width fields, so a blob can hold
+ * it as it is */
+struct glushkov_t {
+    uint32_t position_number;
+    /* the regex matches the empty string */
+    uint32_t nullable;
+    /* the positions a match can start and end at */
+    uint64_t first;
+    uint64_t last;
+    uint64_t B[256];
+    /* follow[k][b] is the set following positions 8k + i for each bit i
+     * of b */
+    uint64_t follow[GLUSHKOV_CHUNK][256];
+    /* the bytes of the first positions if there are no more than 3 of
+     * them, so that memchr can find where a match may start */
+    uint32_t start_number;
+    uchar    start[3];
+};
+
+/* Whether the expression has no assertion and no more than
+ * GLUSHKOV_POSITION chars */
+extern bool glushkov_fit(vfrex_t vfrex);
+/* false if the DFA can do better, that is when it skips to a literal
+ * inside the regex */
+extern bool glushkov_compile(vfrex_t vfrex);
+extern bool glushkov_match(const uchar *text, size_t len, vfrex_t vfrex);
+/* Go on over [p, end) with the positions D a stream has after the chunks
+ * before, 0 at its start.  The end of the first match is returned, or
+ * NULL.  *empty is moved to the last place D was empty at, so that no match
+ * going on started before it.  The regex must not match the empty string */
+extern const uchar *glushkov_stream(const uchar *p, const uchar *end,
+                                    uint64_t *D, const uchar **empty,
+                                    vfrex_t vfrex);
+extern bool glushkov_valid(const glushkov_t *g);
+extern void glushkov_free(vfrex_t vfrex);
+
+#endif /* end of include guard: __GLUSHKOV_H */
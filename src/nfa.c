@@ -0,0 +1,330 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "nfa.h"
+#include "macro.h"
+
+static void init_list(thread_list_t *list, size_t size, size_t slot_number)
+{
+    list->sparse = mcalloc(size, sizeof(uint32_t));
+    list->dense  = mmalloc(size * sizeof(nnode_t *));
+    list->slot   = mmalloc(size * slot_number * sizeof(uchar *));
+    list->len    = 0;
+}
+
+static void free_list(thread_list_t *list)
+{
+    cleanup(list->sparse);
+    cleanup(list->dense);
+    cleanup(list->slot);
+}
+
+static bool in_list(thread_list_t *list, nnode_t *node)
+{
+    uint32_t i = list->sparse[node->id];
+    return i < list->len && list->dense[i] == node;
+}
+
+/* Add node and everything it reaches without eating a char into list.  The
+ * order of the nodes in the list is the order a backtracking engine would
+ * try them, so that the first thread to accept has the highest priority.
+ * The save nodes on the way record p into the slots of the thread. */
+static void add_thread(pike_t *pike, thread_list_t *list, nnode_t *node,
+                       const uchar **slot, const uchar *p)
+{
+    const uchar **save = pike->save;
+    memcpy(save, slot, pike->slot_number * sizeof(uchar *));
+
+    size_t top = 0;
+    pike->stack[top++] = (frame_t){ node, 0, NULL };
+    while (top) {
+        frame_t frame = pike->stack[--top];
+        if (!frame.node) {
+            save[frame.slot] = frame.old;
+            continue;
+        }
+        nnode_t *cnode = frame.node;
+        if (in_list(list, cnode))
+            continue;
+
+        size_t i = list->len++;
+        list->sparse[cnode->id] = (uint32_t)i;
+        list->dense[i] = cnode;
+
+        switch (cnode->kind) {
+        case NODE_BRANCH:
+            pike->stack[top++] = (frame_t){ cnode->next0, 0, NULL };
+            pike->stack[top++] = (frame_t){ cnode->next, 0, NULL };
+            break;
+
+        case NODE_NULL:
+            pike->stack[top++] = (frame_t){ cnode->next, 0, NULL };
+            break;
+
+        case NODE_SAVE:
+            /* restored after everything behind the node is followed */
+            pike->stack[top++] = (frame_t){ NULL, cnode->slot, save[cnode->slot] };
+            pike->stack[top++] = (frame_t){ cnode->next, 0, NULL };
+            save[cnode->slot] = p;
+            break;
+
+        case NODE_CHAR:
+        case NODE_ACCEPT:
+            memcpy(list->slot + i * pike->slot_number, save,
+                   pike->slot_number * sizeof(uchar *));
+            break;
+        }
+    }
+}
+
+static bool in_range(range_a *range, uchar c)
+{
+    arr_for(r, *range)
+        if (r->lower <= c && c <= r->upper)
+            return true;
+    return false;
+}
+
+/* the thread lists and the stacks for the graph and slots of pike */
+static void init_scratch(pike_t *pike)
+{
+    size_t size = pike->FSM.nodes.len;
+    init_list(&pike->list[0], size, pike->slot_number);
+    init_list(&pike->list[1], size, pike->slot_number);
+    /* each node is expanded at most once and pushes at most two frames */
+    pike->stack = mmalloc((2 * size + 1) * sizeof(frame_t));
+    pike->match = mmalloc(pike->slot_number * sizeof(uchar *));
+    pike->save  = mmalloc(pike->slot_number * sizeof(uchar *));
+}
+
+extern void NFA_compile(vfrex_t vfrex)
+{
+    assert(vfrex->exp.len);
+
+    pike_t *pike = mcalloc(1, sizeof(pike_t));
+    vfrex->pike  = pike;
+    build_NFA(vfrex, false, false, &pike->FSM);
+
+    pike->slot_number = 2;
+    if (vfrex->option.match == REGEX_MATCH_FULL_SUBMATCH ||
+        vfrex->option.match == REGEX_MATCH_PARTIAL_SUBMATCH)
+        pike->slot_number = 2 * vfrex->capture_number;
+    init_scratch(pike);
+}
+
+extern void NFA_context(vfrex_t context)
+{
+    const pike_t *pike = context->pike;
+    if (!pike)
+        return;
+    pike_t *own = mcalloc(1, sizeof(pike_t));
+    own->FSM.NFA          = pike->FSM.NFA;
+    own->FSM.nodes        = pike->FSM.nodes;
+    own->FSM.borrow_graph = true;
+    own->slot_number      = pike->slot_number;
+    init_scratch(own);
+    context->pike = own;
+}
+
+extern bool NFA_match(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    pike_t *pike = vfrex->pike;
+    assert(pike);
+
+    bool anchored = vfrex->option.match == REGEX_MATCH_FULL_BOOL ||
+                    vfrex->option.match == REGEX_MATCH_FULL_SUBMATCH;
+    bool found    = false;
+    size_t n      = pike->slot_number;
+
+    thread_list_t *clist = &pike->list[0];
+    thread_list_t *nlist = &pike->list[1];
+    const uchar   *end   = text + len;
+    clist->len = 0;
+
+    for (const uchar *p = text; ; ++p) {
+        if (!found && (!anchored || p == text)) {
+            /* a new thread starting here has the lowest priority */
+            memset(pike->match, 0, n * sizeof(uchar *));
+            pike->match[0] = p;
+            add_thread(pike, clist, pike->FSM.NFA, pike->match, p);
+        }
+        if (clist->len == 0)
+            break;
+
+        nlist->len = 0;
+        for (size_t i = 0; i < clist->len; ++i) {
+            nnode_t      *node = clist->dense[i];
+            const uchar **slot = clist->slot + i * n;
+
+            if (node->kind == NODE_ACCEPT) {
+                if (anchored && p != end)
+                    continue;
+                found = true;
+                memcpy(pike->match, slot, n * sizeof(uchar *));
+                pike->match[1] = p;
+                if (vfrex->option.match == REGEX_MATCH_PARTIAL_BOOL ||
+                    vfrex->option.match == REGEX_MATCH_FULL_BOOL)
+                    return true;
+                /* threads after this one have lower priority */
+                break;
+            }
+            if (node->kind == NODE_CHAR && p < end && in_range(&node->range, *p))
+                add_thread(pike, nlist, node->next, slot, p+1);
+        }
+        if (p == end)
+            break;
+        swap(clist, nlist);
+    }
+    if (!found)
+        return false;
+
+    group_reserve(vfrex, n / 2);
+    for (size_t i = 0; i < n / 2; ++i) {
+        vfrex->group_left[i]  = pike->match[2*i];
+        vfrex->group_right[i] = pike->match[2*i + 1];
+    }
+    return true;
+}
+
+extern void NFA_free(vfrex_t vfrex)
+{
+    pike_t *pike = vfrex->pike;
+    if (!pike)
+        return;
+    free_NFA(&pike->FSM);
+    free_list(&pike->list[0]);
+    free_list(&pike->list[1]);
+    cleanup(pike->stack);
+    cleanup(pike->match);
+    cleanup(pike->save);
+    cleanup(vfrex->pike);
+}
+
+#ifdef DEBUG_MAIN
+
+#include "parser.h"
+#include "debug.h"
+
+void test(const char *regex, vfrex_match_t match, bool ignore_case,
+          const char *str, bool ret, int left, int right)
+{
+    printf("\nTest case: %s <match> %s\n", regex, str);
+    struct vfrex_t vfrex;
+    memset(&vfrex, 0, sizeof(vfrex));
+    vfrex.regex = (uchar *)regex;
+    vfrex.regex_len = strlen(regex);
+    vfrex.option.style = REGEX_STYLE_POSIX;
+    vfrex.option.match = match;
+    vfrex.option.ignore_case = ignore_case;
+
+    if (0 == setjmp(vfrex.env)) {
+        parser_parse(&vfrex);
+        NFA_compile(&vfrex);
+        assert(NFA_match((uchar *)str, strlen(str), &vfrex) == ret);
+        if (ret && match == REGEX_MATCH_PARTIAL_BOUNDARY) {
+            assert(vfrex.group_number == 1);
+            assert(*vfrex.group_left  == (uchar *)str + left - 1);
+            assert(*vfrex.group_right == (uchar *)str + right);
+            mfree(vfrex.group_left);
+            mfree(vfrex.group_right);
+        }
+        NFA_free(&vfrex);
+    } else {
+        assert(0);
+    }
+}
+
+/* group is a list of the [left, right) of each group, -1 if unmatched */
+void test_group(const char *regex, vfrex_match_t match, const char *str,
+                size_t number, const int *group)
+{
+    printf("\nTest case: %s <submatch> %s\n", regex, str);
+    struct vfrex_t vfrex;
+    memset(&vfrex, 0, sizeof(vfrex));
+    vfrex.regex = (uchar *)regex;
+    vfrex.regex_len = strlen(regex);
+    vfrex.option.style = REGEX_STYLE_POSIX;
+    vfrex.option.match = match;
+
+    if (0 == setjmp(vfrex.env)) {
+        parser_parse(&vfrex);
+        NFA_compile(&vfrex);
+        assert(NFA_match((uchar *)str, strlen(str), &vfrex));
+        assert(vfrex.group_number == number);
+        for (size_t i = 0; i < number; ++i) {
+            const uchar *left  = vfrex.group_left[i];
+            const uchar *right = vfrex.group_right[i];
+            assert(left  ? left  - (uchar *)str == group[2*i]   : group[2*i]   < 0);
+            assert(right ? right - (uchar *)str == group[2*i+1] : group[2*i+1] < 0);
+        }
+        mfree(vfrex.group_left);
+        mfree(vfrex.group_right);
+        NFA_free(&vfrex);
+    } else {
+        assert(0);
+    }
+}
+
+int main(void)
+{
+    setbuf(stdout, NULL);
+
+    test("a|abcd", REGEX_MATCH_FULL_BOOL, false, "a", true, 0, 0);
+    test("a|abcd", REGEX_MATCH_FULL_BOOL, false, "abcc", false, 0, 0);
+    test("a|abcd", REGEX_MATCH_FULL_BOOL, false, "abcd", true, 0, 0);
+    test("ab*|c", REGEX_MATCH_FULL_BOOL, false, "abbbbbbbbbb", true, 0, 0);
+    test("ab*|c", REGEX_MATCH_FULL_BOOL, false, "ca", false, 0, 0);
+    test("ab*|c", REGEX_MATCH_FULL_BOOL, false, "abbc", false, 0, 0);
+    test("ab*|c", REGEX_MATCH_PARTIAL_BOOL, false, "xxabbc", true, 0, 0);
+    test("ab*|c", REGEX_MATCH_PARTIAL_BOOL, false, "xxbb", false, 0, 0);
+
+    test("a*b*", REGEX_MATCH_PARTIAL_BOUNDARY, false, "zhouyichao", true, 1, 0);
+    test("a*b*", REGEX_MATCH_PARTIAL_BOUNDARY, false, "aaaaabbbbb", true, 1, 10);
+    test("a*b*", REGEX_MATCH_PARTIAL_BOUNDARY, false, "aaaaabxbbb", true, 1, 6);
+    test("c*ab+c", REGEX_MATCH_PARTIAL_BOUNDARY, false, "ac", false, 0, 0);
+    test("c*ab+c", REGEX_MATCH_PARTIAL_BOUNDARY, false, "abcc", true, 1, 3);
+    test("(cabde)+|a.*", REGEX_MATCH_PARTIAL_BOUNDARY, false,
+         "ffffcabdecabdekkkkkkkkk", true, 5, 14);
+    test("(cabde)+|c.*", REGEX_MATCH_PARTIAL_BOUNDARY, false,
+         "ffffcabdfcabdekkkkkkkkk", true, 5, 23);
+    test("(caBDe)+|C.*", REGEX_MATCH_PARTIAL_BOUNDARY, true,
+         "FffFcaBdfCabDekKkkKkkKk", true, 5, 23);
+    test("hel|hello", REGEX_MATCH_PARTIAL_BOUNDARY, false, "hello", true, 1, 3);
+    test("hello|hel", REGEX_MATCH_PARTIAL_BOUNDARY, false, "hello", true, 1, 5);
+    test("x(|a)b", REGEX_MATCH_PARTIAL_BOUNDARY, false, "xxbb", true, 2, 3);
+    test("(a|b)*a(a|b)(a|b)(a|b)c", REGEX_MATCH_PARTIAL_BOUNDARY, false,
+         "xxabbabbabaabbbabbbc", true, 3, 20);
+
+    test_group("(a*)(a*)", REGEX_MATCH_FULL_SUBMATCH, "aaa",
+               3, (int []){ 0, 3, 0, 3, 3, 3 });
+    test_group("((1|2)+)-(a*b*)", REGEX_MATCH_FULL_SUBMATCH, "12-ab",
+               4, (int []){ 0, 5, 0, 2, 1, 2, 3, 5 });
+    test_group("x(a|(b))*y", REGEX_MATCH_PARTIAL_SUBMATCH, "zxabayy",
+               3, (int []){ 1, 6, 4, 5, 3, 4 });
+    test_group("x(a|(b))*y", REGEX_MATCH_PARTIAL_SUBMATCH, "xy",
+               3, (int []){ 0, 2, -1, -1, -1, -1 });
+    test_group("(a|ab)(c|bcd)(d*)", REGEX_MATCH_PARTIAL_SUBMATCH, "abcd",
+               4, (int []){ 0, 4, 0, 1, 1, 4, 4, 4 });
+    return 0;
+}
+#endif
@@ -0,0 +1,70 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef __NFA_H
+#define __NFA_H
+
+#include "common.h"
+#include "dfa.h"
+
+/* A Pike VM simulating the NFA graph of build_NFA directly.  It runs in
+ * O(n*m) time for text length n and graph size m, and all the memory it
+ * needs is allocated by NFA_compile. */
+
+typedef struct thread_list_t {
+    /* node id -> position in dense */
+    uint32_t     *sparse;
+    /* the nodes in the list, in the order of priority */
+    nnode_t     **dense;
+    /* slot_number slots for each node in dense */
+    const uchar **slot;
+    size_t        len;
+} thread_list_t;
+
+/* An entry of the stack of add_thread: a node to visit, or the old value
+ * of a slot to restore if node is NULL */
+typedef struct frame_t {
+    nnode_t     *node;
+    uint32_t     slot;
+    const uchar *old;
+} frame_t;
+
+typedef struct pike_t {
+    FSM_t          FSM;
+    thread_list_t  list[2];
+    frame_t       *stack;
+    /* slot 2i and 2i+1 are the boundary of group i, and group 0 is the
+     * whole match.  Only the SUBMATCH modes have more than one group */
+    size_t         slot_number;
+    const uchar  **match;
+    /* the slots of the thread add_thread is following */
+    const uchar  **save;
+} pike_t;
+
+extern void NFA_compile(vfrex_t vfrex);
+/* The return value just means whether we find a match */
+extern bool NFA_match(const uchar *text, size_t len, vfrex_t vfrex);
+/* Give the context its own thread lists on the graph of its pike */
+extern void NFA_context(vfrex_t context);
+extern void NFA_free(vfrex_t vfrex);
+
+#endif /* end of include guard: __NFA_H */
@@ -0,0 +1,237 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "onepass.h"
+#include "macro.h"
+
+typedef struct closure_t {
+    nnode_t  *node;
+    /* the slots recorded on the way from the state to node */
+    uint32_t  save;
+} closure_t;
+
+static bool in_range(range_a *range, uchar c)
+{
+    arr_for(r, *range)
+        if (r->lower <= c && c <= r->upper)
+            return true;
+    return false;
+}
+
+/* Fill the row of state s by following everything its node reaches without
+ * eating a char.  It fails if a node is reached twice, or two chars can eat
+ * the same byte, since then there is more than one way to go on. */
+static bool fill_state(onepass_t *op, uint32_t s, closure_t *stack,
+                       uint32_t *mark, uint32_t *state, nnode_t **root,
+                       const uchar *rep)
+{
+    size_t           K   = op->FSM.class_number;
+    onepass_entry_t *row = op->table + s * K;
+
+    for (size_t k = 0; k < K; ++k)
+        row[k] = (onepass_entry_t){ ONEPASS_FAIL, 0 };
+    op->accept[s] = ONEPASS_FAIL;
+
+    size_t top = 0;
+    stack[top++] = (closure_t){ root[s], 0 };
+    while (top) {
+        closure_t cur  = stack[--top];
+        nnode_t  *node = cur.node;
+        if (mark[node->id] == s + 1)
+            return false;
+        mark[node->id] = s + 1;
+
+        switch (node->kind) {
+        case NODE_BRANCH:
+            stack[top++] = (closure_t){ node->next0, cur.save };
+            stack[top++] = (closure_t){ node->next, cur.save };
+            break;
+
+        case NODE_NULL:
+            stack[top++] = (closure_t){ node->next, cur.save };
+            break;
+
+        case NODE_SAVE:
+            stack[top++] = (closure_t){ node->next, cur.save | 1u << node->slot };
+            break;
+
+        case NODE_ACCEPT:
+            op->accept[s] = cur.save;
+            break;
+
+        case NODE_CHAR:
+            if (state[node->next->id] == ONEPASS_FAIL) {
+                state[node->next->id] = (uint32_t)op->state_number;
+                root[op->state_number++] = node->next;
+            }
+            for (size_t k = 0; k < K; ++k) {
+                if (!in_range(&node->range, rep[k]))
+                    continue;
+                if (row[k].next != ONEPASS_FAIL)
+                    return false;
+                row[k].next = (uint32_t)(state[node->next->id] * K);
+                row[k].save = cur.save;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+extern bool onepass_compile(vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_ONE_PASS);
+    assert(vfrex->exp.len);
+    if (2 * vfrex->capture_number > ONEPASS_MAX_SLOT)
+        return false;
+
+    onepass_t *op = vfrex->onepass = mcalloc(1, sizeof(onepass_t));
+    build_byte_class(vfrex, &op->FSM);
+    build_NFA(vfrex, false, false, &op->FSM);
+
+    size_t K    = op->FSM.class_number;
+    size_t size = op->FSM.nodes.len;
+    uchar  rep[256];
+    for (int c = 255; c >= 0; --c)
+        rep[op->FSM.byte_class[c]] = (uchar)c;
+
+    /* every state is a node, so there are at most size of them */
+    op->table  = mmalloc(size * K * sizeof(onepass_entry_t));
+    op->accept = mmalloc(size * sizeof(uint32_t));
+
+    uint32_t  *state = mmalloc(size * sizeof(uint32_t));
+    uint32_t  *mark  = mcalloc(size, sizeof(uint32_t));
+    nnode_t  **root  = mmalloc(size * sizeof(nnode_t *));
+    /* each node is expanded at most once and pushes at most two nodes */
+    closure_t *stack = mmalloc((2 * size + 1) * sizeof(closure_t));
+    memset(state, 0xFF, size * sizeof(uint32_t));
+
+    size_t limit = vfrex->option.cache_size;
+    state[op->FSM.NFA->id] = 0;
+    root[0] = op->FSM.NFA;
+    op->state_number = 1;
+
+    bool ok = true;
+    for (uint32_t s = 0; ok && s < op->state_number; ++s)
+        ok = fill_state(op, s, stack, mark, state, root, rep) &&
+             !(limit && op->state_number * (K * sizeof(onepass_entry_t) +
+                                            sizeof(uint32_t)) > limit);
+    mfree(state);
+    mfree(mark);
+    mfree(root);
+    mfree(stack);
+
+    if (!ok) {
+        onepass_free(vfrex);
+        return false;
+    }
+
+    op->slot_number = 2 * vfrex->capture_number;
+    op->slot        = mmalloc(op->slot_number * sizeof(uchar *));
+    /* the groups are looked for in the match the DFA finds */
+    if (vfrex->option.match == REGEX_MATCH_PARTIAL_SUBMATCH)
+        DFA_compile(vfrex);
+    return true;
+}
+
+static void save_slot(const uchar **slot, uint32_t save, const uchar *p)
+{
+    for (; save; save &= save - 1)
+        slot[__builtin_ctz(save)] = p;
+}
+
+extern bool onepass_match(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    onepass_t *op = vfrex->onepass;
+    assert(op);
+
+    const uchar *end = text + len;
+    if (vfrex->option.match == REGEX_MATCH_PARTIAL_SUBMATCH) {
+        if (!DFA_match(text, len, vfrex))
+            return false;
+        text = *vfrex->group_left;
+        end  = *vfrex->group_right;
+        vfrex->group_number = 0;
+    }
+
+    const uchar           **slot  = op->slot;
+    const onepass_entry_t  *table = op->table;
+    const uchar            *class = op->FSM.byte_class;
+    uint32_t                s     = 0;
+    memset(slot, 0, op->slot_number * sizeof(uchar *));
+
+    /* a match of the DFA always has a way through the one-pass DFA */
+    for (const uchar *p = text; p < end; ++p) {
+        onepass_entry_t e = table[s + class[*p]];
+        if (e.next == ONEPASS_FAIL) {
+            assert(vfrex->option.match == REGEX_MATCH_FULL_SUBMATCH);
+            return false;
+        }
+        save_slot(slot, e.save, p);
+        s = e.next;
+    }
+    uint32_t accept = op->accept[s / op->FSM.class_number];
+    if (accept == ONEPASS_FAIL) {
+        assert(vfrex->option.match == REGEX_MATCH_FULL_SUBMATCH);
+        return false;
+    }
+    save_slot(slot, accept, end);
+    slot[0] = text;
+    slot[1] = end;
+
+    size_t n = op->slot_number / 2;
+    group_reserve(vfrex, n);
+    for (size_t i = 0; i < n; ++i) {
+        vfrex->group_left[i]  = slot[2*i];
+        vfrex->group_right[i] = slot[2*i + 1];
+    }
+    return true;
+}
+
+extern void onepass_context(vfrex_t context)
+{
+    const onepass_t *op = context->onepass;
+    if (!op)
+        return;
+    onepass_t *own = mmalloc(sizeof(onepass_t));
+    *own = *op;
+    own->FSM.borrow_graph = true;
+    own->FSM.mark         = NULL;
+    own->slot             = mmalloc(op->slot_number * sizeof(uchar *));
+    context->onepass      = own;
+}
+
+extern void onepass_free(vfrex_t vfrex)
+{
+    onepass_t *op = vfrex->onepass;
+    if (!op)
+        return;
+    /* the tables go with the graph */
+    if (!op->FSM.borrow_graph) {
+        cleanup(op->table);
+        cleanup(op->accept);
+    }
+    free_NFA(&op->FSM);
+    cleanup(op->slot);
+    cleanup(vfrex->onepass);
+}
@@ -0,0 +1,66 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef __ONEPASS_H
+#define __ONEPASS_H
+
+#include "common.h"
+#include "dfa.h"
+
+/* A one-pass DFA finds the groups of a regex that has at most one way to go
+ * on at any point of the text, like "(a*)b(c*)".  Each node of the NFA
+ * graph behind a char is a state, and a transition carries the slots to
+ * record before the char is eaten.  So the groups come out of a single scan
+ * without the thread lists of the Pike VM. */
+
+typedef struct onepass_entry_t {
+    /* the row of the target state, or ONEPASS_FAIL */
+    uint32_t next;
+    /* bit i set: record the position in slot i */
+    uint32_t save;
+} onepass_entry_t;
+
+#define ONEPASS_FAIL     0xFFFFFFFFu
+/* the slots are saved with a mask of 32 bits, i.e. 16 groups at most */
+#define ONEPASS_MAX_SLOT 32
+
+struct onepass_t {
+    FSM_t            FSM;
+    /* class_number entries for each state, state 0 is the start */
+    onepass_entry_t *table;
+    /* state -> the slots to record if it may accept, ONEPASS_FAIL if not */
+    uint32_t        *accept;
+    size_t           state_number;
+    size_t           slot_number;
+    const uchar    **slot;
+};
+
+/* Return false if the regex is not one-pass, or the table would be larger
+ * than option.cache_size.  Nothing is left in vfrex in that case */
+extern bool onepass_compile(vfrex_t vfrex);
+extern bool onepass_match(const uchar *text, size_t len, vfrex_t vfrex);
+/* Give the context its own slots, and the tables of the one-pass DFA it was
+ * copied with */
+extern void onepass_context(vfrex_t context);
+extern void onepass_free(vfrex_t vfrex);
+
+#endif /* end of include guard: __ONEPASS_H */
@@ -22,6 +22,10 @@
  */
 
 #include "parser.h"
+#include "aho.h"
+#include "teddy.h"
+#include "glushkov.h"
+#include "substring.h"
 
 #include <string.h>
 #include <ctype.h>
@@ -30,9 +34,6 @@
 #include <stdio.h>
 #endif
 
-static vfrex_option_t option;
-uchar next_char;
-
 static uchar tooppo(int c)
 {
     if (islower(c))
@@ -66,7 +67,8 @@ static uint32_t precedence(operator_t opt)
     }
 }
 
-static void gen_default_charset(range_a *range) {
+static void gen_default_charset(range_a *range, uchar next_char,
+                                vfrex_option_t option) {
     switch (next_char) {
     case '.':
         arr_push(*range, ((range_t){ 32, 127 }));
@@ -123,14 +125,15 @@ static void gen_default_charset(range_a *range) {
     }
 }
 
-static uint32_t next_token(uchar **s)
+static uint32_t next_token(uchar **s, uchar *next_char,
+                           vfrex_option_t option)
 {
     uchar c0 = **s;
     (*s)++;
     uchar c1 = **s;
 
     if (isalnum(c0)) {
-        next_char = c0;
+        *next_char = c0;
         return REGEX_CHAR;
     }
 
@@ -148,7 +151,7 @@ static uint32_t next_token(uchar **s)
             case REGEX_STYLE_VIM_NOMAGIC:
             case REGEX_STYLE_VIM_VERY_NOMAGIC:
             case REGEX_STYLE_MIXED:
-                next_char = '(';
+                *next_char = '(';
                 return REGEX_CHAR;
             }
 
@@ -162,7 +165,7 @@ static uint32_t next_token(uchar **s)
             case REGEX_STYLE_VIM_NOMAGIC:
             case REGEX_STYLE_VIM_VERY_NOMAGIC:
             case REGEX_STYLE_MIXED:
-                next_char = ')';
+                *next_char = ')';
                 return REGEX_CHAR;
             }
 
@@ -176,7 +179,7 @@ static uint32_t next_token(uchar **s)
             case REGEX_STYLE_VIM_NOMAGIC:
             case REGEX_STYLE_VIM_VERY_NOMAGIC:
             case REGEX_STYLE_MIXED:
-                next_char = '+';
+                *next_char = '+';
                 return REGEX_CHAR;
             }
 
@@ -190,14 +193,14 @@ static uint32_t next_token(uchar **s)
             case REGEX_STYLE_VIM_NOMAGIC:
             case REGEX_STYLE_VIM_VERY_NOMAGIC:
             case REGEX_STYLE_MIXED:
-                next_char = '?';
+                *next_char = '?';
                 return REGEX_CHAR;
             }
             assert(0);
             break;
 
         case '\\':
-            next_char = '\\';
+            *next_char = '\\';
             return REGEX_CHAR;
 
         case 's':
@@ -209,12 +212,12 @@ static uint32_t next_token(uchar **s)
         case 'a':
         case 'l':
         case 'u':
-            next_char = c1;
+            *next_char = c1;
             return REGEX_CHARSET;
 
         default:
             (*s)--;
-            next_char = '\\';
+            *next_char = '\\';
             return REGEX_CHAR;
         }
 
@@ -320,50 +323,154 @@ static uint32_t next_token(uchar **s)
             return REGEX_OR;
         }
     case '.':
-        next_char = '.';
+        *next_char = '.';
         return REGEX_CHARSET;
     case '\0':
         assert(0);
         return REGEX_REGEX_END;
     default:
-        next_char = c0;
+        *next_char = c0;
         return REGEX_CHAR;
     }
     assert(0);
     return REGEX_NOTHING;
 }
 
+/* The most bytes a match of the RPN spans, SIZE_MAX if a repeat has no
+ * bound */
+static size_t max_length(symbol_a exp)
+{
+    size_t *stack = mmalloc((exp.len + 1) * sizeof(size_t));
+    size_t  top   = 0;
+    arr_for(sym, exp) {
+        size_t a, b;
+        switch (sym->kind) {
+        case REGEX_CHAR:
+        case REGEX_CHARSET:
+            stack[top++] = 1;
+            break;
+
+        case REGEX_NOTHING:
+            stack[top++] = 0;
+            break;
+
+        case REGEX_CONCATE:
+            b = stack[--top];
+            a = stack[--top];
+            stack[top++] = a > SIZE_MAX - b ? SIZE_MAX : a + b;
+            break;
+
+        case REGEX_OR:
+            b = stack[--top];
+            a = stack[--top];
+            stack[top++] = max(a, b);
+            break;
+
+        case REGEX_REPEAT:
+        case REGEX_REPEAT_ALO:
+        case REGEX_REPEAT_NG:
+        case REGEX_REPEAT_ALO_NG:
+            if (stack[top-1])
+                stack[top-1] = SIZE_MAX;
+            break;
+
+        default:
+            /* the optional ones and the groups span their operand */
+            break;
+        }
+    }
+    size_t ret = top ? stack[top-1] : 0;
+    mfree(stack);
+    return ret;
+}
+
 static void choose_algorithm(vfrex_t vfrex)
 {
     bool is_shift_or_32 = true;
     bool is_shift_or_64 = false;
+    /* a longer string of chars and classes keeps the state in SIMD
+     * registers, or is matched with BNDM up to 64, but Boyer-Moore is
+     * faster on a literal */
+    bool is_shift_or_wide = true;
     bool is_boyer_moore = true;
+    /* a literal long enough that skipping windows beats the prefilter */
+    bool is_bndm = true;
+    /* a literal of which a long run repeats, that skipping windows reads
+     * over and over */
+    bool is_two_way = false;
+    /* a regex that the bit set of its positions can hold, unless the
+     * whole DFA is asked for */
+    bool is_glushkov = glushkov_fit(vfrex) && !vfrex->option.full_DFA;
     bool is_dfa = true;
     bool is_nfa = true;
     size_t num_char = 0;
+    size_t literal_bytes;
+    size_t num_literal = aho_literal_number(vfrex, &literal_bytes);
 
     symbol_t *exp = vfrex->exp.v;
     for (size_t i = 0; i < vfrex->exp.len; ++i) {
         operator_t op = exp[i].kind;
-        if (op == REGEX_CHAR)
+        if (op == REGEX_CHAR || op == REGEX_CHARSET)
             ++num_char;
-        if (op != REGEX_CHAR && op != REGEX_CONCATE) {
+        /* a class is a bit of shift-or like a char, but the bad char table
+         * of Boyer-Moore only has room for one byte */
+        if (op != REGEX_CHAR && op != REGEX_CONCATE)
+            is_boyer_moore = false;
+        if (op != REGEX_CHAR && op != REGEX_CHARSET && op != REGEX_CONCATE) {
             is_shift_or_32 = false;
             is_shift_or_64 = false;
-            is_boyer_moore = false;
+            is_shift_or_wide = false;
         }
     }
+    /* only a string is matched with edits, one shift-or word for each */
+    if (vfrex->option.max_error &&
+        (!is_shift_or_32 || num_char > 64 || vfrex->option.max_error < 0 ||
+         (size_t)vfrex->option.max_error >= num_char)) {
+        vfrex->status = VFREX_INVALID_APPROXIMATE;
+        longjmp(vfrex->env, 1);
+    }
+    if (num_char > 32)
+        is_shift_or_32 = false;
     if (num_char > 64)
         is_shift_or_64 = false;
-    else if (num_char > 32)
-        is_shift_or_32 = false;
-
-    if (is_shift_or_32)
+    if (num_char <= 32 || num_char > 256)
+        is_shift_or_wide = false;
+    if (!is_boyer_moore || num_char < BNDM_MIN_LITERAL || num_char > 64)
+        is_bndm = false;
+    if (is_boyer_moore && num_char >= BNDM_MIN_LITERAL)
+        is_two_way = two_way_fit(vfrex);
+
+    if (vfrex->option.max_error)
+        vfrex->algorithm = REGEX_APPROXIMATE;
+    /* only the one-pass DFA and the NFA know about the groups */
+    else if (vfrex->option.match == REGEX_MATCH_FULL_SUBMATCH ||
+        vfrex->option.match == REGEX_MATCH_PARTIAL_SUBMATCH)
+        vfrex->algorithm = REGEX_ONE_PASS;
+    else if (is_two_way)
+        vfrex->algorithm = REGEX_TWO_WAY;
+    else if (is_bndm)
+        vfrex->algorithm = REGEX_BNDM;
+    else if (is_shift_or_32)
         vfrex->algorithm = REGEX_SHIFT_OR_32;
     else if (is_shift_or_64)
         vfrex->algorithm = REGEX_SHIFT_OR_64;
     else if (is_boyer_moore)
         vfrex->algorithm = REGEX_BOYER_MOORE;
+    else if (is_shift_or_wide)
+        vfrex->algorithm = num_char <= 128 ? REGEX_SHIFT_OR_128
+                                           : REGEX_SHIFT_OR_256;
+    /* a byte at a time, the packed shift-or is slower than Teddy with
+     * pshufb even on a few short literals */
+    else if (num_literal >= 2 && literal_bytes <= SHIFT_OR_MULTI_LEN &&
+             !teddy_simd())
+        vfrex->algorithm = REGEX_SHIFT_OR_MULTI;
+    else if (num_literal >= TEDDY_MIN_LITERAL &&
+             num_literal <= TEDDY_MAX_LITERAL)
+        vfrex->algorithm = REGEX_TEDDY;
+    else if (num_literal >= AHO_MIN_LITERAL)
+        vfrex->algorithm = REGEX_AHO_CORASICK;
+    else if (is_glushkov)
+        vfrex->algorithm = REGEX_GLUSHKOV;
     else if (is_dfa)
         vfrex->algorithm = REGEX_DFA;
     else if (is_nfa)
@@ -375,18 +482,26 @@ static void choose_algorithm(vfrex_t vfrex)
 /* The main parser routine */
 extern void parser_parse(vfrex_t vfrex)
 {
-    option = vfrex->option;
+    vfrex_option_t option = vfrex->option;
+    uchar          next_char;
 
     uchar *regex      = vfrex->regex;
     typedef array(operator_t) operator_a;
+    typedef array(uint32_t)   group_a;
 
     symbol_a   exp;
     symbol_a   token;
     operator_a stack;
+    /* the indices of the groups being parsed */
+    group_a    group;
+    uint32_t   group_number = 0;
+    bool       submatch     = option.match == REGEX_MATCH_FULL_SUBMATCH ||
+                              option.match == REGEX_MATCH_PARTIAL_SUBMATCH;
 
     arr_init(exp);
     arr_init(token);
     arr_init(stack);
+    arr_init(group);
 
     /* first scan, get all the symbol(token) */
     symbol_t sym;
@@ -394,7 +509,7 @@ extern void parser_parse(vfrex_t vfrex)
     arr_push(token, sym);
 
     while (*regex) {
-        operator_t kind = next_token(&regex);
+        operator_t kind = next_token(&regex, &next_char, option);
 
         sym.kind = kind;
         if (kind == REGEX_CHAR || kind == REGEX_CHARSET) {
@@ -408,7 +523,7 @@ extern void parser_parse(vfrex_t vfrex)
                     arr_push(*sym.ch, ((range_t){ next_char, next_char }));
                 }
             } else {
-                gen_default_charset(sym.ch);
+                gen_default_charset(sym.ch, next_char, option);
             }
         }
         arr_push(token, sym);
@@ -484,7 +599,7 @@ extern void parser_parse(vfrex_t vfrex)
                     vfrex->status = VFREX_INVALID_STAR;
                 else
                     vfrex->status = VFREX_INVALID_PLUS;
-                longjmp(env, 1);
+                longjmp(vfrex->env, 1);
             }
             maintain(token.v[i].kind);
             break;
@@ -494,20 +609,31 @@ extern void parser_parse(vfrex_t vfrex)
                 maintain(REGEX_CONCATE);
             }
             arr_push(stack, REGEX_PARENT_LEFT);
+            arr_push(group, ++group_number);
             break;
 
         case REGEX_PARENT_RIGHT:
+            /* when we have situation like () */
+            if (token.v[i-1].kind == REGEX_PARENT_LEFT) {
+                sym.kind = REGEX_NOTHING;
+                arr_push(exp, sym);
+            }
             for (operator_t *p = stack.v+stack.len-1; p >= stack.v; --p) {
                 --stack.len;
                 if (*p == REGEX_PARENT_LEFT)
                     break;
                 if (*p == REGEX_REGEX_START) {
                     vfrex->status = VFREX_UNMATCH_PARENTHESES;
-                    longjmp(env, vfrex->status);
+                    longjmp(vfrex->env, vfrex->status);
                 }
                 sym.kind = *p;
                 arr_push(exp, sym);
             }
+            sym.group = arr_pop(group);
+            if (submatch) {
+                sym.kind = REGEX_GROUP;
+                arr_push(exp, sym);
+            }
             break;
 
         case REGEX_REGEX_END:
@@ -517,7 +643,7 @@ extern void parser_parse(vfrex_t vfrex)
                     break;
                 if (*p == REGEX_PARENT_LEFT) {
                     vfrex->status = VFREX_UNMATCH_PARENTHESES;
-                    longjmp(env, vfrex->status);
+                    longjmp(vfrex->env, vfrex->status);
                 }
                 sym.kind = *p;
                 arr_push(exp, sym);
@@ -550,11 +676,14 @@ extern void parser_parse(vfrex_t vfrex)
 #endif
     }
 
-    vfrex->exp = exp;
+    vfrex->exp            = exp;
+    vfrex->capture_number = (size_t)group_number + 1;
+    vfrex->max_length     = max_length(exp);
     choose_algorithm(vfrex);
 
     arr_free(token);
     arr_free(stack);
+    arr_free(group);
 }
 
 #ifdef DEBUG_MAIN
@@ -571,7 +700,7 @@ int main(void)
     vfrex.regex = (uchar *)"a|(.*|b.*)";
     vfrex.regex_len = strlen((char *)vfrex.regex);
 
-    int jmp = setjmp(env);
+    int jmp = setjmp(vfrex.env);
     if (0 == jmp)
         parser_parse(&vfrex);
     else {
@@ -0,0 +1,653 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "prefilter.h"
+#include "macro.h"
+#include <ctype.h>
+#include <stdlib.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+static const uchar *scan_generic(const uchar *byte, size_t n,
+                                 const uchar *p, const uchar *end)
+{
+    for (; p < end; ++p)
+        for (size_t i = 0; i < n; ++i)
+            if (*p == byte[i])
+                return p;
+    return end;
+}
+
+#ifdef __SSE2__
+static const uchar *scan_sse2(const uchar *byte, size_t n,
+                              const uchar *p, const uchar *end)
+{
+    __m128i a = _mm_set1_epi8((char)byte[0]);
+    __m128i b = _mm_set1_epi8((char)byte[n > 1]);
+    __m128i c = _mm_set1_epi8((char)byte[n > 2 ? 2 : 0]);
+    for (; end - p >= 16; p += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)p);
+        __m128i y = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, a),
+                                              _mm_cmpeq_epi8(x, b)),
+                                 _mm_cmpeq_epi8(x, c));
+        int mask = _mm_movemask_epi8(y);
+        if (mask)
+            return p + __builtin_ctz((unsigned)mask);
+    }
+    return scan_generic(byte, n, p, end);
+}
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__AVX2__)
+#  define PREFILTER_AVX2_DISPATCH
+#  include <immintrin.h>
+/* AVX2 is not in the baseline of x86-64, so it is compiled for this function
+ * only and used when the CPU has it */
+__attribute__((target("avx2")))
+static const uchar *scan_avx2(const uchar *byte, size_t n,
+                              const uchar *p, const uchar *end)
+{
+    __m256i a = _mm256_set1_epi8((char)byte[0]);
+    __m256i b = _mm256_set1_epi8((char)byte[n > 1]);
+    __m256i c = _mm256_set1_epi8((char)byte[n > 2 ? 2 : 0]);
+    for (; end - p >= 32; p += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)p);
+        __m256i y = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, a),
+                                                    _mm256_cmpeq_epi8(x, b)),
+                                    _mm256_cmpeq_epi8(x, c));
+        int mask = _mm256_movemask_epi8(y);
+        if (mask)
+            return p + __builtin_ctz((unsigned)mask);
+    }
+    return scan_sse2(byte, n, p, end);
+}
+#endif
+
+extern const uchar *scan_bytes(const uchar *byte, size_t n,
+                               const uchar *p, const uchar *end)
+{
+    assert(1 <= n && n <= 3);
+    if (n == 1) {
+        p = memchr(p, byte[0], (size_t)(end - p));
+        return p ? p : end;
+    }
+#if defined(PREFILTER_AVX2_DISPATCH)
+    /* the threads that find it unset all set it to the same value */
+    static int has_avx2 = -1;
+    int        avx2     = __atomic_load_n(&has_avx2, __ATOMIC_RELAXED);
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&has_avx2, avx2, __ATOMIC_RELAXED);
+    }
+    if (avx2)
+        return scan_avx2(byte, n, p, end);
+    return scan_sse2(byte, n, p, end);
+#elif defined(__SSE2__)
+    return scan_sse2(byte, n, p, end);
+#else
+    return scan_generic(byte, n, p, end);
+#endif
+}
+
+typedef array(literal_a) literal_aa;
+
+static void push_literal(literal_a *set, const uchar *v, size_t len,
+                         bool exact)
+{
+    literal_t lit;
+    lit.exact = exact && len <= PREFILTER_MAX_LEN;
+    lit.len   = (uint32_t)(len <= PREFILTER_MAX_LEN ? len : PREFILTER_MAX_LEN);
+    if (lit.len)
+        memcpy(lit.v, v, lit.len);
+    arr_push(*set, lit);
+}
+
+/* nothing is known about what the part of the regex starts with */
+static void unknown(literal_a *set)
+{
+    set->len = 0;
+    push_literal(set, NULL, 0, false);
+}
+
+static void char_set(literal_a *set, range_a *ch, bool ignore_case)
+{
+    bool   has[256] = { false };
+    size_t n        = 0;
+    arr_for(range, *ch)
+        for (int c = range->lower; c <= range->upper; ++c) {
+            uchar f = (uchar)(ignore_case ? tolower(c) : c);
+            if (has[f])
+                continue;
+            has[f] = true;
+            if (++n > PREFILTER_MAX_LITERAL) {
+                unknown(set);
+                return;
+            }
+        }
+    for (int c = 0; c < 256; ++c)
+        if (has[c]) {
+            uchar v = (uchar)c;
+            push_literal(set, &v, 1, true);
+        }
+}
+
+/* An exact literal of a goes on with each literal of b.  If there would be
+ * too many of them, a alone is the best we can tell */
+static literal_a concate(literal_a a, literal_a b)
+{
+    literal_a set;
+    arr_init(set);
+    uchar buf[2 * PREFILTER_MAX_LEN];
+    arr_for(x, a) {
+        if (!x->exact) {
+            arr_push(set, *x);
+            continue;
+        }
+        arr_for(y, b) {
+            memcpy(buf, x->v, x->len);
+            memcpy(buf + x->len, y->v, y->len);
+            push_literal(&set, buf, x->len + y->len, y->exact);
+        }
+    }
+    if (set.len > PREFILTER_MAX_LITERAL) {
+        set.len = 0;
+        arr_for(x, a)
+            push_literal(&set, x->v, x->len, false);
+    }
+    return set;
+}
+
+static int compare_literal(const void *x, const void *y)
+{
+    const literal_t *a = x, *b = y;
+    int ret = memcmp(a->v, b->v, a->len < b->len ? a->len : b->len);
+    if (ret)
+        return ret;
+    return a->len < b->len ? -1 : a->len > b->len;
+}
+
+/* A rough guess of how common c is in text, the lower the rarer */
+static int frequency(uchar c)
+{
+    if (c == ' ' || c == '\n' || c == '\t' || c == '\r')
+        return 6;
+    if (c && strchr("etaoinsrhl", c))
+        return 5;
+    if (islower(c))
+        return 4;
+    if (isdigit(c) || ispunct(c))
+        return 3;
+    if (isupper(c))
+        return 2;
+    return 1;
+}
+
+/* Pick the offset where the literals have the fewest and rarest bytes */
+static void choose_rare(prefilter_t *pf)
+{
+    int best = -1;
+    for (size_t i = 0; i < pf->min_len; ++i) {
+        bool   has[256] = { false };
+        uchar  rare[3];
+        size_t n    = 0;
+        int    cost = 0;
+        arr_for(x, pf->literal)
+            for (int k = 0; k < 2; ++k) {
+                uchar c = x->v[i];
+                if (k && !(pf->ignore_case && isalpha(c)))
+                    break;
+                if (k)
+                    c = (uchar)toupper(c);
+                if (has[c])
+                    continue;
+                has[c] = true;
+                if (n == 3)
+                    goto next;
+                rare[n++] = c;
+                cost += frequency(c);
+            }
+        if (best < 0 || cost < best) {
+            best            = cost;
+            pf->rare_at     = i;
+            pf->rare_number = n;
+            memcpy(pf->rare, rare, n);
+        }
+    next:
+        ;
+    }
+}
+
+static prefilter_t *prefilter_new(literal_a literal, bool ignore_case)
+{
+    prefilter_t *pf = mcalloc(1, sizeof(prefilter_t));
+    pf->literal     = literal;
+    pf->ignore_case = ignore_case;
+    for (int c = 0; c < 256; ++c)
+        pf->fold[c] = (uchar)(ignore_case ? tolower(c) : c);
+
+    pf->min_len = PREFILTER_MAX_LEN;
+    arr_for(x, literal)
+        if (x->len < pf->min_len)
+            pf->min_len = x->len;
+
+    /* the tables are made on the folded bytes first */
+    size_t m = pf->min_len;
+    uchar  shift[256];
+    bool   first[256] = { false };
+    memset(shift, (int)m, sizeof(shift));
+    arr_for(x, literal) {
+        first[x->v[0]] = true;
+        for (size_t i = 0; i + 1 < m; ++i)
+            if (shift[x->v[i]] > m - 1 - i)
+                shift[x->v[i]] = (uchar)(m - 1 - i);
+    }
+    for (int c = 0; c < 256; ++c) {
+        pf->shift[c] = shift[pf->fold[c]];
+        pf->first[c] = first[pf->fold[c]];
+    }
+    for (size_t k = 0; k < literal.len; ++k) {
+        const literal_t *x = &literal.v[k];
+        uchar head[8] = { 0 }, fold[8] = { 0 }, mask[8] = { 0 };
+        for (size_t i = 0; i < x->len && i < 8; ++i) {
+            head[i] = x->v[i];
+            /* the literal is in lower case, which or 0x20 folds to */
+            fold[i] = (uchar)(ignore_case && islower(x->v[i]) ? 0x20 : 0);
+            mask[i] = 0xFF;
+        }
+        memcpy(&pf->head[k], head, 8);
+        memcpy(&pf->head_fold[k], fold, 8);
+        memcpy(&pf->head_mask[k], mask, 8);
+    }
+    choose_rare(pf);
+    return pf;
+}
+
+/* The literals the RPN exp[0, len) starts with */
+static literal_a literal_set(const symbol_t *exp, size_t len, bool ignore_case)
+{
+    literal_aa stack;
+    literal_a  a, b, set;
+    arr_init(stack);
+
+    for (size_t i = 0; i < len; ++i) {
+        const symbol_t *sym = &exp[i];
+        arr_init(set);
+        switch (sym->kind) {
+        case REGEX_CHAR:
+        case REGEX_CHARSET:
+            char_set(&set, sym->ch, ignore_case);
+            break;
+
+        case REGEX_NOTHING:
+            push_literal(&set, NULL, 0, true);
+            break;
+
+        case REGEX_CONCATE:
+            b   = arr_pop(stack);
+            a   = arr_pop(stack);
+            set = concate(a, b);
+            arr_free(a);
+            arr_free(b);
+            break;
+
+        case REGEX_OR:
+            b   = arr_pop(stack);
+            set = arr_pop(stack);
+            arr_for(x, b)
+                arr_push(set, *x);
+            arr_free(b);
+            if (set.len > PREFILTER_MAX_LITERAL)
+                unknown(&set);
+            break;
+
+        case REGEX_ZERO_ONE:
+        case REGEX_ZERO_ONE_NG:
+            set = arr_pop(stack);
+            push_literal(&set, NULL, 0, true);
+            if (set.len > PREFILTER_MAX_LITERAL)
+                unknown(&set);
+            break;
+
+        case REGEX_REPEAT:
+        case REGEX_REPEAT_NG:
+        case REGEX_REPEAT_ALO:
+        case REGEX_REPEAT_ALO_NG:
+            set = arr_pop(stack);
+            arr_for(x, set)
+                x->exact = false;
+            if (sym->kind == REGEX_REPEAT || sym->kind == REGEX_REPEAT_NG)
+                push_literal(&set, NULL, 0, true);
+            if (set.len > PREFILTER_MAX_LITERAL)
+                unknown(&set);
+            break;
+
+        case REGEX_GROUP:
+            set = arr_pop(stack);
+            break;
+
+        default:
+            assert(0);
+            break;
+        }
+        arr_push(stack, set);
+    }
+    assert(stack.len == 1);
+    set = stack.v[0];
+    arr_free(stack);
+    return set;
+}
+
+extern prefilter_t *prefilter_build(vfrex_t vfrex)
+{
+    bool      ignore_case = vfrex->option.ignore_case;
+    literal_a set = literal_set(vfrex->exp.v, vfrex->exp.len, ignore_case);
+
+    /* a literal with another one as its prefix adds nothing, and after the
+     * sort it comes right behind the other one */
+    qsort(set.v, set.len, sizeof(literal_t), compare_literal);
+    size_t n = 0;
+    arr_for(x, set) {
+        literal_t *last = n ? &set.v[n-1] : NULL;
+        if (last && last->len <= x->len && !memcmp(last->v, x->v, last->len))
+            continue;
+        set.v[n++] = *x;
+    }
+    set.len = n;
+
+    /* with literals of one byte, the accelerated start state of the DFA
+     * does as well as the prefilter */
+    arr_for(x, set)
+        if (x->len < 2) {
+            arr_free(set);
+            return NULL;
+        }
+    return prefilter_new(set, ignore_case);
+}
+
+/* Whether c may be matched by one of the chars of exp[0, len) */
+static bool used_in(uchar c, const symbol_t *exp, size_t len, bool ignore_case)
+{
+    int v[2] = { c, ignore_case ? toupper(c) : c };
+    for (size_t i = 0; i < len; ++i)
+        if (exp[i].kind == REGEX_CHAR || exp[i].kind == REGEX_CHARSET)
+            arr_for(range, *exp[i].ch)
+                for (int k = 0; k < 2; ++k)
+                    if (range->lower <= v[k] && v[k] <= range->upper)
+                        return true;
+    return false;
+}
+
+extern prefilter_t *prefilter_inner(vfrex_t vfrex, size_t *split)
+{
+    bool      ignore_case = vfrex->option.ignore_case;
+    symbol_t *exp         = vfrex->exp.v;
+    size_t    len         = vfrex->exp.len;
+
+    /* where the RPN of the part of the regex ending at each symbol starts */
+    size_t *start = mmalloc(sizeof(size_t) * len);
+    size_t *stack = mmalloc(sizeof(size_t) * len);
+    size_t  top   = 0;
+    for (size_t i = 0; i < len; ++i) {
+        switch (exp[i].kind) {
+        case REGEX_CHAR:
+        case REGEX_CHARSET:
+        case REGEX_NOTHING:
+            start[i] = i;
+            break;
+        case REGEX_CONCATE:
+        case REGEX_OR:
+            --top;
+            start[i] = stack[--top];
+            break;
+        default:
+            start[i] = stack[--top];
+            break;
+        }
+        stack[top++] = start[i];
+    }
+
+    /* the regex is f[0] f[1] ... f[n-1], where the concatenation is left
+     * associative, so the RPN of f[0] ... f[k-1] is exp[0, start of f[k]) */
+    size_t  n = 0;
+    size_t *f = stack;
+    for (size_t i = len - 1;; ) {
+        if (exp[i].kind == REGEX_GROUP) {
+            --i;
+        } else if (exp[i].kind == REGEX_CONCATE) {
+            f[n++] = i - 1;
+            i      = start[i - 1] - 1;
+        } else {
+            f[n++] = i;
+            break;
+        }
+    }
+    for (size_t i = 0; i < n / 2; ++i) {
+        size_t t     = f[i];
+        f[i]         = f[n - 1 - i];
+        f[n - 1 - i] = t;
+    }
+
+    /* A literal L that f[k] ... f[m] are exactly, with k > 0 and its first
+     * byte not in f[0] ... f[k-1], is found at the first place at or after
+     * the start of a match where L starts.  The rarer its bytes and the
+     * longer it is, the better */
+    literal_t best, lit;
+    int       best_cost = 0;
+    best.len = 0;
+    for (size_t k = 1; k < n; ++k) {
+        lit.len = 0;
+        for (size_t m = k; m < n && lit.len < PREFILTER_MAX_LEN; ++m) {
+            size_t    i   = f[m];
+            literal_a set = literal_set(exp + start[i], i + 1 - start[i],
+                                        ignore_case);
+            bool exact = set.len == 1 && set.v[0].exact && set.v[0].len;
+            if (exact) {
+                size_t l = set.v[0].len;
+                if (l > PREFILTER_MAX_LEN - lit.len)
+                    l = PREFILTER_MAX_LEN - lit.len;
+                memcpy(lit.v + lit.len, set.v[0].v, l);
+                lit.len += (uint32_t)l;
+            }
+            arr_free(set);
+            if (!exact)
+                break;
+        }
+        if (!lit.len ||
+            used_in(lit.v[0], exp, start[f[k]], ignore_case))
+            continue;
+        int cost = 7;
+        for (size_t i = 0; i < lit.len; ++i)
+            if (frequency(lit.v[i]) < cost)
+                cost = frequency(lit.v[i]);
+        if (!best.len || cost < best_cost ||
+            (cost == best_cost && lit.len > best.len)) {
+            best      = lit;
+            best_cost = cost;
+            *split    = start[f[k]];
+        }
+    }
+    mfree(start);
+    mfree(stack);
+    if (!best.len)
+        return NULL;
+
+    literal_a set;
+    arr_init(set);
+    push_literal(&set, best.v, best.len, true);
+    return prefilter_new(set, ignore_case);
+}
+
+extern prefilter_t *prefilter_pieces(vfrex_t vfrex, size_t n)
+{
+    bool ignore_case = vfrex->option.ignore_case;
+    /* the byte of each char of the string, -1 for a class */
+    int    v[64];
+    size_t len = 0;
+    arr_for(sym, vfrex->exp) {
+        if (sym->kind == REGEX_CONCATE)
+            continue;
+        if (sym->kind != REGEX_CHAR && sym->kind != REGEX_CHARSET)
+            return NULL;
+        if (len == 64)
+            return NULL;
+        literal_a one;
+        arr_init(one);
+        char_set(&one, sym->ch, ignore_case);
+        v[len++] = one.len == 1 && one.v[0].len == 1 ? one.v[0].v[0] : -1;
+        arr_free(one);
+    }
+    if (n > PREFILTER_MAX_LITERAL || n > len)
+        return NULL;
+
+    literal_a set;
+    arr_init(set);
+    for (size_t i = 0; i < n; ++i) {
+        /* the longest run of chars in the part */
+        size_t best = 0, at = 0, run = 0;
+        for (size_t j = len * i / n; j < len * (i + 1) / n; ++j) {
+            run = v[j] < 0 ? 0 : run + 1;
+            if (run > best) {
+                best = run;
+                at   = j + 1 - run;
+            }
+        }
+        if (best < 2) {
+            arr_free(set);
+            return NULL;
+        }
+        uchar buf[64];
+        for (size_t j = 0; j < best; ++j)
+            buf[j] = (uchar)v[at + j];
+        push_literal(&set, buf, best, false);
+    }
+    /* a literal that another one starts with is dropped, the other one is
+     * found wherever it is */
+    for (size_t k = 0; k < set.len; ) {
+        bool covered = false;
+        for (size_t j = 0; j < set.len && !covered; ++j)
+            covered = j != k && set.v[j].len <= set.v[k].len &&
+                      !memcmp(set.v[j].v, set.v[k].v, set.v[j].len);
+        if (covered)
+            set.v[k] = set.v[--set.len];
+        else
+            ++k;
+    }
+    return prefilter_new(set, ignore_case);
+}
+
+static bool verify(const prefilter_t *pf, const uchar *s, const uchar *end)
+{
+    size_t   left = (size_t)(end - s);
+    uint64_t word = 0;
+    memcpy(&word, s, left < 8 ? left : 8);
+    for (size_t k = 0; k < pf->literal.len; ++k) {
+        const literal_t *x = &pf->literal.v[k];
+        if (x->len > left ||
+            ((word | pf->head_fold[k]) & pf->head_mask[k]) != pf->head[k])
+            continue;
+        size_t i = 8;
+        while (i < x->len && pf->fold[s[i]] == x->v[i])
+            ++i;
+        if (i >= x->len)
+            return true;
+    }
+    return false;
+}
+
+extern const uchar *prefilter_scan(const prefilter_t *pf,
+                                   const uchar *p, const uchar *end)
+{
+    size_t m = pf->min_len;
+    if ((size_t)(end - p) < m)
+        return end;
+    if (pf->rare_number) {
+        const uchar *q = p + pf->rare_at;
+        while ((q = scan_bytes(pf->rare, pf->rare_number, q, end)) < end) {
+            const uchar *s = q++ - pf->rare_at;
+            if (pf->first[*s] && verify(pf, s, end))
+                return s;
+        }
+        return end;
+    }
+    for (const uchar *t = p + m - 1; t < end; t += pf->shift[*t]) {
+        const uchar *s = t + 1 - m;
+        if (pf->first[*s] && verify(pf, s, end))
+            return s;
+    }
+    return end;
+}
+
+extern const uchar *prefilter_stream_scan(const prefilter_t *pf,
+                                          const uchar *p, const uchar *end)
+{
+    size_t tail = 0;
+    for (size_t k = 0; k < pf->literal.len; ++k)
+        tail = max(tail, (size_t)pf->literal.v[k].len - 1);
+    /* a literal cut by end may start before the first whole one */
+    const uchar *cut = (size_t)(end - p) > tail ? end - tail : p;
+    return min(prefilter_scan(pf, p, end), cut);
+}
+
+extern size_t prefilter_pack(const prefilter_t *pf, uchar *buf)
+{
+    size_t n = 0;
+    for (size_t k = 0; k < pf->literal.len; ++k) {
+        const literal_t *x = &pf->literal.v[k];
+        if (buf) {
+            buf[n] = (uchar)x->len;
+            memcpy(buf + n + 1, x->v, x->len);
+        }
+        n += 1 + x->len;
+    }
+    return n;
+}
+
+extern prefilter_t *prefilter_unpack(const uchar *buf, size_t size,
+                                     bool ignore_case)
+{
+    literal_a set;
+    arr_init(set);
+    for (size_t n = 0; n < size; n += 1 + buf[n]) {
+        if (buf[n] < 2 || buf[n] > PREFILTER_MAX_LEN || buf[n] >= size - n ||
+            set.len == PREFILTER_MAX_LITERAL) {
+            arr_free(set);
+            return NULL;
+        }
+        push_literal(&set, buf + n + 1, buf[n], false);
+    }
+    if (!set.len) {
+        arr_free(set);
+        return NULL;
+    }
+    return prefilter_new(set, ignore_case);
+}
+
+extern void prefilter_free(prefilter_t **pf)
+{
+    if (!*pf)
+        return;
+    arr_free((*pf)->literal);
+    cleanup(*pf);
+}
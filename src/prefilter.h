@@ -0,0 +1,104 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef __PREFILTER_H
+#define __PREFILTER_H
+
+#include "common.h"
+
+/* Every match of a regex like "GET /api/(v1|v2)" starts with one of a few
+ * literals.  The prefilter finds the next place where one of them starts,
+ * so the DFA does not have to look at the bytes in between byte by byte.
+ * It looks for the rarest bytes the literals have at the same offset with
+ * memchr or SIMD, or skips over the text like Horspool if there are too
+ * many of them. */
+
+/* literals longer than this are cut, as the DFA checks the rest anyway */
+#define PREFILTER_MAX_LEN     32
+/* a regex with more literals than this is left to the DFA */
+#define PREFILTER_MAX_LITERAL 16
+
+typedef struct literal_t {
+    uchar    v[PREFILTER_MAX_LEN];
+    uint32_t len;
+    /* the literal is all that the part of the regex matches */
+    bool     exact;
+} literal_t;
+
+typedef array(literal_t) literal_a;
+
+typedef struct prefilter_t {
+    /* none of them is a prefix of another one */
+    literal_a literal;
+    /* the literals are in lower case and the text is folded to it */
+    bool      ignore_case;
+    uchar     fold[256];
+    /* the Horspool shift on the last byte of a window of min_len bytes */
+    size_t    min_len;
+    uchar     shift[256];
+    /* the first bytes of the literals, folded */
+    bool      first[256];
+    /* the first 8 bytes of each literal, to compare with 8 bytes of the text
+     * at once: (text | head_fold) & head_mask == head */
+    uint64_t  head[PREFILTER_MAX_LITERAL];
+    uint64_t  head_fold[PREFILTER_MAX_LITERAL];
+    uint64_t  head_mask[PREFILTER_MAX_LITERAL];
+    /* the bytes the literals have at offset rare_at, unfolded.  There are
+     * no more than 3 of them, 0 if Horspool is used instead */
+    size_t    rare_at;
+    uchar     rare[3];
+    size_t    rare_number;
+} prefilter_t;
+
+/* The literals every match of vfrex->exp starts with, NULL if there is no
+ * such set worth searching for */
+extern prefilter_t *prefilter_build(vfrex_t vfrex);
+/* A literal every match of vfrex->exp has right after a part that never
+ * matches its first byte, NULL if there is none.  *split is the length of
+ * the RPN of that part */
+extern prefilter_t *prefilter_inner(vfrex_t vfrex, size_t *split);
+/* The longest run of at least 2 chars in each of the n parts of a string of
+ * chars and classes, NULL if a part has none.  A match of the string with
+ * fewer than n edits leaves a part as it is, so it has one of the runs */
+extern prefilter_t *prefilter_pieces(vfrex_t vfrex, size_t n);
+/* The first position in [p, end) where one of the literals starts, or end */
+extern const uchar *prefilter_scan(const prefilter_t *pf,
+                                   const uchar *p, const uchar *end);
+/* prefilter_scan on a chunk of a stream, where a literal may go on in the
+ * next chunk.  No literal starts before the returned position, which is the
+ * first whole one or the first of the last bytes one cut by end may start
+ * at, for the caller to go through them */
+extern const uchar *prefilter_stream_scan(const prefilter_t *pf,
+                                          const uchar *p, const uchar *end);
+/* The first byte in [p, end) that is one of the n bytes, 1 <= n <= 3, or
+ * end */
+extern const uchar *scan_bytes(const uchar *byte, size_t n,
+                               const uchar *p, const uchar *end);
+/* Write the literals into buf as a length byte and the bytes each, and
+ * return the size.  buf may be NULL to get the size only */
+extern size_t prefilter_pack(const prefilter_t *pf, uchar *buf);
+/* The prefilter of a packed buf, NULL if buf is malformed */
+extern prefilter_t *prefilter_unpack(const uchar *buf, size_t size,
+                                     bool ignore_case);
+extern void prefilter_free(prefilter_t **pf);
+
+#endif /* end of include guard: __PREFILTER_H */
@@ -0,0 +1,566 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* The blob of vfrex_serialize is a blob_t followed by the sections it points
+ * to.  A section is referred to by its offset from the start of the blob and
+ * padded to 8 bytes, so the blob can be used wherever it is mapped. */
+
+#include "macro.h"
+#include "dfa.h"
+#include "prefilter.h"
+#include "aho.h"
+#include "teddy.h"
+#include "glushkov.h"
+#include "substring.h"
+#include "vfrex.h"
+#include <stdint.h>
+
+#define BLOB_MAGIC   "vfrex\x1a\r\n"
+#define BLOB_VERSION 9
+/* reads differently on a machine of the other byte order */
+#define BLOB_ENDIAN  0x01020304u
+
+typedef struct blob_FSM_t {
+    /* offset of FSM->trans, 0 if there is no such FSM */
+    uint64_t trans;
+    uint64_t accel;
+    uint32_t stride;
+    uint32_t state_number;
+    uint32_t start;
+    uint32_t class_number;
+    uchar    byte_class[256];
+} blob_FSM_t;
+
+typedef struct blob_aho_t {
+    /* offset of aho->trans, 0 if there is no automaton */
+    uint64_t trans;
+    uint64_t state;
+    uint64_t state_number;
+    uint64_t literal_number;
+    uint64_t max_len;
+    uint64_t class_number;
+    uchar    byte_class[256];
+} blob_aho_t;
+
+typedef struct blob_t {
+    char       magic[8];
+    uint32_t   version;
+    uint32_t   endian;
+    uint64_t   size;
+
+    uint32_t   algorithm;
+    uint32_t   style;
+    uint32_t   match;
+    uint32_t   ignore_case;
+    uint32_t   full_DFA;
+    uint32_t   max_error;
+    uint64_t   cache_size;
+
+    uint64_t   regex_len;
+    uint64_t   regex;
+    /* the most bytes a match spans, for streaming */
+    uint64_t   max_length;
+    uint64_t   shift_or;
+    uint64_t   shift_or_len;
+    uint64_t   BM_bad_char_table;
+    uint64_t   BM_good_suffix_table;
+    uint64_t   BM_full_jump_table;
+    /* the packed literals of the prefilter, 0 if there is none */
+    uint64_t   prefilter;
+    uint64_t   prefilter_size;
+    blob_FSM_t FSM[2];
+    blob_aho_t aho;
+    /* the teddy_t of REGEX_TEDDY as it is, 0 if there is none */
+    uint64_t   teddy;
+    uint64_t   teddy_size;
+    /* the glushkov_t of REGEX_GLUSHKOV as it is, 0 if there is none */
+    uint64_t   glushkov;
+} blob_t;
+
+typedef struct writer_t {
+    uchar  *base;
+    size_t  size;
+    size_t  len;
+} writer_t;
+
+/* Append a section to the blob if there is room for it, and return its
+ * offset anyway so that the size can be computed with no buffer */
+static uint64_t put_section(writer_t *w, const void *data, size_t len)
+{
+    size_t at  = w->len;
+    size_t end = (at + len + 7) & ~(size_t)7;
+    if (end <= w->size) {
+        memcpy(w->base + at, data, len);
+        memset(w->base + at + len, 0, end - at - len);
+    }
+    w->len = end;
+    return at;
+}
+
+/* The whole table of the DFA and its prefilter */
+static bool put_DFA(writer_t *w, vfrex_t vfrex, blob_t *head)
+{
+    /* the lazy DFA has no fixed form, build the whole table now */
+    if (!DFA_build_table(vfrex))
+        return false;
+    for (size_t i = 0; i < 2; ++i) {
+        FSM_t *FSM = vfrex->FSM[i];
+        if (!FSM)
+            continue;
+        blob_FSM_t *p   = &head->FSM[i];
+        p->trans        = put_section(w, FSM->trans, FSM->state_number *
+                                      FSM->stride * sizeof(uint32_t));
+        p->accel        = put_section(w, FSM->accel, FSM->state_number *
+                                      DFA_ACCEL_SIZE);
+        p->stride       = (uint32_t)FSM->stride;
+        p->state_number = (uint32_t)FSM->state_number;
+        p->start        = FSM->start;
+        p->class_number = (uint32_t)FSM->class_number;
+        memcpy(p->byte_class, FSM->byte_class, 256);
+    }
+    return true;
+}
+
+static void put_prefilter(writer_t *w, vfrex_t vfrex, blob_t *head)
+{
+    if (vfrex->prefilter) {
+        size_t len = prefilter_pack(vfrex->prefilter, NULL);
+        uchar  buf[PREFILTER_MAX_LITERAL * (PREFILTER_MAX_LEN + 1)];
+        prefilter_pack(vfrex->prefilter, buf);
+        head->prefilter      = put_section(w, buf, len);
+        head->prefilter_size = len;
+    }
+}
+
+size_t vfrex_serialize(vfrex_t vfrex, void *blob, size_t size)
+{
+    if (!vfrex || vfrex->status != VFREX_SUCCESS)
+        return 0;
+
+    blob_t head;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, BLOB_MAGIC, sizeof(head.magic));
+    head.version     = BLOB_VERSION;
+    head.endian      = BLOB_ENDIAN;
+    head.algorithm   = vfrex->algorithm;
+    head.style       = vfrex->option.style;
+    head.match       = vfrex->option.match;
+    head.ignore_case = (uint32_t)vfrex->option.ignore_case;
+    head.full_DFA    = (uint32_t)vfrex->option.full_DFA;
+    head.max_error   = (uint32_t)vfrex->option.max_error;
+    head.cache_size  = vfrex->option.cache_size;
+    head.regex_len   = vfrex->regex_len;
+    head.max_length  = vfrex->max_length;
+
+    writer_t w = { blob, size, sizeof(blob_t) };
+    size_t   len = vfrex->regex_len;
+    head.regex = put_section(&w, vfrex->regex, len + 1);
+
+    switch (vfrex->algorithm) {
+    case REGEX_SHIFT_OR_32:
+        head.shift_or     = put_section(&w, vfrex->shift_or,
+                                        256 * sizeof(uint32_t));
+        head.shift_or_len = vfrex->shift_or_len;
+        put_prefilter(&w, vfrex, &head);
+        break;
+
+    case REGEX_SHIFT_OR_64:
+        head.shift_or     = put_section(&w, vfrex->shift_or,
+                                        256 * sizeof(uint64_t));
+        head.shift_or_len = vfrex->shift_or_len;
+        put_prefilter(&w, vfrex, &head);
+        break;
+
+    case REGEX_BNDM:
+        head.shift_or     = put_section(&w, vfrex->shift_or,
+                                        256 * sizeof(uint64_t));
+        head.shift_or_len = vfrex->shift_or_len;
+        break;
+
+    case REGEX_APPROXIMATE:
+        /* the masks of the string and of the reversed string */
+        head.shift_or     = put_section(&w, vfrex->shift_or,
+                                        2 * 256 * sizeof(uint64_t));
+        head.shift_or_len = vfrex->shift_or_len;
+        put_prefilter(&w, vfrex, &head);
+        break;
+
+    case REGEX_SHIFT_OR_128:
+    case REGEX_SHIFT_OR_256:
+        head.shift_or     = put_section(&w, vfrex->shift_or,
+                                        256 * sizeof(uint64_t) *
+                                        (vfrex->algorithm ==
+                                         REGEX_SHIFT_OR_128 ? 2 : 4));
+        head.shift_or_len = vfrex->shift_or_len;
+        put_prefilter(&w, vfrex, &head);
+        break;
+
+    case REGEX_SHIFT_OR_MULTI:
+        head.shift_or = put_section(&w, vfrex->shift_or,
+                                    sizeof(shift_or_multi_t));
+        break;
+
+    case REGEX_TWO_WAY:
+        head.shift_or = put_section(&w, vfrex->shift_or,
+                                    ((two_way_t *)vfrex->shift_or)->size);
+        break;
+
+    case REGEX_BOYER_MOORE:
+        head.BM_bad_char_table    = put_section(&w, vfrex->BM_bad_char_table,
+                                                256 * sizeof(int32_t));
+        head.BM_good_suffix_table = put_section(&w, vfrex->BM_good_suffix_table,
+                                                (len+1) * sizeof(int32_t));
+        head.BM_full_jump_table   = put_section(&w, vfrex->BM_full_jump_table,
+                                                (len+1) * sizeof(int32_t));
+        break;
+
+    case REGEX_DFA:
+        if (!put_DFA(&w, vfrex, &head))
+            return 0;
+        put_prefilter(&w, vfrex, &head);
+        break;
+
+    case REGEX_GLUSHKOV:
+        head.glushkov = put_section(&w, vfrex->glushkov, sizeof(glushkov_t));
+        if (vfrex->FSM[0] && !put_DFA(&w, vfrex, &head))
+            return 0;
+        put_prefilter(&w, vfrex, &head);
+        break;
+
+    case REGEX_AHO_CORASICK: {
+        const aho_t *ac = vfrex->aho;
+        head.aho.trans          = put_section(&w, ac->trans,
+                                              ac->state_number *
+                                              ac->class_number *
+                                              sizeof(uint32_t));
+        head.aho.state          = put_section(&w, ac->state,
+                                              ac->state_number *
+                                              sizeof(aho_state_t));
+        head.aho.state_number   = ac->state_number;
+        head.aho.literal_number = ac->literal_number;
+        head.aho.max_len        = ac->max_len;
+        head.aho.class_number   = ac->class_number;
+        memcpy(head.aho.byte_class, ac->byte_class, 256);
+        break;
+    }
+
+    case REGEX_TEDDY:
+        head.teddy      = put_section(&w, vfrex->teddy, vfrex->teddy->size);
+        head.teddy_size = vfrex->teddy->size;
+        break;
+
+    case REGEX_ONE_PASS:
+    case REGEX_NFA:
+        /* the one-pass DFA and the NFA are graphs of pointers */
+        return 0;
+    }
+
+    head.size = w.len;
+    if (w.len <= size)
+        memcpy(blob, &head, sizeof(head));
+    return w.len;
+}
+
+/* whether the section [at, at+len) is inside the blob */
+static bool in_blob(const blob_t *blob, uint64_t at, uint64_t len)
+{
+    return at >= sizeof(blob_t) && at % 8 == 0 &&
+           at <= blob->size && len <= blob->size - at;
+}
+
+/* whether every byte is mapped to one of the class_number classes, as the
+ * classes index the rows of a table */
+static bool class_ok(const uchar *byte_class, uint64_t class_number)
+{
+    for (size_t c = 0; c < 256; ++c)
+        if (byte_class[c] >= class_number)
+            return false;
+    return true;
+}
+
+static bool DFA_ok(const blob_t *blob)
+{
+    bool ok = blob->FSM[0].trans &&
+              (blob->FSM[1].trans ||
+               blob->match != REGEX_MATCH_PARTIAL_BOUNDARY);
+    for (size_t i = 0; i < 2; ++i) {
+        const blob_FSM_t *p     = &blob->FSM[i];
+        uint32_t          start = p->start & DFA_STATE;
+        if (p->trans)
+            ok = ok && p->stride == p->class_number && p->stride &&
+                 (uint64_t)p->state_number * p->stride <= DFA_STATE &&
+                 /* the start state is a row of the table, or dead */
+                 (p->start == DFA_DEAD ||
+                  (start % p->stride == 0 &&
+                   start < (uint64_t)p->state_number * p->stride)) &&
+                 class_ok(p->byte_class, p->class_number) &&
+                 in_blob(blob, p->trans, (uint64_t)p->state_number *
+                                         p->stride * sizeof(uint32_t)) &&
+                 in_blob(blob, p->accel, (uint64_t)p->state_number *
+                                         DFA_ACCEL_SIZE);
+    }
+    return ok;
+}
+
+static void load_DFA(vfrex_t v, const blob_t *blob)
+{
+    const uchar *base = (const uchar *)blob;
+    for (size_t i = 0; i < 2; ++i) {
+        const blob_FSM_t *p = &blob->FSM[i];
+        if (!p->trans)
+            continue;
+        FSM_t *FSM        = v->FSM[i] = mcalloc(1, sizeof(FSM_t));
+        FSM->trans        = (uint32_t *)(base + p->trans);
+        FSM->accel        = (uchar *)(base + p->accel);
+        FSM->stride       = p->stride;
+        FSM->state_number = p->state_number;
+        FSM->start        = p->start;
+        FSM->class_number = p->class_number;
+        FSM->cache_limit  = v->option.cache_size;
+        FSM->complete     = true;
+        memcpy(FSM->byte_class, p->byte_class, 256);
+    }
+}
+
+static void load_prefilter(vfrex_t v, const blob_t *blob)
+{
+    const uchar *base = (const uchar *)blob;
+    if (blob->prefilter) {
+        v->prefilter = prefilter_unpack(base + blob->prefilter,
+                                        blob->prefilter_size,
+                                        v->option.ignore_case);
+        if (v->FSM[0])
+            v->FSM[0]->prefilter = v->prefilter;
+    }
+}
+
+/* The header is checked, but the tables are used as they are: checking
+ * them would touch every page of the blob */
+int vfrex_load(vfrex_t *vfrex, const void *_blob, size_t size)
+{
+    const blob_t *blob = _blob;
+    const uchar  *base = _blob;
+
+    *vfrex = NULL;
+    if (!blob || ((uintptr_t)blob & 7) || size < sizeof(blob_t) ||
+        memcmp(blob->magic, BLOB_MAGIC, sizeof(blob->magic)) ||
+        blob->version != BLOB_VERSION || blob->endian != BLOB_ENDIAN ||
+        blob->size > size || blob->regex_len >= SIZE_MAX ||
+        !in_blob(blob, blob->regex, blob->regex_len + 1) ||
+        base[blob->regex + blob->regex_len])
+        return VFREX_INVALID_BLOB;
+    /* each byte of a match takes a char of the regex at least, and a
+     * stream keeps a few times the longest one */
+    if (blob->max_length != SIZE_MAX && blob->max_length > blob->regex_len)
+        return VFREX_INVALID_BLOB;
+
+    size_t len = blob->regex_len;
+    bool   ok  = false;
+    switch ((algorithm_t)blob->algorithm) {
+    case REGEX_SHIFT_OR_32:
+        ok = blob->shift_or_len > 0 && blob->shift_or_len <= 32 &&
+             in_blob(blob, blob->shift_or, 256 * sizeof(uint32_t));
+        if (blob->prefilter)
+            ok = ok && in_blob(blob, blob->prefilter, blob->prefilter_size);
+        break;
+
+    case REGEX_SHIFT_OR_64:
+        ok = blob->shift_or_len > 0 && blob->shift_or_len <= 64 &&
+             in_blob(blob, blob->shift_or, 256 * sizeof(uint64_t));
+        if (blob->prefilter)
+            ok = ok && in_blob(blob, blob->prefilter, blob->prefilter_size);
+        break;
+
+    case REGEX_BNDM:
+        ok = blob->shift_or_len > 0 && blob->shift_or_len <= 64 &&
+             in_blob(blob, blob->shift_or, 256 * sizeof(uint64_t));
+        break;
+
+    case REGEX_APPROXIMATE:
+        ok = blob->shift_or_len <= 64 && blob->max_error > 0 &&
+             blob->max_error < blob->shift_or_len &&
+             in_blob(blob, blob->shift_or, 2 * 256 * sizeof(uint64_t));
+        if (blob->prefilter)
+            ok = ok && in_blob(blob, blob->prefilter, blob->prefilter_size);
+        break;
+
+    case REGEX_SHIFT_OR_128:
+        ok = blob->shift_or_len > 0 && blob->shift_or_len <= 128 &&
+             in_blob(blob, blob->shift_or, 2 * 256 * sizeof(uint64_t));
+        if (blob->prefilter)
+            ok = ok && in_blob(blob, blob->prefilter, blob->prefilter_size);
+        break;
+
+    case REGEX_SHIFT_OR_256:
+        ok = blob->shift_or_len > 0 && blob->shift_or_len <= 256 &&
+             in_blob(blob, blob->shift_or, 4 * 256 * sizeof(uint64_t));
+        if (blob->prefilter)
+            ok = ok && in_blob(blob, blob->prefilter, blob->prefilter_size);
+        break;
+
+    case REGEX_SHIFT_OR_MULTI:
+        ok = in_blob(blob, blob->shift_or, sizeof(shift_or_multi_t)) &&
+             shift_or_multi_valid(
+                 (const shift_or_multi_t *)(base + blob->shift_or));
+        break;
+
+    case REGEX_TWO_WAY:
+        if (in_blob(blob, blob->shift_or, sizeof(two_way_t))) {
+            const two_way_t *tw = (const two_way_t *)(base + blob->shift_or);
+            ok = in_blob(blob, blob->shift_or, tw->size) &&
+                 two_way_valid(tw, tw->size);
+        }
+        break;
+
+    case REGEX_BOYER_MOORE:
+        ok = in_blob(blob, blob->BM_bad_char_table, 256 * sizeof(int32_t)) &&
+             in_blob(blob, blob->BM_good_suffix_table, (len+1) * sizeof(int32_t)) &&
+             in_blob(blob, blob->BM_full_jump_table, (len+1) * sizeof(int32_t));
+        break;
+
+    case REGEX_DFA:
+        ok = DFA_ok(blob);
+        if (blob->prefilter)
+            ok = ok && in_blob(blob, blob->prefilter, blob->prefilter_size);
+        break;
+
+    case REGEX_GLUSHKOV:
+        ok = in_blob(blob, blob->glushkov, sizeof(glushkov_t)) &&
+             glushkov_valid((const glushkov_t *)(base + blob->glushkov)) &&
+             blob->match != REGEX_MATCH_FULL_SUBMATCH &&
+             blob->match != REGEX_MATCH_PARTIAL_SUBMATCH;
+        /* only the boundaries need the DFA */
+        if (blob->match == REGEX_MATCH_PARTIAL_BOUNDARY)
+            ok = ok && DFA_ok(blob);
+        if (blob->prefilter)
+            ok = ok && in_blob(blob, blob->prefilter, blob->prefilter_size);
+        break;
+
+    case REGEX_AHO_CORASICK: {
+        const blob_aho_t *p = &blob->aho;
+        ok = p->trans && p->state_number && p->class_number &&
+             p->class_number <= 256 &&
+             p->state_number <= AHO_STATE / p->class_number &&
+             class_ok(p->byte_class, p->class_number) &&
+             in_blob(blob, p->trans, p->state_number * p->class_number *
+                                     sizeof(uint32_t)) &&
+             in_blob(blob, p->state, p->state_number * sizeof(aho_state_t));
+        break;
+    }
+
+    case REGEX_TEDDY:
+        ok = in_blob(blob, blob->teddy, blob->teddy_size) &&
+             teddy_valid((const teddy_t *)(base + blob->teddy),
+                         blob->teddy_size);
+        break;
+
+    case REGEX_ONE_PASS:
+    case REGEX_NFA:
+        break;
+    }
+    if (!ok)
+        return VFREX_INVALID_BLOB;
+
+    vfrex_t v = *vfrex = mcalloc(1, sizeof(struct vfrex_t));
+    v->blob               = blob;
+    v->regex              = (uchar *)(base + blob->regex);
+    v->regex_len          = len;
+    v->max_length         = (size_t)blob->max_length;
+    v->algorithm          = (algorithm_t)blob->algorithm;
+    v->status             = VFREX_SUCCESS;
+    v->option.style       = (vfrex_style_t)blob->style;
+    v->option.match       = (vfrex_match_t)blob->match;
+    v->option.ignore_case = (int)blob->ignore_case;
+    v->option.full_DFA    = (int)blob->full_DFA;
+    v->option.max_error   = (int)blob->max_error;
+    v->option.cache_size  = blob->cache_size;
+
+    switch (v->algorithm) {
+    case REGEX_SHIFT_OR_32:
+    case REGEX_SHIFT_OR_64:
+    case REGEX_SHIFT_OR_128:
+    case REGEX_SHIFT_OR_256:
+        v->shift_or     = (void *)(base + blob->shift_or);
+        v->shift_or_len = blob->shift_or_len;
+        load_prefilter(v, blob);
+        break;
+
+    case REGEX_BNDM:
+    case REGEX_APPROXIMATE:
+        v->shift_or     = (void *)(base + blob->shift_or);
+        v->shift_or_len = blob->shift_or_len;
+        load_prefilter(v, blob);
+        break;
+
+    case REGEX_TWO_WAY:
+        v->shift_or = (void *)(base + blob->shift_or);
+        break;
+
+    case REGEX_SHIFT_OR_MULTI:
+        v->shift_or = (void *)(base + blob->shift_or);
+        v->literal  = AHO_NONE;
+        break;
+
+    case REGEX_BOYER_MOORE:
+        v->BM_bad_char_table    = (int32_t *)(base + blob->BM_bad_char_table);
+        v->BM_good_suffix_table = (int32_t *)(base + blob->BM_good_suffix_table);
+        v->BM_full_jump_table   = (int32_t *)(base + blob->BM_full_jump_table);
+        break;
+
+    case REGEX_DFA:
+        load_DFA(v, blob);
+        load_prefilter(v, blob);
+        break;
+
+    case REGEX_GLUSHKOV:
+        v->glushkov = (glushkov_t *)(base + blob->glushkov);
+        load_DFA(v, blob);
+        load_prefilter(v, blob);
+        break;
+
+    case REGEX_AHO_CORASICK: {
+        const blob_aho_t *p = &blob->aho;
+        aho_t *ac          = v->aho = mcalloc(1, sizeof(aho_t));
+        ac->trans          = (uint32_t *)(base + p->trans);
+        ac->state          = (aho_state_t *)(base + p->state);
+        ac->state_number   = p->state_number;
+        ac->literal_number = p->literal_number;
+        ac->max_len        = p->max_len;
+        ac->class_number   = p->class_number;
+        memcpy(ac->byte_class, p->byte_class, 256);
+        v->literal = AHO_NONE;
+        break;
+    }
+
+    case REGEX_TEDDY:
+        v->teddy   = (teddy_t *)(base + blob->teddy);
+        v->literal = AHO_NONE;
+        break;
+
+    case REGEX_ONE_PASS:
+    case REGEX_NFA:
+        assert(0);
+        break;
+    }
+    return VFREX_SUCCESS;
+}
@@ -23,17 +23,55 @@
 
 #include "substring.h"
 #include "macro.h"
+#include "aho.h"
+#include "prefilter.h"
 #include <ctype.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#  define SHIFT_OR_SIMD
+#  include <immintrin.h>
+#endif
 
-int ignore_case;
-
+/* a byte of the text as the lower case regex of ignore_case has it */
 #define filter(x) (ignore_case ? tolower(x) : (x))
 
+algorithm_t shift_or_prefilter(vfrex_t vfrex)
+{
+    prefilter_free(&vfrex->prefilter);
+    if (vfrex->option.match == REGEX_MATCH_FULL_BOOL)
+        return vfrex->algorithm;
+    vfrex->prefilter = prefilter_build(vfrex);
+
+    size_t n     = 0;
+    size_t bytes = 0;
+    bool   class = false;
+    arr_for(sym, vfrex->exp) {
+        n    += sym->kind != REGEX_CONCATE;
+        class = class || sym->kind == REGEX_CHARSET;
+    }
+    if (vfrex->prefilter || !class)
+        return vfrex->algorithm;
+    arr_for(range, *vfrex->exp.v[0].ch)
+        bytes += range->upper - range->lower + 1u;
+    /* the start state of the DFA skips to the few bytes the first class
+     * matches, or the DFA skips to a literal inside */
+    if (bytes <= 3)
+        return REGEX_DFA;
+    if (n > 64)
+        return (vfrex->inner = prefilter_inner(vfrex, &vfrex->inner_split))
+                   ? REGEX_DFA : vfrex->algorithm;
+    if (n >= BNDM_MIN_INNER)
+        return REGEX_BNDM;
+    if ((vfrex->inner = prefilter_inner(vfrex, &vfrex->inner_split)))
+        return REGEX_DFA;
+    return n >= BNDM_MIN_CLASS ? REGEX_BNDM : vfrex->algorithm;
+}
+
+/* Each char or class of the regex is a bit, cleared in the mask of every
+ * byte it matches.  The ranges have both cases with ignore_case, so the
+ * text is not folded */
 #define SHIFT_OR_COMPILE_GENERATOR(SIZE) \
 void shift_or_compile_##SIZE(vfrex_t vfrex) \
 { \
-    ignore_case = vfrex->option.ignore_case; \
-    assert(vfrex->regex_len <= SIZE); \
     cleanup(vfrex->shift_or); \
  \
     vfrex->shift_or     = mmalloc(256 * sizeof(uint##SIZE##_t)); \
@@ -41,19 +79,28 @@ void shift_or_compile_##SIZE(vfrex_t vfrex) \
     uint##SIZE##_t *has = vfrex->shift_or; \
     memset(has, 0xFF, 256 * sizeof(uint##SIZE##_t)); \
  \
-    for (uchar *p = vfrex->regex; *p; ++p) \
-        has[filter(*p)] &= ~((uint##SIZE##_t)1 << (p - vfrex->regex)); \
-    return; \
+    size_t n = 0; \
+    arr_for(sym, vfrex->exp) { \
+        if (sym->kind == REGEX_CONCATE) \
+            continue; \
+        assert(sym->kind == REGEX_CHAR || sym->kind == REGEX_CHARSET); \
+        assert(n < SIZE); \
+        arr_for(range, *sym->ch) \
+            for (unsigned c = range->lower; c <= range->upper; ++c) \
+                has[c] &= ~((uint##SIZE##_t)1 << n); \
+        ++n; \
+    } \
+    vfrex->shift_or_len = n; \
 }
 
 #define SHIFT_OR_MATCH_GENERATOR(SIZE) \
 bool shift_or_match_##SIZE(const uchar *text, size_t len, vfrex_t vfrex) \
 { \
-    UNUSED(len); \
-    if (vfrex->regex_len == 0) { \
-        vfrex->group_number = 1; \
-        vfrex->group_left   = mmalloc(sizeof(size_t)); \
-        vfrex->group_right  = mmalloc(sizeof(size_t)); \
+    size_t n = vfrex->shift_or_len; \
+    if (vfrex->option.match == REGEX_MATCH_FULL_BOOL && len != n) \
+        return false; \
+    if (n == 0) { \
+        group_reserve(vfrex, 1); \
         *vfrex->group_left  = text; \
         *vfrex->group_right = text; \
         return true; \
@@ -62,16 +109,20 @@ bool shift_or_match_##SIZE(const uchar *text, size_t len, vfrex_t vfrex) \
     assert(vfrex->algorithm == REGEX_SHIFT_OR_##SIZE); \
  \
     uint##SIZE##_t d    = ~(uint##SIZE##_t)0; \
-    uint##SIZE##_t mask =  (uint##SIZE##_t)1 << (vfrex->regex_len-1); \
+    uint##SIZE##_t mask =  (uint##SIZE##_t)1 << (n-1); \
+    uint##SIZE##_t live =  mask | (mask - 1); \
     uint##SIZE##_t *has =   vfrex->shift_or; \
+    const prefilter_t *pf = vfrex->prefilter; \
+    const uchar *end = text + len; \
  \
-    for (const uchar *t = text; *t; ++t) { \
-        d = (d << 1) | has[filter(*t)]; \
+    for (const uchar *t = text; t < end; ++t) { \
+        /* no match has started, skip to where one may */ \
+        if (pf && (d & live) == live && (t = prefilter_scan(pf, t, end)) == end) \
+            break; \
+        d = (d << 1) | has[*t]; \
         if (0 == (d & mask)) { \
-            vfrex->group_number = 1; \
-            vfrex->group_left   = mmalloc(sizeof(size_t)); \
-            vfrex->group_right  = mmalloc(sizeof(size_t)); \
-            *vfrex->group_left  = t + 1 - vfrex->regex_len; \
+            group_reserve(vfrex, 1); \
+            *vfrex->group_left  = t + 1 - n; \
             *vfrex->group_right = t + 1; \
             return true; \
         } \
@@ -84,6 +135,373 @@ SHIFT_OR_COMPILE_GENERATOR(64)
 SHIFT_OR_MATCH_GENERATOR(32)
 SHIFT_OR_MATCH_GENERATOR(64)
 
+/* The scan of a stream goes on from the state the chunks before left in
+ * *state, and leaves its own there */
+#define SHIFT_OR_STREAM_GENERATOR(SIZE) \
+static const uchar *stream_##SIZE(const uchar *t, const uchar *end, \
+                                  uint64_t *state, vfrex_t vfrex) \
+{ \
+    size_t n = vfrex->shift_or_len; \
+    uint##SIZE##_t d    = (uint##SIZE##_t)*state; \
+    uint##SIZE##_t mask = (uint##SIZE##_t)1 << (n-1); \
+    uint##SIZE##_t live = mask | (mask - 1); \
+    const uint##SIZE##_t *has = vfrex->shift_or; \
+    const prefilter_t *pf = vfrex->prefilter; \
+    const uchar *match = NULL; \
+ \
+    for (; t < end; ++t) { \
+        if (pf && (d & live) == live && \
+            (t = prefilter_stream_scan(pf, t, end)) == end) \
+            break; \
+        d = (d << 1) | has[*t]; \
+        if (0 == (d & mask)) { \
+            match = t + 1; \
+            break; \
+        } \
+    } \
+    *state = d; \
+    return match; \
+}
+
+SHIFT_OR_STREAM_GENERATOR(32)
+SHIFT_OR_STREAM_GENERATOR(64)
+
+/* The state of a longer string is words uint64_t, word i having the bits
+ * 64i .. 64i+63, and so is the mask of each byte in has */
+static void compile_wide(vfrex_t vfrex, size_t words)
+{
+    cleanup(vfrex->shift_or);
+
+    uint64_t *has   = mmalloc(256 * words * sizeof(uint64_t));
+    vfrex->shift_or = has;
+    memset(has, 0xFF, 256 * words * sizeof(uint64_t));
+
+    size_t n = 0;
+    arr_for(sym, vfrex->exp) {
+        if (sym->kind == REGEX_CONCATE)
+            continue;
+        assert(sym->kind == REGEX_CHAR || sym->kind == REGEX_CHARSET);
+        assert(n < 64 * words);
+        arr_for(range, *sym->ch)
+            for (unsigned c = range->lower; c <= range->upper; ++c)
+                has[c * words + n / 64] &= ~((uint64_t)1 << n % 64);
+        ++n;
+    }
+    vfrex->shift_or_len = n;
+}
+
+void shift_or_compile_128(vfrex_t vfrex)
+{
+    compile_wide(vfrex, 2);
+    vfrex->algorithm = REGEX_SHIFT_OR_128;
+}
+
+void shift_or_compile_256(vfrex_t vfrex)
+{
+    compile_wide(vfrex, 4);
+    vfrex->algorithm = REGEX_SHIFT_OR_256;
+}
+
+/* The wide scans return the end of the first match, or NULL.  The carry
+ * of each word goes into the bit 0 of the next one.  The bits past n are
+ * set by every mask, so the state is all ones when no match has
+ * started */
+static const uchar *wide_generic(const uint64_t *has, size_t words, size_t n,
+                                 const prefilter_t *pf,
+                                 const uchar *t, const uchar *end)
+{
+    uint64_t d[4] = { ~0ull, ~0ull, ~0ull, ~0ull };
+    uint64_t mask = (uint64_t)1 << (n - 1) % 64;
+    size_t   top  = (n - 1) / 64;
+    assert(words <= 4);
+    for (; t < end; ++t) {
+        if (pf && (d[0] & d[1] & d[2] & d[3]) == ~0ull &&
+            (t = prefilter_scan(pf, t, end)) == end)
+            break;
+        const uint64_t *h = has + *t * words;
+        for (size_t i = words - 1; i > 0; --i)
+            d[i] = (d[i] << 1) | (d[i-1] >> 63) | h[i];
+        d[0] = (d[0] << 1) | h[0];
+        if (!(d[top] & mask))
+            return t + 1;
+    }
+    return NULL;
+}
+
+#ifdef SHIFT_OR_SIMD
+/* SSE2 is in the baseline of x86-64 */
+static const uchar *wide_sse2(const uint64_t *has, size_t n,
+                              const prefilter_t *pf,
+                              const uchar *t, const uchar *end)
+{
+    __m128i ones = _mm_set1_epi8(-1);
+    __m128i d    = ones;
+    /* the bit of the last char goes to the sign of its word for movemask,
+     * which has the sign of word i in bit 8i+7 */
+    __m128i up   = _mm_cvtsi32_si128(63 - (int)((n - 1) % 64));
+    int     sign = (n - 1) / 64 ? 0x8000 : 0x80;
+    for (; t < end; ++t) {
+        if (pf && _mm_movemask_epi8(_mm_cmpeq_epi8(d, ones)) == 0xFFFF &&
+            (t = prefilter_scan(pf, t, end)) == end)
+            break;
+        __m128i h     = _mm_loadu_si128((const __m128i *)(has + *t * 2));
+        __m128i carry = _mm_srli_epi64(_mm_slli_si128(d, 8), 63);
+        d = _mm_or_si128(_mm_or_si128(_mm_slli_epi64(d, 1), carry), h);
+        if (!(_mm_movemask_epi8(_mm_sll_epi64(d, up)) & sign))
+            return t + 1;
+    }
+    return NULL;
+}
+
+/* AVX2 is not in the baseline of x86-64, so it is compiled for this function
+ * only and used when the CPU has it */
+__attribute__((target("avx2")))
+static const uchar *wide_avx2(const uint64_t *has, size_t n,
+                              const prefilter_t *pf,
+                              const uchar *t, const uchar *end)
+{
+    __m256i ones = _mm256_set1_epi8(-1);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i d    = ones;
+    uint64_t m[4] = { 0, 0, 0, 0 };
+    m[(n - 1) / 64] = (uint64_t)1 << (n - 1) % 64;
+    __m256i mask = _mm256_loadu_si256((const __m256i *)m);
+    for (; t < end; ++t) {
+        if (pf && _mm256_movemask_epi8(_mm256_cmpeq_epi8(d, ones)) == -1 &&
+            (t = prefilter_scan(pf, t, end)) == end)
+            break;
+        __m256i h = _mm256_loadu_si256((const __m256i *)(has + *t * 4));
+        /* word i-1 moved to word i, and 0 into word 0 */
+        __m256i carry = _mm256_blend_epi32(
+            _mm256_srli_epi64(_mm256_permute4x64_epi64(d, 0x90), 63),
+            zero, 0x03);
+        d = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi64(d, 1), carry),
+                            h);
+        if (_mm256_testz_si256(d, mask))
+            return t + 1;
+    }
+    return NULL;
+}
+
+static bool has_avx2(void)
+{
+    static int known = -1;
+    int        avx2  = __atomic_load_n(&known, __ATOMIC_RELAXED);
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&known, avx2, __ATOMIC_RELAXED);
+    }
+    return avx2;
+}
+#endif
+
+static bool match_wide(const uchar *text, size_t len, vfrex_t vfrex,
+                       size_t words)
+{
+    size_t n = vfrex->shift_or_len;
+    if (vfrex->option.match == REGEX_MATCH_FULL_BOOL && len != n)
+        return false;
+
+    const uint64_t    *has = vfrex->shift_or;
+    const prefilter_t *pf  = vfrex->prefilter;
+    const uchar       *end = text + len;
+    const uchar       *right = text;
+    if (n == 0)
+        goto found;
+#ifdef SHIFT_OR_SIMD
+    if (words == 2)
+        right = wide_sse2(has, n, pf, text, end);
+    else if (has_avx2())
+        right = wide_avx2(has, n, pf, text, end);
+    else
+#endif
+        right = wide_generic(has, words, n, pf, text, end);
+    if (!right)
+        return false;
+
+found:
+    group_reserve(vfrex, 1);
+    *vfrex->group_left  = right - n;
+    *vfrex->group_right = right;
+    return true;
+}
+
+bool shift_or_match_128(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_SHIFT_OR_128);
+    return match_wide(text, len, vfrex, 2);
+}
+
+bool shift_or_match_256(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_SHIFT_OR_256);
+    return match_wide(text, len, vfrex, 4);
+}
+
+/* wide_generic on the state d of a stream, which is all ones past the
+ * words of the string */
+static const uchar *stream_wide(const uchar *t, const uchar *end,
+                                uint64_t *d, size_t words, vfrex_t vfrex)
+{
+    const uint64_t    *has  = vfrex->shift_or;
+    const prefilter_t *pf   = vfrex->prefilter;
+    size_t             n    = vfrex->shift_or_len;
+    uint64_t           mask = (uint64_t)1 << (n - 1) % 64;
+    size_t             top  = (n - 1) / 64;
+    for (; t < end; ++t) {
+        if (pf && (d[0] & d[1] & d[2] & d[3]) == ~0ull &&
+            (t = prefilter_stream_scan(pf, t, end)) == end)
+            break;
+        const uint64_t *h = has + *t * words;
+        for (size_t i = words - 1; i > 0; --i)
+            d[i] = (d[i] << 1) | (d[i-1] >> 63) | h[i];
+        d[0] = (d[0] << 1) | h[0];
+        if (!(d[top] & mask))
+            return t + 1;
+    }
+    return NULL;
+}
+
+const uchar *shift_or_stream(const uchar *text, const uchar *end,
+                             uint64_t *d, vfrex_t vfrex)
+{
+    assert(vfrex->shift_or_len);
+    switch (vfrex->algorithm) {
+    case REGEX_SHIFT_OR_32:
+        return stream_32(text, end, d, vfrex);
+    case REGEX_SHIFT_OR_64:
+        return stream_64(text, end, d, vfrex);
+    case REGEX_SHIFT_OR_128:
+        return stream_wide(text, end, d, 2, vfrex);
+    default:
+        assert(vfrex->algorithm == REGEX_SHIFT_OR_256);
+        return stream_wide(text, end, d, 4, vfrex);
+    }
+}
+
+void shift_or_compile_multi(vfrex_t vfrex)
+{
+    word_a word;
+    bool   ok = aho_words(vfrex, &word);
+    assert(ok);
+    (void)ok;
+    cleanup(vfrex->shift_or);
+
+    shift_or_multi_t *so = mcalloc(1, sizeof(shift_or_multi_t));
+    memset(so->has, 0xFF, sizeof(so->has));
+    so->literal_number = (uint32_t)word.len;
+
+    size_t at = 0;
+    for (size_t i = 0; i < word.len; ++i) {
+        const word_t *w = &word.v[i];
+        assert(w->len && at + w->len <= SHIFT_OR_MULTI_LEN);
+        so->start[i] = (uchar)at;
+        so->first   |= (uint64_t)1 << at;
+        for (size_t j = 0; j < w->len; ++j, ++at) {
+            uchar c = w->v[j];
+            uchar u = (uchar)(vfrex->option.ignore_case ? toupper(c) : c);
+            so->has[c]     &= ~((uint64_t)1 << at);
+            so->has[u]     &= ~((uint64_t)1 << at);
+            so->byte[at]    = c;
+            so->literal[at] = (uchar)i;
+        }
+        so->last |= (uint64_t)1 << (at - 1);
+        if (w->len > so->max_len)
+            so->max_len = (uint32_t)w->len;
+    }
+    so->start[word.len] = (uchar)at;
+    aho_free_words(&word);
+
+    vfrex->shift_or  = so;
+    vfrex->algorithm = REGEX_SHIFT_OR_MULTI;
+    vfrex->literal   = AHO_NONE;
+}
+
+static bool equal_multi(const uchar *w, const uchar *s, size_t len,
+                        bool ignore_case)
+{
+    for (size_t i = 0; i < len; ++i)
+        if (filter(s[i]) != w[i])
+            return false;
+    return true;
+}
+
+/* The leftmost match wins, then the first literal starting there, as in
+ * the DFA.  Each of them has ended max_len bytes after the leftmost start
+ * seen so far */
+bool shift_or_match_multi(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_SHIFT_OR_MULTI);
+    const shift_or_multi_t *so          = vfrex->shift_or;
+    const uchar            *end         = text + len;
+    bool                    ignore_case = vfrex->option.ignore_case;
+    vfrex->literal = AHO_NONE;
+
+    if (vfrex->option.match == REGEX_MATCH_FULL_BOOL) {
+        for (uint32_t i = 0; i < so->literal_number; ++i)
+            if ((size_t)(so->start[i+1] - so->start[i]) == len &&
+                equal_multi(so->byte + so->start[i], text, len,
+                            ignore_case)) {
+                vfrex->literal = i;
+                return true;
+            }
+        return false;
+    }
+
+    const uint64_t *has   = so->has;
+    uint64_t        first = ~so->first;
+    uint64_t        last  = so->last;
+    uint64_t        d     = ~(uint64_t)0;
+    const uchar    *left  = NULL;
+    const uchar    *right = NULL;
+    uint32_t        found = AHO_NONE;
+    for (const uchar *t = text; t < end; ) {
+        uint64_t hit;
+        do {
+            d   = ((d << 1) & first) | has[*t++];
+            hit = ~d & last;
+        } while (!hit && t < end);
+        for (; hit; hit &= hit - 1) {
+            uint32_t     i     = so->literal[__builtin_ctzll(hit)];
+            const uchar *start = t - (so->start[i+1] - so->start[i]);
+            if (!left || start < left || (start == left && i < found)) {
+                left  = start;
+                right = t;
+                found = i;
+            }
+        }
+        if (left && (vfrex->option.match == REGEX_MATCH_PARTIAL_BOOL ||
+                     (size_t)(t - left) >= so->max_len))
+            break;
+    }
+    if (!left)
+        return false;
+
+    vfrex->literal = found;
+    if (vfrex->option.match == REGEX_MATCH_PARTIAL_BOUNDARY) {
+        group_reserve(vfrex, 1);
+        *vfrex->group_left  = left;
+        *vfrex->group_right = right;
+    }
+    return true;
+}
+
+bool shift_or_multi_valid(const shift_or_multi_t *so)
+{
+    uint32_t n = so->literal_number;
+    if (n < 1 || n > SHIFT_OR_MULTI_LEN || so->start[0] != 0 ||
+        so->start[n] > SHIFT_OR_MULTI_LEN || so->max_len > SHIFT_OR_MULTI_LEN)
+        return false;
+    for (size_t i = 0; i < n; ++i)
+        if (so->start[i] >= so->start[i+1])
+            return false;
+    for (size_t at = 0; at < SHIFT_OR_MULTI_LEN; ++at)
+        if (so->literal[at] >= n)
+            return false;
+    return true;
+}
+
 static size_t match_length(uchar *x, uchar *y)
 {
     size_t ret = 0;
@@ -119,13 +537,13 @@ static void calc_z_table(const uchar *regex, size_t len, size_t *z)
     for (i = z[1]+1; i < len; ++i) {
         size_t jz = j + z[j];
         if (jz > i) {
+            /* inside the box, z[i] is z[i-j] unless it reaches the end of
+             * the box, from where it has to be matched again */
             size_t i0 = i-j;
             if (i + z[i0] < jz)
                 z[i] = z[i0];
-            else if (i + z[i0] == jz)
-                z[i] = jz - i;
             else
-                z[i] = jz - i + match_length(rev+z[j], rev+jz);
+                z[i] = jz - i + match_length(rev+jz-i, rev+jz);
         } else {
             z[i] = match_length(rev, rev+i);
         }
@@ -147,7 +565,8 @@ static void calc_bad_char_table(const uchar *regex, size_t len,
                                 size_t *z, int32_t *tab)
 {
     UNUSED(z);
-    memset(tab, 0x7F, 256 * sizeof(int32_t));
+    /* a byte not in the regex shifts it past the mismatch */
+    memset(tab, -1, 256 * sizeof(int32_t));
     for (size_t i = 0; i < len; ++i)
         tab[regex[i]] = i;
 }
@@ -180,7 +599,7 @@ void boyer_moore_compile(vfrex_t vfrex)
 #ifdef DEBUG
     puts("Boyer-Moore-Match");
 #endif
-    ignore_case = vfrex->option.ignore_case;
+    bool ignore_case = vfrex->option.ignore_case;
 
     size_t len                 = vfrex->regex_len;
     uchar *regex               = vfrex->regex;
@@ -215,26 +634,26 @@ bool boyer_moore_match(const uchar *text, size_t len, vfrex_t vfrex)
     assert(vfrex->BM_bad_char_table);
     assert(vfrex->BM_good_suffix_table);
     assert(vfrex->BM_full_jump_table);
+    if (vfrex->option.match == REGEX_MATCH_FULL_BOOL && len != vfrex->regex_len)
+        return false;
 
     int32_t     *bad_char_table    = vfrex->BM_bad_char_table;
     int32_t     *good_suffix_table = vfrex->BM_good_suffix_table;
     int32_t     *full_jump_table   = vfrex->BM_full_jump_table;
     const uchar *regex             = vfrex->regex;
+    bool         ignore_case       = vfrex->option.ignore_case;
 
     int32_t k = vfrex->regex_len - 1;
-    int32_t previous = -1;
     while (k < (int32_t)len) {
         int32_t i = vfrex->regex_len - 1;
         int32_t j = k;
-        while (j >= 0 && j > previous && regex[i] == filter(text[j])) {
+        while (i >= 0 && regex[i] == filter(text[j])) {
             --i;
             --j;
         }
 
-        if (i == -1 || j == previous) {
-            vfrex->group_number = 1;
-            vfrex->group_left   = mmalloc(sizeof(size_t));
-            vfrex->group_right  = mmalloc(sizeof(size_t));
+        if (i == -1) {
+            group_reserve(vfrex, 1);
             *vfrex->group_left  = text + k + 1 - vfrex->regex_len;
             *vfrex->group_right = text + k + 1;
             return true;
@@ -253,11 +672,427 @@ bool boyer_moore_match(const uchar *text, size_t len, vfrex_t vfrex)
                 shift_suffix = full_jump_table[i+1];
             else
                 shift_suffix = good_suffix_table[i+1];
-            int shift = max(shift_char, shift_suffix);
-            if (shift > i)
-                previous = k;
-            k += shift;
+            k += max(shift_char, shift_suffix);
         }
     }
     return false;
 }
+
+/* The bytes of a string of chars, in lower case with ignore_case.  buf may
+ * be NULL to get the length only */
+static size_t string_literal(vfrex_t vfrex, uchar *buf)
+{
+    size_t n = 0;
+    arr_for(sym, vfrex->exp) {
+        if (sym->kind == REGEX_CONCATE)
+            continue;
+        assert(sym->kind == REGEX_CHAR);
+        if (buf) {
+            int c = sym->ch->v[0].lower;
+            buf[n] = (uchar)(vfrex->option.ignore_case ? tolower(c) : c);
+        }
+        ++n;
+    }
+    return n;
+}
+
+/* The critical point of x, the start of the larger of its maximal suffixes
+ * for the order of the bytes and for the reverse order.  *period is the
+ * period of that suffix */
+static size_t critical_factorization(const uchar *x, size_t n, size_t *period)
+{
+    if (n < 3) {
+        *period = 1;
+        return n ? n - 1 : 0;
+    }
+    size_t start[2];
+    size_t p[2];
+    for (int rev = 0; rev < 2; ++rev) {
+        /* the suffix at m is the largest so far, x[j+1 ..] is compared to it
+         * at offset k */
+        size_t m = (size_t)-1, j = 0, k = 1;
+        p[rev] = 1;
+        while (j + k < n) {
+            uchar a = x[j + k];
+            uchar b = x[m + k];
+            if (a == b) {
+                if (k == p[rev]) {
+                    j += p[rev];
+                    k  = 1;
+                } else
+                    ++k;
+            } else if ((a < b) != rev) {
+                j     += k;
+                k      = 1;
+                p[rev] = j - m;
+            } else {
+                m      = j++;
+                k      = 1;
+                p[rev] = 1;
+            }
+        }
+        start[rev] = m + 1;
+    }
+    int larger = start[1] >= start[0];
+    *period = p[larger];
+    return start[larger];
+}
+
+/* The literal has the period of its right part if its left part repeats
+ * it */
+static bool literal_periodic(const uchar *x, size_t critical, size_t period)
+{
+    return !memcmp(x, x + period, critical);
+}
+
+/* The length of the longest factor of x with a period of at most
+ * TWO_WAY_MAX_PERIOD */
+static size_t periodic_run(const uchar *x, size_t n)
+{
+    size_t longest = 0;
+    for (size_t p = 1; p <= TWO_WAY_MAX_PERIOD && p < n; ++p) {
+        size_t run = 0;
+        for (size_t i = 0; i + p < n; ++i) {
+            run = x[i] == x[i + p] ? run + 1 : 0;
+            /* the factor holds its first p bytes at least twice */
+            if (run >= p)
+                longest = max(longest, run + p);
+        }
+    }
+    return longest;
+}
+
+bool two_way_fit(vfrex_t vfrex)
+{
+    size_t n = string_literal(vfrex, NULL);
+    if (n < 2)
+        return false;
+    uchar *x = mmalloc(n);
+    string_literal(vfrex, x);
+    size_t period;
+    size_t critical = critical_factorization(x, n, &period);
+    bool   whole    = literal_periodic(x, critical, period) && 2 * period <= n;
+    bool   fit      = !whole && 2 * periodic_run(x, n) >= n;
+    mfree(x);
+    return fit;
+}
+
+void two_way_compile(vfrex_t vfrex)
+{
+    cleanup(vfrex->shift_or);
+
+    size_t     n  = string_literal(vfrex, NULL);
+    two_way_t *tw = mcalloc(1, sizeof(two_way_t) + n);
+    string_literal(vfrex, tw->literal);
+    tw->size        = (uint32_t)(sizeof(two_way_t) + n);
+    tw->len         = (uint32_t)n;
+    tw->ignore_case = (uint32_t)vfrex->option.ignore_case;
+    for (int c = 0; c < 256; ++c)
+        tw->fold[c] = (uchar)(tw->ignore_case ? tolower(c) : c);
+
+    size_t period;
+    size_t critical = critical_factorization(tw->literal, n, &period);
+    tw->critical = (uint32_t)critical;
+    tw->periodic = literal_periodic(tw->literal, critical, period);
+    /* with no period, the window moves past the longer part */
+    tw->period   = (uint32_t)(tw->periodic ? period
+                              : max(critical, n - critical) + 1);
+
+    for (int c = 0; c < 256; ++c)
+        tw->shift[c] = (uint32_t)n;
+    for (size_t i = 0; i < n; ++i)
+        tw->shift[tw->literal[i]] = (uint32_t)(n - 1 - i);
+    for (int c = 0; c < 256; ++c)
+        tw->shift[c] = tw->shift[tw->fold[c]];
+
+    vfrex->shift_or  = tw;
+    vfrex->algorithm = REGEX_TWO_WAY;
+}
+
+/* The window at j is skipped by the shift of its last byte, until that byte
+ * is the last one of the literal.  memory is the prefix of the literal known
+ * to match the window, after a shift by the period */
+bool two_way_match(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_TWO_WAY);
+    const two_way_t *tw     = vfrex->shift_or;
+    const uchar     *x      = tw->literal;
+    const uchar     *fold   = tw->fold;
+    size_t           n      = tw->len;
+    size_t           ell    = tw->critical;
+    size_t           period = tw->period;
+    if (vfrex->option.match == REGEX_MATCH_FULL_BOOL && len != n)
+        return false;
+
+    size_t j      = 0;
+    size_t memory = 0;
+    bool   found  = n == 0;
+    while (!found && j + n <= len) {
+        const uchar *w     = text + j;
+        size_t       shift = tw->shift[w[n - 1]];
+        if (shift) {
+            /* the prefix kept by the period is lost by a shorter shift */
+            if (memory && shift < period)
+                shift = n - period;
+            memory = 0;
+            j     += shift;
+            continue;
+        }
+        /* the right part, whose last byte is known to match */
+        size_t i = max(ell, memory);
+        while (i < n - 1 && x[i] == fold[w[i]])
+            ++i;
+        if (i < n - 1) {
+            j     += i - ell + 1;
+            memory = 0;
+            continue;
+        }
+        /* the left part, down to the prefix that is known to match */
+        i = ell;
+        while (i > memory && x[i - 1] == fold[w[i - 1]])
+            --i;
+        if (i <= memory)
+            found = true;
+        else if (tw->periodic) {
+            j     += period;
+            memory = n - period;
+        } else
+            j += period;
+    }
+    if (!found)
+        return false;
+
+    group_reserve(vfrex, 1);
+    *vfrex->group_left  = text + j;
+    *vfrex->group_right = text + j + n;
+    return true;
+}
+
+bool two_way_valid(const two_way_t *tw, size_t size)
+{
+    if (size < sizeof(two_way_t) || tw->size != size ||
+        tw->len != size - sizeof(two_way_t) || tw->critical > tw->len ||
+        tw->period < 1 || tw->period > tw->len + 1)
+        return false;
+    for (int c = 0; c < 256; ++c)
+        if (tw->shift[c] > tw->len)
+            return false;
+    return true;
+}
+
+void bndm_compile(vfrex_t vfrex)
+{
+    shift_or_compile_64(vfrex);
+    vfrex->algorithm = REGEX_BNDM;
+}
+
+/* The window of n bytes is read backward.  Bit i of d is set while the
+ * bytes read are the string at i of the regex, so a set bit 0 is a prefix,
+ * where the next window may start */
+bool bndm_match(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_BNDM);
+    size_t n = vfrex->shift_or_len;
+    if (vfrex->option.match == REGEX_MATCH_FULL_BOOL && len != n)
+        return false;
+
+    const uint64_t *has  = vfrex->shift_or;
+    uint64_t        all  = n < 64 ? ((uint64_t)1 << n) - 1 : ~(uint64_t)0;
+    size_t          pos  = 0;
+    bool            found = n == 0;
+    while (!found && pos + n <= len) {
+        const uchar *window = text + pos;
+        size_t   j    = n;
+        size_t   last = n;
+        uint64_t d    = all;
+        do {
+            /* the bits past n are set in every mask, so they are cleared
+             * here */
+            d &= ~has[window[--j]];
+            if (d & 1) {
+                if (j == 0) {
+                    found = true;
+                    break;
+                }
+                last = j;
+            }
+            d >>= 1;
+        } while (d);
+        if (!found)
+            pos += last;
+    }
+    if (!found)
+        return false;
+
+    group_reserve(vfrex, 1);
+    *vfrex->group_left  = text + pos;
+    *vfrex->group_right = text + pos + n;
+    return true;
+}
+
+void approximate_compile(vfrex_t vfrex)
+{
+    shift_or_compile_64(vfrex);
+    size_t    n   = vfrex->shift_or_len;
+    uint64_t *has = mrealloc(vfrex->shift_or, 512 * sizeof(uint64_t));
+    /* the masks of the reversed string follow, for the backward pass */
+    for (unsigned c = 0; c < 256; ++c) {
+        has[256 + c] = ~(uint64_t)0;
+        for (size_t i = 0; i < n; ++i)
+            if (!(has[c] >> i & 1))
+                has[256 + c] &= ~((uint64_t)1 << (n - 1 - i));
+    }
+    vfrex->shift_or  = has;
+    vfrex->algorithm = REGEX_APPROXIMATE;
+    prefilter_free(&vfrex->prefilter);
+    vfrex->prefilter = prefilter_pieces(vfrex,
+                                        (size_t)vfrex->option.max_error + 1);
+}
+
+/* d[j] is the shift-or state of at most j edits.  A byte is matched at the
+ * next bit of d[j], inserted keeping d[j-1], substituted at the next bit of
+ * d[j-1], and a char of the string is deleted at the next bit of the new
+ * d[j-1].  A match may start anywhere, so 0 is shifted in */
+static inline void approximate_step(uint64_t *d, size_t k, uint64_t h)
+{
+    uint64_t prev = d[0];
+    d[0] = d[0] << 1 | h;
+    for (size_t j = 1; j <= k; ++j) {
+        uint64_t old = d[j];
+        d[j] = (old << 1 | h) & (prev << 1) & prev & (d[j - 1] << 1);
+        prev = old;
+    }
+}
+
+/* The fewest edits of d, k + 1 if none of them matches */
+static inline size_t approximate_cost(const uint64_t *d, size_t k,
+                                      uint64_t mask)
+{
+    size_t j = 0;
+    while (j <= k && (d[j] & mask))
+        ++j;
+    return j;
+}
+
+/* The same states for a match anchored at t, read for len bytes by step.
+ * The start is left at j edits once more than j bytes are read, all of them
+ * inserted.  longest is set to the most bytes read with at most k edits */
+static size_t approximate_anchored(const uint64_t *has, size_t n, size_t k,
+                                   const uchar *t, size_t len,
+                                   ptrdiff_t step, size_t *longest)
+{
+    uint64_t d[64];
+    uint64_t mask = (uint64_t)1 << (n - 1);
+    for (size_t j = 0; j <= k; ++j)
+        d[j] = ~(uint64_t)0 << j;
+
+    *longest = 0;
+    for (size_t l = 0; l < len; ++l) {
+        uint64_t h    = has[t[(ptrdiff_t)l * step]];
+        uint64_t prev = d[0];
+        d[0] = (d[0] << 1 | (l > 0)) | h;
+        for (size_t j = 1; j <= k; ++j) {
+            uint64_t old = d[j];
+            d[j] = (old << 1 | (l > j) | h) & (prev << 1 | (l >= j)) &
+                   prev & (d[j - 1] << 1 | 1);
+            prev = old;
+        }
+        if (!(d[k] & mask))
+            *longest = l + 1;
+    }
+    return approximate_cost(d, k, mask);
+}
+
+/* The forward pass, up to the first end of a match with at most k edits
+ * whose states are left in d.  A match is at most reach bytes, and has one
+ * of the pieces of the prefilter, so only the bytes near one are stepped
+ * over */
+static const uchar *approximate_scan(uint64_t *d, size_t k,
+                                     const uint64_t *has, uint64_t mask,
+                                     const prefilter_t *pf, size_t reach,
+                                     const uchar *t, const uchar *end)
+{
+    for (size_t j = 0; j <= k; ++j)
+        d[j] = ~(uint64_t)0 << j;
+    uint64_t     idle = d[k];
+    /* a byte matching none of the first k + 1 chars keeps the states idle */
+    uint64_t     head = ~(uint64_t)0 >> (63 - k);
+    const uchar *stop = pf ? t : end;
+    const uchar *next = t;
+    for (;;) {
+        while (t < stop) {
+            uint64_t h = has[*t++];
+            if (d[k] == idle && (h & head) == head)
+                continue;
+            approximate_step(d, k, h);
+            if (!(d[k] & mask))
+                return t;
+        }
+        const uchar *p;
+        if (!pf || (p = prefilter_scan(pf, next, end)) == end)
+            return NULL;
+        next = p + 1;
+        if (p > t && (size_t)(p - t) > reach) {
+            for (size_t j = 0; j <= k; ++j)
+                d[j] = ~(uint64_t)0 << j;
+            t = p - reach;
+        }
+        stop = (size_t)(end - p) > reach ? p + reach : end;
+    }
+}
+
+/* The first end of a match with at most k edits is found by the forward
+ * pass, then moved over the next bytes if they lower the edits.  The start
+ * is the farthest one with as few edits, found by the backward pass */
+bool approximate_match(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_APPROXIMATE);
+    size_t          n    = vfrex->shift_or_len;
+    size_t          k    = (size_t)vfrex->option.max_error;
+    const uint64_t *has  = vfrex->shift_or;
+    uint64_t        mask = (uint64_t)1 << (n - 1);
+    assert(k < n && n <= 64);
+
+    const uchar *left, *right;
+    size_t       cost, l;
+    if (vfrex->option.match == REGEX_MATCH_FULL_BOOL) {
+        if (len > n + k)
+            return false;
+        cost  = approximate_anchored(has, n, k, text, len, 1, &l);
+        left  = text;
+        right = text + len;
+        if (cost > k)
+            return false;
+    } else {
+        uint64_t     d[64];
+        const uchar *end = text + len;
+        const uchar *t   = approximate_scan(d, k, has, mask, vfrex->prefilter,
+                                            n + k, text, end);
+        if (!t)
+            return false;
+
+        /* the next bytes may lower the edits */
+        cost  = approximate_cost(d, k, mask);
+        right = t;
+        for (size_t i = 0, more = cost; i < more && cost && t + i < end;
+             ++i) {
+            approximate_step(d, k, has[t[i]]);
+            size_t c = approximate_cost(d, k, mask);
+            if (c < cost) {
+                cost  = c;
+                right = t + i + 1;
+            }
+        }
+        size_t back = (size_t)(right - text);
+        approximate_anchored(has + 256, n, cost, right - 1,
+                             back < n + cost ? back : n + cost, -1, &l);
+        assert(l > 0);
+        left = right - l;
+    }
+
+    vfrex->edit         = cost;
+    group_reserve(vfrex, 1);
+    *vfrex->group_left  = left;
+    *vfrex->group_right = right;
+    return true;
+}
@@ -3,13 +3,117 @@
 
 #include "common.h"
 
+/* A few short literals like "GET|PUT|POST" packed side by side into the
+ * bits of one word, so a single shift-or pass runs them all.  It is only
+ * the fallback of Teddy on CPUs without pshufb */
+#define SHIFT_OR_MULTI_LEN 64
+
+typedef struct shift_or_multi_t {
+    /* the bits of the literals that are not the byte, in both cases with
+     * ignore_case */
+    uint64_t has[256];
+    /* the first and the last bit of each literal */
+    uint64_t first;
+    uint64_t last;
+    uint32_t literal_number;
+    uint32_t max_len;
+    /* literal i is the bits start[i] .. start[i+1]-1, in lower case with
+     * ignore_case */
+    uchar    start[SHIFT_OR_MULTI_LEN + 1];
+    uchar    byte[SHIFT_OR_MULTI_LEN];
+    /* the literal each bit belongs to */
+    uchar    literal[SHIFT_OR_MULTI_LEN];
+} shift_or_multi_t;
+
+/* Set the prefilter of a partial match and tell what had better match a
+ * regex with classes and no literal prefix: its shift-or, BNDM, or the DFA
+ * which skips to the few bytes of the first class or to a literal inside */
+algorithm_t shift_or_prefilter(vfrex_t vfrex);
 void shift_or_compile_32(vfrex_t vfrex);
 void shift_or_compile_64(vfrex_t vfrex);
 
 bool shift_or_match_32(const uchar *text, size_t len, vfrex_t vfrex);
 bool shift_or_match_64(const uchar *text, size_t len, vfrex_t vfrex);
 
+/* Longer strings keep the state in an SSE2 or AVX2 register, the carry
+ * crossing the 64-bit lanes */
+void shift_or_compile_128(vfrex_t vfrex);
+void shift_or_compile_256(vfrex_t vfrex);
+
+bool shift_or_match_128(const uchar *text, size_t len, vfrex_t vfrex);
+bool shift_or_match_256(const uchar *text, size_t len, vfrex_t vfrex);
+
+/* The scan of a stream goes on over [text, end) from the state d of the
+ * chunks before, which is all ones at its start: a word for a string of up
+ * to 64 chars, and four for a longer one.  The end of the first match is
+ * returned, or NULL.  Every match of the string has its length, so no byte
+ * is kept for it */
+const uchar *shift_or_stream(const uchar *text, const uchar *end,
+                             uint64_t *d, vfrex_t vfrex);
+
+void shift_or_compile_multi(vfrex_t vfrex);
+bool shift_or_match_multi(const uchar *text, size_t len, vfrex_t vfrex);
+/* Tell if so is safe to match with */
+bool shift_or_multi_valid(const shift_or_multi_t *so);
+
 void boyer_moore_compile(vfrex_t vfrex);
 bool boyer_moore_match(const uchar *text, size_t len, vfrex_t vfrex);
 
+/* Two-Way matching of a literal, by Crochemore and Perrin.  The literal is
+ * cut at a critical point, the right part is compared forward and then the
+ * left part backward, and a mismatch shifts the window past the bytes
+ * compared or by the period.  Linear time in constant space besides the
+ * shift of the last byte of the window, even on a literal and a text that
+ * repeat, where Boyer-Moore and BNDM read a window over and over.  The whole
+ * of it is one block, so a blob can hold it as it is */
+typedef struct two_way_t {
+    /* bytes of the two_way_t and the literal after it */
+    uint32_t size;
+    uint32_t len;
+    /* the right part starts at critical */
+    uint32_t critical;
+    uint32_t period;
+    /* the literal has the period, so a shift by it keeps the prefix that
+     * matched */
+    uint32_t periodic;
+    /* the literal is in lower case and the text is folded to it */
+    uint32_t ignore_case;
+    uchar    fold[256];
+    /* the shift of the window by its last byte, 0 if the byte is the last
+     * one of the literal */
+    uint32_t shift[256];
+    uchar    literal[];
+} two_way_t;
+
+/* Tell if at least half of the literal of a string is a run with a period of
+ * at most TWO_WAY_MAX_PERIOD, like "====FAIL" or "abababc", that BNDM and
+ * Boyer-Moore read again for each window on a text with the run.  A literal
+ * that is all of the run, like "abcabcabc", skips better with them */
+#define TWO_WAY_MAX_PERIOD 8
+
+bool two_way_fit(vfrex_t vfrex);
+void two_way_compile(vfrex_t vfrex);
+bool two_way_match(const uchar *text, size_t len, vfrex_t vfrex);
+/* Tell if the size bytes at tw are a two_way_t that is safe to match with */
+bool two_way_valid(const two_way_t *tw, size_t size);
+
+/* Backward matching of the window with the masks of shift-or, which skips
+ * like Boyer-Moore on a string of at most 64 chars and classes.  A shorter
+ * literal skips better with the prefilter, a class string shorter than
+ * BNDM_MIN_CLASS with shift-or, and one shorter than BNDM_MIN_INNER with
+ * the DFA skipping to a literal inside */
+#define BNDM_MIN_LITERAL 12
+#define BNDM_MIN_CLASS   8
+#define BNDM_MIN_INNER   16
+
+void bndm_compile(vfrex_t vfrex);
+bool bndm_match(const uchar *text, size_t len, vfrex_t vfrex);
+
+/* Matching with at most option.max_error edits by the extension of shift-or
+ * of Wu and Manber: one state for each number of edits, on a string of at
+ * most 64 chars and classes.  A byte of the text may be inserted, deleted,
+ * or substituted for a char of the string, each one edit */
+void approximate_compile(vfrex_t vfrex);
+bool approximate_match(const uchar *text, size_t len, vfrex_t vfrex);
+
 #endif
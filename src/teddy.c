@@ -0,0 +1,307 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "teddy.h"
+#include "macro.h"
+#include <ctype.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#  define TEDDY_SIMD
+#  include <immintrin.h>
+#endif
+
+static bool equal(const teddy_t *t, const uchar *w, const uchar *s, size_t len)
+{
+    if (!t->ignore_case)
+        return !memcmp(w, s, len);
+    for (size_t i = 0; i < len; ++i)
+        if (t->fold[s[i]] != w[i])
+            return false;
+    return true;
+}
+
+/* The first literal of the buckets starting at s, AHO_NONE if there is
+ * none */
+static uint32_t verify(const teddy_t *t, unsigned bucket,
+                       const uchar *s, const uchar *end)
+{
+    uint32_t found = AHO_NONE;
+    for (; bucket; bucket &= bucket - 1) {
+        unsigned b = (unsigned)__builtin_ctz(bucket);
+        for (uint32_t k = t->first[b]; k < t->first[b+1]; ++k) {
+            uint32_t i   = t->member[k];
+            size_t   len = t->offset[i+1] - t->offset[i];
+            if (i < found && len <= (size_t)(end - s) &&
+                equal(t, t->byte + t->offset[i], s, len))
+                found = i;
+        }
+    }
+    return found;
+}
+
+/* The leftmost position in [p, end) where a literal starts, or end.  The
+ * first literal starting there is put into found */
+static const uchar *scan_generic(const teddy_t *t, const uchar *p,
+                                 const uchar *end, uint32_t *found)
+{
+    for (; (size_t)(end - p) >= t->finger; ++p) {
+        unsigned bucket = 0xFF;
+        for (size_t j = 0; j < t->finger; ++j)
+            bucket &= t->lo[j][p[j] & 15] & t->hi[j][p[j] >> 4];
+        if (bucket && (*found = verify(t, bucket, p, end)) != AHO_NONE)
+            return p;
+    }
+    return end;
+}
+
+#ifdef TEDDY_SIMD
+/* SSSE3 and AVX2 are not in the baseline of x86-64, so they are compiled
+ * for these functions only and used when the CPU has them.  The tables of
+ * the bytes after finger are all ones, so the three lookups are always
+ * done */
+__attribute__((target("ssse3")))
+static const uchar *scan_ssse3(const teddy_t *t, const uchar *p,
+                               const uchar *end, uint32_t *found)
+{
+    __m128i lo[TEDDY_FINGER], hi[TEDDY_FINGER];
+    for (size_t j = 0; j < TEDDY_FINGER; ++j) {
+        lo[j] = _mm_loadu_si128((const __m128i *)t->lo[j]);
+        hi[j] = _mm_loadu_si128((const __m128i *)t->hi[j]);
+    }
+    __m128i nibble = _mm_set1_epi8(0x0f);
+    for (; end - p >= 16 + TEDDY_FINGER - 1; p += 16) {
+        __m128i m = _mm_set1_epi8(-1);
+        for (size_t j = 0; j < TEDDY_FINGER; ++j) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(p + j));
+            __m128i l = _mm_and_si128(x, nibble);
+            __m128i h = _mm_and_si128(_mm_srli_epi16(x, 4), nibble);
+            m = _mm_and_si128(m, _mm_and_si128(_mm_shuffle_epi8(lo[j], l),
+                                               _mm_shuffle_epi8(hi[j], h)));
+        }
+        unsigned mask = 0xFFFFu & ~(unsigned)
+            _mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128()));
+        if (!mask)
+            continue;
+        uchar bucket[16];
+        _mm_storeu_si128((__m128i *)bucket, m);
+        for (; mask; mask &= mask - 1) {
+            unsigned k = (unsigned)__builtin_ctz(mask);
+            if ((*found = verify(t, bucket[k], p + k, end)) != AHO_NONE)
+                return p + k;
+        }
+    }
+    return scan_generic(t, p, end, found);
+}
+
+__attribute__((target("avx2")))
+static const uchar *scan_avx2(const teddy_t *t, const uchar *p,
+                              const uchar *end, uint32_t *found)
+{
+    /* pshufb looks up within each 16 byte lane, so each lane has the
+     * tables */
+    __m256i lo[TEDDY_FINGER], hi[TEDDY_FINGER];
+    for (size_t j = 0; j < TEDDY_FINGER; ++j) {
+        lo[j] = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128((const __m128i *)t->lo[j]));
+        hi[j] = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128((const __m128i *)t->hi[j]));
+    }
+    __m256i nibble = _mm256_set1_epi8(0x0f);
+    for (; end - p >= 32 + TEDDY_FINGER - 1; p += 32) {
+        __m256i m = _mm256_set1_epi8(-1);
+        for (size_t j = 0; j < TEDDY_FINGER; ++j) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(p + j));
+            __m256i l = _mm256_and_si256(x, nibble);
+            __m256i h = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+            m = _mm256_and_si256(m,
+                    _mm256_and_si256(_mm256_shuffle_epi8(lo[j], l),
+                                     _mm256_shuffle_epi8(hi[j], h)));
+        }
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(
+                            _mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+        if (!mask)
+            continue;
+        uchar bucket[32];
+        _mm256_storeu_si256((__m256i *)bucket, m);
+        for (; mask; mask &= mask - 1) {
+            unsigned k = (unsigned)__builtin_ctz(mask);
+            if ((*found = verify(t, bucket[k], p + k, end)) != AHO_NONE)
+                return p + k;
+        }
+    }
+    return scan_ssse3(t, p, end, found);
+}
+#endif
+
+/* 2 for AVX2, 1 for SSSE3 and 0 for neither */
+static int simd_level(void)
+{
+    static int known = -1;
+    int        level = __atomic_load_n(&known, __ATOMIC_RELAXED);
+    if (level < 0) {
+#ifdef TEDDY_SIMD
+        __builtin_cpu_init();
+        level = __builtin_cpu_supports("avx2")  ? 2 :
+                __builtin_cpu_supports("ssse3") ? 1 : 0;
+#else
+        level = 0;
+#endif
+        __atomic_store_n(&known, level, __ATOMIC_RELAXED);
+    }
+    return level;
+}
+
+static const uchar *scan(const teddy_t *t, const uchar *p,
+                         const uchar *end, uint32_t *found)
+{
+#ifdef TEDDY_SIMD
+    switch (simd_level()) {
+    case 2:
+        return scan_avx2(t, p, end, found);
+    case 1:
+        return scan_ssse3(t, p, end, found);
+    }
+#endif
+    return scan_generic(t, p, end, found);
+}
+
+extern bool teddy_simd(void)
+{
+    return simd_level() > 0;
+}
+
+extern void teddy_compile(vfrex_t vfrex)
+{
+    word_a word;
+    bool   ok = aho_words(vfrex, &word);
+    assert(ok);
+    (void)ok;
+    size_t n = word.len;
+    assert(TEDDY_MIN_LITERAL <= n && n <= TEDDY_MAX_LITERAL);
+
+    size_t total = 0, min_len = SIZE_MAX;
+    arr_for(w, word) {
+        total += w->len;
+        if (w->len < min_len)
+            min_len = w->len;
+    }
+    teddy_t *t = mcalloc(1, sizeof(teddy_t) + total);
+    t->size           = (uint32_t)(sizeof(teddy_t) + total);
+    t->literal_number = (uint32_t)n;
+    t->finger         = (uint32_t)(min_len < TEDDY_FINGER ? min_len
+                                                          : TEDDY_FINGER);
+    t->ignore_case    = vfrex->option.ignore_case;
+    for (int c = 0; c < 256; ++c)
+        t->fold[c] = (uchar)(t->ignore_case ? tolower(c) : c);
+    for (size_t i = 0; i < n; ++i) {
+        t->offset[i+1] = t->offset[i] + (uint32_t)word.v[i].len;
+        memcpy(t->byte + t->offset[i], word.v[i].v, word.v[i].len);
+    }
+
+    /* Literals alike share a bucket, so a candidate has fewer of them to
+     * compare with */
+    uint32_t order[TEDDY_MAX_LITERAL];
+    for (size_t i = 0; i < n; ++i) {
+        size_t k = i;
+        for (; k && memcmp(word.v[order[k-1]].v, word.v[i].v, t->finger) > 0;
+             --k)
+            order[k] = order[k-1];
+        order[k] = (uint32_t)i;
+    }
+    for (size_t b = 0; b <= TEDDY_BUCKET; ++b)
+        t->first[b] = (uint32_t)(b * n / TEDDY_BUCKET);
+    for (size_t b = 0; b < TEDDY_BUCKET; ++b)
+        for (uint32_t k = t->first[b]; k < t->first[b+1]; ++k) {
+            const uchar *w = word.v[order[k]].v;
+            t->member[k] = order[k];
+            for (size_t j = 0; j < t->finger; ++j) {
+                int c[2] = { w[j], t->ignore_case ? toupper(w[j]) : w[j] };
+                for (int u = 0; u < 2; ++u) {
+                    t->lo[j][c[u] & 15] |= (uchar)(1 << b);
+                    t->hi[j][c[u] >> 4] |= (uchar)(1 << b);
+                }
+            }
+        }
+    for (size_t j = t->finger; j < TEDDY_FINGER; ++j) {
+        memset(t->lo[j], 0xFF, 16);
+        memset(t->hi[j], 0xFF, 16);
+    }
+    aho_free_words(&word);
+
+    vfrex->teddy   = t;
+    vfrex->literal = AHO_NONE;
+}
+
+extern bool teddy_match(const uchar *text, size_t len, vfrex_t vfrex)
+{
+    assert(vfrex->algorithm == REGEX_TEDDY);
+    const teddy_t *t     = vfrex->teddy;
+    const uchar   *end   = text + len;
+    uint32_t       found = AHO_NONE;
+
+    vfrex->literal = AHO_NONE;
+    if (vfrex->option.match == REGEX_MATCH_FULL_BOOL) {
+        for (uint32_t i = 0; i < t->literal_number; ++i)
+            if (t->offset[i+1] - t->offset[i] == len &&
+                equal(t, t->byte + t->offset[i], text, len)) {
+                vfrex->literal = i;
+                return true;
+            }
+        return false;
+    }
+
+    const uchar *left = scan(t, text, end, &found);
+    if (left == end)
+        return false;
+
+    vfrex->literal = found;
+    if (vfrex->option.match == REGEX_MATCH_PARTIAL_BOUNDARY) {
+        group_reserve(vfrex, 1);
+        *vfrex->group_left  = left;
+        *vfrex->group_right = left + t->offset[found+1] - t->offset[found];
+    }
+    return true;
+}
+
+extern bool teddy_valid(const teddy_t *t, size_t size)
+{
+    if (size < sizeof(teddy_t) || t->size != size)
+        return false;
+    uint32_t n = t->literal_number;
+    if (n < TEDDY_MIN_LITERAL || n > TEDDY_MAX_LITERAL ||
+        t->finger < 1 || t->finger > TEDDY_FINGER ||
+        t->first[0] != 0 || t->first[TEDDY_BUCKET] != n ||
+        t->offset[0] != 0 || t->offset[n] != size - sizeof(teddy_t))
+        return false;
+    for (size_t b = 0; b < TEDDY_BUCKET; ++b)
+        if (t->first[b] > t->first[b+1])
+            return false;
+    for (size_t i = 0; i < n; ++i)
+        if (t->member[i] >= n || t->offset[i+1] < t->offset[i] + t->finger)
+            return false;
+    return true;
+}
+
+extern void teddy_free(vfrex_t vfrex)
+{
+    cleanup(vfrex->teddy);
+}
@@ -0,0 +1,75 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2013, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef __TEDDY_H
+#define __TEDDY_H
+
+#include "common.h"
+#include "aho.h"
+
+/* A short alternation of literals like "error|warn|fatal|panic" is matched
+ * with Teddy.  The literals are put into 8 buckets, and for each of their
+ * first few bytes a pair of 16 entry tables tells the buckets whose
+ * literals may have a byte with that low and high nibble there.  pshufb
+ * looks the nibbles of 16 or 32 bytes of the text up at once, and a
+ * position is a candidate if a bucket survives the AND over the bytes.
+ * The literals of its buckets are compared with the text exactly. */
+
+#define TEDDY_MIN_LITERAL 2
+/* more literals than this go to Aho-Corasick */
+#define TEDDY_MAX_LITERAL (AHO_MIN_LITERAL - 1)
+#define TEDDY_BUCKET      8
+/* the number of bytes looked up at each position */
+#define TEDDY_FINGER      3
+
+/* The whole of it is one block of fixed width fields, so a blob can hold
+ * it as it is */
+struct teddy_t {
+    /* bytes of the teddy_t and the literals after it */
+    uint32_t size;
+    uint32_t literal_number;
+    /* the bytes of each literal looked up, no more than the length of the
+     * shortest one.  The tables of the others let every bucket through */
+    uint32_t finger;
+    /* the literals are in lower case and the text is folded to it */
+    uint32_t ignore_case;
+    uchar    fold[256];
+    uchar    lo[TEDDY_FINGER][16];
+    uchar    hi[TEDDY_FINGER][16];
+    /* the literals of bucket b are member[first[b]] .. member[first[b+1]-1] */
+    uint32_t first[TEDDY_BUCKET + 1];
+    uint32_t member[TEDDY_MAX_LITERAL];
+    /* literal i is byte[offset[i]] .. byte[offset[i+1]-1] */
+    uint32_t offset[TEDDY_MAX_LITERAL + 1];
+    uchar    byte[];
+};
+
+/* Without pshufb, the scalar loop over the tables is slower than the packed
+ * shift-or, which is used instead when the literals fit into it */
+extern bool teddy_simd(void);
+extern void teddy_compile(vfrex_t vfrex);
+extern bool teddy_match(const uchar *text, size_t len, vfrex_t vfrex);
+/* Tell if the size bytes at t are a teddy_t that is safe to match with */
+extern bool teddy_valid(const teddy_t *t, size_t size);
+extern void teddy_free(vfrex_t vfrex);
+
+#endif /* end of include guard: __TEDDY_H */
@@ -1,2 +1,2 @@
-gcc -std=gnu99 -DDEBUG -Wall -Wextra -Wconversion -Wno-sign-conversion -g -c common.c dfa.c parser.c substring.c
-gcc -std=gnu99 -DDEBUG -DDEBUG_MAIN -Wall -Wextra -Wconversion -Wno-sign-conversion -g vfrex.c common.o dfa.o parser.o substring.o
+gcc -std=gnu99 -DDEBUG -Wall -Wextra -Wconversion -Wno-sign-conversion -g -c common.c dfa.c nfa.c onepass.c prefilter.c aho.c teddy.c glushkov.c parser.c substring.c serialize.c
+gcc -std=gnu99 -DDEBUG -DDEBUG_MAIN -Wall -Wextra -Wconversion -Wno-sign-conversion -g vfrex.c common.o dfa.o nfa.o onepass.o prefilter.o aho.o teddy.o glushkov.o parser.o substring.o serialize.o
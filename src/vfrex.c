@@ -26,10 +26,14 @@
 #include "parser.h"
 #include "substring.h"
 #include "dfa.h"
+#include "nfa.h"
+#include "onepass.h"
+#include "aho.h"
+#include "teddy.h"
+#include "glushkov.h"
 #include "vfrex.h"
 #include <stdlib.h>
 
-jmp_buf env;
 void *(*mmalloc)(size_t)          = malloc;
 void  (*mfree)(void *)            = free;
 void *(*mrealloc)(void *, size_t) = realloc;
@@ -54,6 +58,9 @@ vfrex_option_t default_option()
         REGEX_STYLE_POSIX,
         REGEX_MATCH_PARTIAL_BOOL,
         0,
+        VFREX_DEFAULT_CACHE_SIZE,
+        0,
+        0,
     };
 }
 
@@ -92,34 +99,92 @@ int vfrex_compile(vfrex_t *vfrex, const char *_regex, vfrex_option_t option)
     size_t       len   = strlen(_regex);
     const uchar *regex = (const uchar *)_regex;
 
+    if (!option.cache_size)
+        option.cache_size = VFREX_DEFAULT_CACHE_SIZE;
+
     (*vfrex)->regex     = mmalloc((len+1) * sizeof(uchar));
     (*vfrex)->regex_len = len;
     (*vfrex)->option    = option;
     (*vfrex)->status    = VFREX_SUCCESS;
     strcpy((char *)(*vfrex)->regex, (const char *)regex);
 
-    if (!setjmp(env)) {
+    if (!setjmp((*vfrex)->env)) {
         parser_parse(*vfrex);
 
         switch ((*vfrex)->algorithm) {
         case REGEX_SHIFT_OR_32:
-            shift_or_compile_32(*vfrex);
-            break;
-
         case REGEX_SHIFT_OR_64:
-            shift_or_compile_64(*vfrex);
+        case REGEX_SHIFT_OR_128:
+        case REGEX_SHIFT_OR_256:
+            (*vfrex)->algorithm = shift_or_prefilter(*vfrex);
+            if ((*vfrex)->algorithm == REGEX_DFA)
+                DFA_compile(*vfrex);
+            else if ((*vfrex)->algorithm == REGEX_BNDM)
+                bndm_compile(*vfrex);
+            else if ((*vfrex)->algorithm == REGEX_SHIFT_OR_32)
+                shift_or_compile_32(*vfrex);
+            else if ((*vfrex)->algorithm == REGEX_SHIFT_OR_64)
+                shift_or_compile_64(*vfrex);
+            else if ((*vfrex)->algorithm == REGEX_SHIFT_OR_128)
+                shift_or_compile_128(*vfrex);
+            else
+                shift_or_compile_256(*vfrex);
             break;
 
         case REGEX_BOYER_MOORE:
             boyer_moore_compile(*vfrex);
             break;
 
+        case REGEX_BNDM:
+            bndm_compile(*vfrex);
+            break;
+
+        case REGEX_APPROXIMATE:
+            approximate_compile(*vfrex);
+            break;
+
+        case REGEX_TWO_WAY:
+            two_way_compile(*vfrex);
+            break;
+
+        case REGEX_TEDDY:
+            teddy_compile(*vfrex);
+            break;
+
+        case REGEX_SHIFT_OR_MULTI:
+            shift_or_compile_multi(*vfrex);
+            break;
+
+        case REGEX_AHO_CORASICK:
+            if (aho_compile(*vfrex))
+                break;
+            /* too many states for the table */
+            (*vfrex)->algorithm = REGEX_DFA;
+            /* fall through */
+
         case REGEX_DFA:
             DFA_compile(*vfrex);
             break;
 
+        case REGEX_GLUSHKOV:
+            if (!glushkov_compile(*vfrex))
+                (*vfrex)->algorithm = REGEX_DFA;
+            /* the DFA finds the boundaries of the match */
+            if ((*vfrex)->algorithm == REGEX_DFA ||
+                option.match == REGEX_MATCH_PARTIAL_BOUNDARY)
+                DFA_compile(*vfrex);
+            break;
+
+        case REGEX_ONE_PASS:
+            if (onepass_compile(*vfrex))
+                break;
+            /* more than one way to go on, only the NFA can tell the groups */
+            (*vfrex)->algorithm = REGEX_NFA;
+            /* fall through */
+
         case REGEX_NFA:
-            assert(0);
+            NFA_compile(*vfrex);
+            break;
         }
     }
 
@@ -129,46 +194,101 @@ int vfrex_compile(vfrex_t *vfrex, const char *_regex, vfrex_option_t option)
     return ret;
 }
 
-/* Using the object we compiled to do full matching */
-int vfrex_object_match(vfrex_t vfrex, const char *_text)
+int vfrex_context(vfrex_t *context, vfrex_t vfrex)
 {
+    *context = NULL;
     if (!vfrex)
         return VFREX_INVALID_COMPLIATION;
 
-    cleanup(vfrex->group_left);
-    cleanup(vfrex->group_right);
+    vfrex_t c = *context = mmalloc(sizeof(struct vfrex_t));
+    *c = *vfrex;
+    c->context      = true;
+    c->group_number = 0;
+    c->group_left   = NULL;
+    c->group_right  = NULL;
+    c->group_size   = 0;
+    c->find_next    = NULL;
+    c->status       = VFREX_SUCCESS;
+    DFA_context(c);
+    NFA_context(c);
+    onepass_context(c);
+    return VFREX_SUCCESS;
+}
+
+/* Match the tlen bytes of text, the groups of the last match are reused */
+static int match_text(vfrex_t vfrex, const uchar *text, size_t tlen)
+{
     vfrex->group_number = 0;
     vfrex->status = VFREX_SUCCESS;
 
-    size_t tlen = strlen(_text);
-    const uchar *text = (const uchar *)_text;
-    
-    bool found;
+    bool found = false;
 
-    if (!setjmp(env)) {
-        parser_parse(vfrex);
+    switch (vfrex->algorithm) {
+    case REGEX_SHIFT_OR_32:
+        found = shift_or_match_32(text, tlen, vfrex);
+        break;
 
-        switch (vfrex->algorithm) {
-        case REGEX_SHIFT_OR_32:
-            found = shift_or_match_32(text, tlen, vfrex);
-            break;
+    case REGEX_SHIFT_OR_64:
+        found = shift_or_match_64(text, tlen, vfrex);
+        break;
 
-        case REGEX_SHIFT_OR_64:
-            found = shift_or_match_64(text, tlen, vfrex);
-            break;
+    case REGEX_SHIFT_OR_128:
+        found = shift_or_match_128(text, tlen, vfrex);
+        break;
 
-        case REGEX_BOYER_MOORE:
-            found = boyer_moore_match(text, tlen, vfrex);
-            break;
+    case REGEX_SHIFT_OR_256:
+        found = shift_or_match_256(text, tlen, vfrex);
+        break;
 
-        case REGEX_DFA:
+    case REGEX_BOYER_MOORE:
+        found = boyer_moore_match(text, tlen, vfrex);
+        break;
+
+    case REGEX_BNDM:
+        found = bndm_match(text, tlen, vfrex);
+        break;
+
+    case REGEX_APPROXIMATE:
+        found = approximate_match(text, tlen, vfrex);
+        break;
+
+    case REGEX_TWO_WAY:
+        found = two_way_match(text, tlen, vfrex);
+        break;
+
+    case REGEX_AHO_CORASICK:
+        found = aho_match(text, tlen, vfrex);
+        break;
+
+    case REGEX_TEDDY:
+        found = teddy_match(text, tlen, vfrex);
+        break;
+
+    case REGEX_SHIFT_OR_MULTI:
+        found = shift_or_match_multi(text, tlen, vfrex);
+        break;
+
+    case REGEX_DFA:
+    case REGEX_ONE_PASS:
+    case REGEX_GLUSHKOV:
+        if (vfrex->algorithm == REGEX_DFA)
             found = DFA_match(text, tlen, vfrex);
+        else if (vfrex->algorithm == REGEX_ONE_PASS)
+            found = onepass_match(text, tlen, vfrex);
+        else
+            found = glushkov_match(text, tlen, vfrex);
+        if (!DFA_give_up(vfrex))
             break;
+        /* The DFA cache is thrashing, the regex is too wide for it.
+         * Use the NFA simulation from now on, whose memory is fixed. */
+        if (!vfrex->pike)
+            NFA_compile(vfrex);
+        vfrex->algorithm = REGEX_NFA;
+        /* fall through */
 
-        case REGEX_NFA:
-            assert(0);
-            break;
-        }
+    case REGEX_NFA:
+        found = NFA_match(text, tlen, vfrex);
+        break;
     }
 
     if (vfrex->status != VFREX_SUCCESS)
@@ -180,6 +300,460 @@ int vfrex_object_match(vfrex_t vfrex, const char *_text)
         return VFREX_NOT_FOUND;
 }
 
+/* Using the object we compiled to do full matching */
+int vfrex_object_match(vfrex_t vfrex, const char *_text)
+{
+    if (!vfrex)
+        return VFREX_INVALID_COMPLIATION;
+    return match_text(vfrex, (const uchar *)_text, strlen(_text));
+}
+
+int vfrex_match_n(vfrex_t vfrex, const void *text, size_t len)
+{
+    if (!vfrex)
+        return VFREX_INVALID_COMPLIATION;
+    return match_text(vfrex, text, len);
+}
+
+int vfrex_find_iter(vfrex_t vfrex, const char *_text)
+{
+    return vfrex_find_iter_n(vfrex, _text, _text ? strlen(_text) : 0);
+}
+
+int vfrex_find_iter_n(vfrex_t vfrex, const void *text, size_t len)
+{
+    if (!vfrex)
+        return VFREX_INVALID_COMPLIATION;
+    vfrex->find_next = NULL;
+    if (vfrex->option.match != REGEX_MATCH_PARTIAL_BOUNDARY &&
+        vfrex->option.match != REGEX_MATCH_PARTIAL_SUBMATCH)
+        return VFREX_INVALID_SCAN;
+    vfrex->find_next = text;
+    vfrex->find_end  = vfrex->find_next + len;
+    return VFREX_SUCCESS;
+}
+
+int vfrex_find_next(vfrex_t vfrex)
+{
+    if (!vfrex)
+        return VFREX_INVALID_COMPLIATION;
+    if (!vfrex->find_next) {
+        vfrex->group_number = 0;
+        return VFREX_NOT_FOUND;
+    }
+
+    const uchar *text = vfrex->find_next;
+    int ret = match_text(vfrex, text, (size_t)(vfrex->find_end - text));
+    if (ret != VFREX_SUCCESS) {
+        vfrex->find_next = NULL;
+        return ret;
+    }
+    /* the next match starts after this one, or a byte later after an empty
+     * one, so that it is not found again */
+    const uchar *right = *vfrex->group_right;
+    if (right == *vfrex->group_left)
+        vfrex->find_next = right < vfrex->find_end ? right + 1 : NULL;
+    else
+        vfrex->find_next = right;
+    return VFREX_SUCCESS;
+}
+
+int vfrex_scan(vfrex_t vfrex, const char *text, vfrex_callback_t callback,
+               void *data)
+{
+    int ret = vfrex_find_iter(vfrex, text);
+    if (ret != VFREX_SUCCESS)
+        return ret;
+    bool found = false;
+    while ((ret = vfrex_find_next(vfrex)) == VFREX_SUCCESS) {
+        found = true;
+        if (callback((const char *)*vfrex->group_left,
+                     (const char *)*vfrex->group_right, data))
+            break;
+    }
+    vfrex->find_next = NULL;
+    if (ret != VFREX_SUCCESS && ret != VFREX_NOT_FOUND)
+        return ret;
+    return found ? VFREX_SUCCESS : VFREX_NOT_FOUND;
+}
+
+/* Report the match [left, right), after which the search goes on from
+ * right, or a byte later after an empty match so that it is not found
+ * again */
+static void stream_report(vfrex_stream_t stream, size_t left, size_t right)
+{
+    stream->next = right == left ? right + 1 : right;
+    stream->stop = stream->callback(left, right, stream->data) != 0;
+}
+
+/* Report the matches from stream->next on in the len bytes of text, which
+ * are at the offset at of the stream.  Unless the stream ends with them, a
+ * match is held back if it may still change with the bytes after them, and
+ * stream->next is left at the first byte that a later match may start at
+ * or need */
+static int stream_search(vfrex_stream_t stream, const uchar *text, size_t at,
+                         size_t len, bool last)
+{
+    vfrex_t vfrex = stream->vfrex;
+    size_t  end   = at + len;
+    while (!stream->stop && stream->next <= end) {
+        size_t from = stream->next;
+        assert(from >= at);
+        int ret = match_text(vfrex, text + (from - at), end - from);
+        if (ret == VFREX_NOT_FOUND) {
+            /* a match ending after end starts after end - length */
+            stream->next = last ? end + 1
+                                : max(from, end + 1 - min(end + 1,
+                                                          stream->length));
+            return VFREX_SUCCESS;
+        }
+        if (ret != VFREX_SUCCESS)
+            return ret;
+
+        size_t left  = at + (size_t)(*vfrex->group_left  - text);
+        size_t right = at + (size_t)(*vfrex->group_right - text);
+        if (!last && end - right < stream->reach) {
+            /* no match starting before left - length ends with or before
+             * this one, so the search may well start there */
+            stream->next = max(from, left - min(left, stream->length));
+            return VFREX_SUCCESS;
+        }
+        stream_report(stream, left, right);
+    }
+    return VFREX_SUCCESS;
+}
+
+/* The forward FSM starts over at stream->pos */
+static void stream_enter(vfrex_stream_t stream)
+{
+    stream->s       = DFA_stream_start(stream->vfrex);
+    stream->matched = stream->s & DFA_MATCH;
+    stream->right   = stream->pos;
+}
+
+/* The engine starts over at stream->next */
+static void stream_restart(vfrex_stream_t stream)
+{
+    stream->pos    = stream->next;
+    stream->start  = stream->next;
+    stream->decide = false;
+    memset(stream->d, 0xFF, sizeof(stream->d));
+    if (stream->kind == STREAM_GLUSHKOV)
+        stream->d[0] = 0;
+    if (stream->kind == STREAM_DFA)
+        stream_enter(stream);
+}
+
+int vfrex_stream_open(vfrex_stream_t *stream, vfrex_t vfrex,
+                      int (*callback)(size_t left, size_t right, void *data),
+                      void *data)
+{
+    *stream = NULL;
+    if (!vfrex)
+        return VFREX_INVALID_COMPLIATION;
+    if (vfrex->option.match != REGEX_MATCH_PARTIAL_BOUNDARY &&
+        vfrex->option.match != REGEX_MATCH_PARTIAL_SUBMATCH)
+        return VFREX_INVALID_SCAN;
+
+    stream_kind_t kind = STREAM_WINDOW;
+    switch (vfrex->algorithm) {
+    case REGEX_SHIFT_OR_32:
+    case REGEX_SHIFT_OR_64:
+    case REGEX_SHIFT_OR_128:
+    case REGEX_SHIFT_OR_256:
+        if (vfrex->shift_or_len)
+            kind = STREAM_SHIFT_OR;
+        break;
+
+    case REGEX_GLUSHKOV:
+        /* an empty match is everywhere, and only the FSM tells which */
+        kind = vfrex->glushkov->nullable ? STREAM_DFA : STREAM_GLUSHKOV;
+        break;
+
+    default:
+        /* the DFA of a vfrex that went on with the NFA is still there */
+        if (vfrex->FSM[0] && vfrex->FSM[1])
+            kind = STREAM_DFA;
+        break;
+    }
+
+    /* an approximate match spans the edits more, and looks as far on for
+     * fewer of them */
+    size_t k = (size_t)vfrex->option.max_error;
+    if (kind == STREAM_WINDOW && vfrex->max_length > SIZE_MAX / 8 - 2 * k)
+        return VFREX_INVALID_STREAM;
+    FSM_t *suffix = NULL;
+    if (kind == STREAM_DFA && vfrex->max_length == SIZE_MAX &&
+        !(suffix = DFA_stream_suffix(vfrex)))
+        return VFREX_INVALID_STREAM;
+
+    vfrex_stream_t s = *stream = mcalloc(1, sizeof(struct vfrex_stream_t));
+    vfrex_context(&s->vfrex, vfrex);
+    s->callback = callback;
+    s->data     = data;
+    s->kind     = kind;
+    s->suffix   = suffix;
+    if (kind != STREAM_WINDOW) {
+        DFA_stream_open(s->vfrex);
+        stream_restart(s);
+        return VFREX_SUCCESS;
+    }
+
+    s->length = vfrex->max_length + k;
+    s->reach  = s->length + k;
+    /* a match starting in the kept bytes ends in the first length bytes of
+     * the chunk, and is decided reach bytes later.  One held there starts
+     * more than length bytes into the chunk, so the search goes on in
+     * place from it */
+    s->seam   = 2 * s->length + s->reach;
+    s->buf    = mmalloc(2 * s->seam + 1);
+    return VFREX_SUCCESS;
+}
+
+static void stream_append(vfrex_stream_t stream, const uchar *bytes,
+                          size_t n)
+{
+    if (stream->len + n > stream->size) {
+        stream->size = max(2 * stream->size, stream->len + n);
+        stream->buf  = mrealloc(stream->buf, stream->size);
+    }
+    memcpy(stream->buf + stream->len, bytes, n);
+    stream->len += n;
+}
+
+/* The bytes of the stream in [lo, hi), which are in the chunk from at on
+ * and in buf before.  If some of them are before at, buf gets the bytes of
+ * the chunk up to hi, so that they are all in one piece */
+static const uchar *stream_bytes(vfrex_stream_t stream, const uchar *chunk,
+                                 size_t at, size_t lo, size_t hi)
+{
+    if (lo >= at)
+        return chunk + (lo - at);
+    assert(lo >= stream->base);
+    size_t have = stream->base + stream->len;
+    assert(have >= at);
+    if (hi > have)
+        stream_append(stream, chunk + (have - at), hi - have);
+    return stream->buf + (lo - stream->base);
+}
+
+/* The forward FSM died after the match ending at stream->right: its left
+ * end is found backward from there in the bytes kept, and the search goes
+ * on after it */
+static void stream_resolve(vfrex_stream_t stream, const uchar *chunk,
+                           size_t at)
+{
+    assert(stream->matched);
+    size_t lo    = max(stream->start, stream->base);
+    size_t right = stream->right;
+    size_t left  = right;
+    /* an empty match may be past the bytes kept, where there are none */
+    if (right > lo) {
+        const uchar *text = stream_bytes(stream, chunk, at, lo, right);
+        const uchar *l    = DFA_stream_left(text, text + (right - lo),
+                                            stream->vfrex);
+        assert(l);
+        left = lo + (size_t)(l - text);
+    }
+    stream_report(stream, left, right);
+    stream_restart(stream);
+}
+
+/* Go on with the engine from stream->pos to end, over the bytes before at
+ * in buf and the rest in the chunk */
+static void stream_carry(vfrex_stream_t stream, const uchar *chunk,
+                         size_t at, size_t end)
+{
+    vfrex_t vfrex = stream->vfrex;
+    while (!stream->stop && stream->pos < end) {
+        bool         kept = stream->pos < at;
+        size_t       from = kept ? stream->base : at;
+        size_t       to   = kept ? at : end;
+        const uchar *text = kept ? stream->buf : chunk;
+        const uchar *p    = text + (stream->pos - from);
+        const uchar *q    = text + (to - from);
+
+        if (stream->kind == STREAM_SHIFT_OR) {
+            const uchar *r = shift_or_stream(p, q, stream->d, vfrex);
+            if (!r) {
+                stream->pos = to;
+                continue;
+            }
+            size_t right = from + (size_t)(r - text);
+            stream_report(stream, right - vfrex->shift_or_len, right);
+            stream_restart(stream);
+            continue;
+        }
+
+        if (stream->kind == STREAM_GLUSHKOV && !stream->decide) {
+            const uchar *empty = NULL;
+            const uchar *r     = glushkov_stream(p, q, stream->d, &empty,
+                                                 vfrex);
+            if (empty)
+                stream->start = from + (size_t)(empty - text);
+            if (!r) {
+                stream->pos = to;
+                continue;
+            }
+            /* the FSM finds the boundaries from where the match may start */
+            stream->decide = true;
+            stream->pos    = stream->start;
+            stream_enter(stream);
+            continue;
+        }
+
+        if (!(stream->s & DFA_DEAD)) {
+            const uchar *r = NULL;
+            const uchar *c = DFA_stream_forward(p, q, &stream->s, &r, vfrex);
+            if (r) {
+                stream->matched = true;
+                stream->right   = from + (size_t)(r - text);
+            }
+            stream->pos = from + (size_t)(c - text);
+            if (!(stream->s & DFA_DEAD))
+                continue;
+        }
+        stream_resolve(stream, chunk, at);
+    }
+}
+
+/* The first byte a match not reported yet may need, now that the engine
+ * went through the bytes up to end, the ones from at on being in the
+ * chunk */
+static size_t stream_need(vfrex_stream_t stream, const uchar *chunk,
+                          size_t at, size_t end)
+{
+    vfrex_t vfrex = stream->vfrex;
+    size_t  lo    = max(stream->start, stream->base);
+    if (stream->kind == STREAM_SHIFT_OR || lo >= end)
+        return end;
+    if (stream->kind == STREAM_GLUSHKOV && !stream->decide)
+        return stream->start;
+    /* the match may span whatever comes next */
+    if (stream->matched || stream->decide)
+        return lo;
+    /* a match ending after end starts after end - max_length */
+    if (vfrex->max_length != SIZE_MAX)
+        return max(lo, end - min(end, vfrex->max_length));
+
+    /* where a prefix of a match starts, in the chunk first */
+    bool         more;
+    size_t       from = max(lo, at);
+    const uchar *text = chunk + (from - at);
+    const uchar *keep = DFA_stream_keep(text, chunk + (end - at), &more,
+                                        stream->suffix);
+    if (!more || from == lo)
+        return more ? lo : from + (size_t)(keep - text);
+    /* and before it only once the bytes kept doubled, so that the same
+     * ones are not gone through for each chunk */
+    if (end - lo <= 2 * stream->kept)
+        return lo;
+    text = stream_bytes(stream, chunk, at, lo, end);
+    keep = DFA_stream_keep(text, text + (end - lo), &more, stream->suffix);
+    stream->kept = end - lo - (more ? 0 : (size_t)(keep - text));
+    return end - stream->kept;
+}
+
+/* Keep the bytes from the first one a match not reported yet may need on,
+ * after the chunk from at to end is gone through */
+static void stream_keep(vfrex_stream_t stream, const uchar *chunk,
+                        size_t at, size_t end)
+{
+    size_t keep = min(stream_need(stream, chunk, at, end), end);
+    if (keep >= at) {
+        stream->base = keep;
+        stream->len  = 0;
+        stream_append(stream, chunk + (keep - at), end - keep);
+        return;
+    }
+    stream_bytes(stream, chunk, at, keep, end);
+    stream->len = end - keep;
+    memmove(stream->buf, stream->buf + (keep - stream->base), stream->len);
+    stream->base = keep;
+}
+
+int vfrex_stream_feed(vfrex_stream_t stream, const void *_chunk, size_t len)
+{
+    if (!stream)
+        return VFREX_INVALID_COMPLIATION;
+    if (stream->stop || len == 0)
+        return VFREX_SUCCESS;
+
+    const uchar *chunk = _chunk;
+    size_t       at    = stream->fed;
+    size_t       n     = min(len, stream->seam);
+    int          ret   = VFREX_SUCCESS;
+    stream->fed += len;
+
+    if (stream->kind != STREAM_WINDOW) {
+        stream_carry(stream, chunk, at, stream->fed);
+        if (!stream->stop)
+            stream_keep(stream, chunk, at, stream->fed);
+        return VFREX_SUCCESS;
+    }
+
+    /* the matches starting in the kept bytes are searched for in them and
+     * the seam, and then the chunk in place */
+    if (stream->len) {
+        memcpy(stream->buf + stream->len, chunk, n);
+        ret = stream_search(stream, stream->buf, at - stream->len,
+                            stream->len + n, false);
+        if (ret == VFREX_SUCCESS && n == len) {
+            size_t base = at - stream->len;
+            stream->len = stream->next < stream->fed ?
+                          stream->fed - stream->next : 0;
+            memmove(stream->buf, stream->buf + (stream->fed - base -
+                                                stream->len), stream->len);
+            return VFREX_SUCCESS;
+        }
+    }
+    if (ret == VFREX_SUCCESS)
+        ret = stream_search(stream, chunk, at, len, false);
+    if (ret != VFREX_SUCCESS) {
+        stream->stop = true;
+        return ret;
+    }
+    if (stream->stop)
+        return VFREX_SUCCESS;
+    stream->len = stream->next < stream->fed ? stream->fed - stream->next : 0;
+    memcpy(stream->buf, chunk + len - stream->len, stream->len);
+    return VFREX_SUCCESS;
+}
+
+/* At the end of the stream, a match the FSM went through is decided, and
+ * the search goes on after it in the bytes kept */
+static void stream_finish(vfrex_stream_t stream)
+{
+    const uchar *end = stream->buf + stream->len;
+    /* the search went on past the end after an empty match there */
+    while (!stream->stop && stream->pos <= stream->fed) {
+        stream_carry(stream, end, stream->fed, stream->fed);
+        if (stream->stop || stream->kind == STREAM_SHIFT_OR ||
+            (stream->kind == STREAM_GLUSHKOV && !stream->decide) ||
+            !stream->matched)
+            return;
+        stream_resolve(stream, end, stream->fed);
+        end = stream->buf + stream->len;
+    }
+}
+
+int vfrex_stream_close(vfrex_stream_t *stream)
+{
+    if (!*stream)
+        return VFREX_INVALID_COMPLIATION;
+    vfrex_stream_t s   = *stream;
+    int            ret = VFREX_SUCCESS;
+    if (s->kind != STREAM_WINDOW)
+        stream_finish(s);
+    else if (!s->stop && s->next <= s->fed)
+        ret = stream_search(s, s->buf, s->fed - s->len, s->len, true);
+    DFA_stream_free(&s->suffix);
+    vfrex_free(&s->vfrex);
+    cleanup(s->buf);
+    cleanup(*stream);
+    return ret;
+}
+
 int vfrex_scanf(vfrex_t vfrex, char *pat, ...)
 {
     UNUSED(vfrex);
@@ -205,29 +779,189 @@ int vfrex_group(size_t idx, const char **left, const char **right, vfrex_t vfrex
     return VFREX_SUCCESS;
 }
 
+int vfrex_literal(size_t *idx, vfrex_t vfrex)
+{
+    if (vfrex->status != VFREX_SUCCESS)
+        return vfrex->status;
+    if ((vfrex->algorithm != REGEX_AHO_CORASICK &&
+         vfrex->algorithm != REGEX_TEDDY &&
+         vfrex->algorithm != REGEX_SHIFT_OR_MULTI) ||
+        vfrex->literal == AHO_NONE)
+        return VFREX_NOT_FOUND;
+    *idx = vfrex->literal;
+    return VFREX_SUCCESS;
+}
+
+int vfrex_edit_distance(size_t *edit, vfrex_t vfrex)
+{
+    if (vfrex->status != VFREX_SUCCESS)
+        return vfrex->status;
+    if (vfrex->algorithm != REGEX_APPROXIMATE || !vfrex->group_number)
+        return VFREX_NOT_FOUND;
+    *edit = vfrex->edit;
+    return VFREX_SUCCESS;
+}
+
+size_t vfrex_cache_reset_number(vfrex_t vfrex)
+{
+    size_t ret = 0;
+    for (size_t i = 0; i < 3; ++i)
+        if (vfrex->FSM[i])
+            ret += vfrex->FSM[i]->cache_reset;
+    return ret;
+}
+
+size_t vfrex_cache_leave_number(vfrex_t vfrex)
+{
+    size_t ret = 0;
+    for (size_t i = 0; i < 3; ++i)
+        if (vfrex->FSM[i])
+            ret += vfrex->FSM[i]->cache_leave;
+    return ret;
+}
+
 void vfrex_free(vfrex_t *vfrex)
 {
+    if ((*vfrex)->context) {
+        /* the rest belongs to the vfrex the context was made of */
+        DFA_context_free(*vfrex);
+        NFA_free(*vfrex);
+        onepass_free(*vfrex);
+        cleanup((*vfrex)->group_left);
+        cleanup((*vfrex)->group_right);
+        cleanup((*vfrex));
+        return;
+    }
     /* TODO */
+    if ((*vfrex)->blob) {
+        /* the regex and the tables belong to the blob */
+        (*vfrex)->regex                = NULL;
+        (*vfrex)->shift_or             = NULL;
+        (*vfrex)->BM_bad_char_table    = NULL;
+        (*vfrex)->BM_good_suffix_table = NULL;
+        (*vfrex)->BM_full_jump_table   = NULL;
+        for (size_t i = 0; i < 3; ++i)
+            if ((*vfrex)->FSM[i]) {
+                (*vfrex)->FSM[i]->trans = NULL;
+                (*vfrex)->FSM[i]->accel = NULL;
+            }
+        if ((*vfrex)->aho) {
+            (*vfrex)->aho->trans = NULL;
+            (*vfrex)->aho->state = NULL;
+        }
+        (*vfrex)->teddy    = NULL;
+        (*vfrex)->glushkov = NULL;
+    }
+    DFA_free(*vfrex);
+    NFA_free(*vfrex);
+    onepass_free(*vfrex);
+    aho_free(*vfrex);
+    teddy_free(*vfrex);
+    glushkov_free(*vfrex);
     cleanup((*vfrex)->shift_or);
     cleanup((*vfrex)->BM_bad_char_table);
     cleanup((*vfrex)->BM_good_suffix_table);
     cleanup((*vfrex)->BM_full_jump_table);
     cleanup((*vfrex)->group_left);
     cleanup((*vfrex)->group_right);
+    cleanup((*vfrex)->regex);
     cleanup((*vfrex));
 }
 
+int vfrex_set_compile(vfrex_set_t *set, const char **regexes, size_t n,
+                      vfrex_option_t option)
+{
+    *set = mcalloc(1, sizeof(struct vfrex_set_t));
+
+    if (option.match != REGEX_MATCH_FULL_BOOL)
+        option.match = REGEX_MATCH_PARTIAL_BOOL;
+    option.max_error = 0;
+    if (!option.cache_size)
+        option.cache_size = VFREX_DEFAULT_CACHE_SIZE;
+    (*set)->option  = option;
+    (*set)->pattern = mcalloc(n + 1, sizeof(vfrex_t));
+    (*set)->matched = mcalloc(n + 1, sizeof(bool));
+    (*set)->match   = mcalloc(n + 1, sizeof(size_t));
+
+    for (size_t i = 0; i < n; ++i) {
+        int ret = vfrex_compile(&(*set)->pattern[i], regexes[i], option);
+        (*set)->pattern_number = i + 1;
+        if (VFREX_SUCCESS != ret) {
+            vfrex_set_free(set);
+            return ret;
+        }
+    }
+    if (n)
+        DFA_set_compile(*set);
+    return VFREX_SUCCESS;
+}
+
+int vfrex_set_match(vfrex_set_t set, const char *_text)
+{
+    if (!set)
+        return VFREX_INVALID_COMPLIATION;
+
+    size_t       n    = set->pattern_number;
+    size_t       tlen = strlen(_text);
+    const uchar *text = (const uchar *)_text;
+
+    memset(set->matched, 0, n * sizeof(bool));
+    set->match_number = 0;
+    if (set->FSM) {
+        DFA_set_match(text, tlen, set);
+        /* The union is too wide for the DFA cache, which may well happen
+         * with thousands of patterns.  Match them one by one from now on */
+        if (set->FSM->give_up)
+            DFA_set_free(set);
+    }
+    if (!set->FSM) {
+        set->match_number = 0;
+        for (size_t i = 0; i < n; ++i) {
+            set->matched[i] = VFREX_SUCCESS ==
+                              vfrex_object_match(set->pattern[i], _text);
+            set->match_number += set->matched[i];
+        }
+    }
+
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i)
+        if (set->matched[i])
+            set->match[k++] = i;
+    assert(k == set->match_number);
+    return k ? VFREX_SUCCESS : VFREX_NOT_FOUND;
+}
+
+size_t vfrex_set_match_number(vfrex_set_t set)
+{
+    return set->match_number;
+}
+
+size_t vfrex_set_match_index(size_t idx, vfrex_set_t set)
+{
+    assert(idx < set->match_number);
+    return set->match[idx];
+}
+
+void vfrex_set_free(vfrex_set_t *set)
+{
+    DFA_set_free(*set);
+    for (size_t i = 0; i < (*set)->pattern_number; ++i)
+        if ((*set)->pattern[i])
+            vfrex_free(&(*set)->pattern[i]);
+    cleanup((*set)->pattern);
+    cleanup((*set)->matched);
+    cleanup((*set)->match);
+    cleanup(*set);
+}
+
 #ifdef DEBUG_MAIN
 
 void judge(const char *regex, const char *text,
            bool match, int st, int ed)
 {
     printf("\nTest case: %s <match> %s\n", regex, text);
-    vfrex_option_t option = {
-        REGEX_STYLE_POSIX,
-        REGEX_MATCH_PARTIAL_BOUNDARY,
-        0,
-    };
+    vfrex_option_t option = default_option();
+    option.match = REGEX_MATCH_PARTIAL_BOUNDARY;
     vfrex_t result = vfrex_match(text, regex, option);
     if (match == false)
         assert(NULL == result);
@@ -241,6 +975,359 @@ void judge(const char *regex, const char *text,
     }
 }
 
+void test_blob(const char *regex, const char *text, int st, int ed,
+               algorithm_t algorithm)
+{
+    printf("\nBlob case: %s <match> %s\n", regex, text);
+    vfrex_option_t option = default_option();
+    option.match = REGEX_MATCH_PARTIAL_BOUNDARY;
+
+    vfrex_t vfrex, loaded;
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, regex, option));
+    assert(vfrex->algorithm == algorithm);
+    size_t size = vfrex_serialize(vfrex, NULL, 0);
+    assert(size);
+    uint64_t *blob = mmalloc(size);
+    assert(size == vfrex_serialize(vfrex, blob, size));
+    vfrex_free(&vfrex);
+
+    assert(VFREX_INVALID_BLOB == vfrex_load(&loaded, blob, size - 8));
+    assert(VFREX_SUCCESS == vfrex_load(&loaded, blob, size));
+    assert(loaded->algorithm == algorithm);
+    if (st == 0) {
+        assert(VFREX_NOT_FOUND == vfrex_object_match(loaded, text));
+    } else {
+        const char *left, *right;
+        assert(VFREX_SUCCESS == vfrex_object_match(loaded, text));
+        assert(0 == vfrex_group(0, &left, &right, loaded));
+        assert(left  == text + st - 1);
+        assert(right == text + ed);
+    }
+    vfrex_free(&loaded);
+    mfree(blob);
+}
+
+/* The offset in the blob of vfrex of the first copy of data, which is how
+ * the header refers to a section */
+uint64_t blob_offset(vfrex_t vfrex, const void *data, size_t len)
+{
+    size_t size = vfrex_serialize(vfrex, NULL, 0);
+    uchar *blob = mmalloc(size);
+    assert(size == vfrex_serialize(vfrex, blob, size));
+    uint64_t at = 0;
+    while (at + len <= size && memcmp(blob + at, data, len))
+        ++at;
+    assert(at + len <= size);
+    mfree(blob);
+    return at;
+}
+
+/* The blob of vfrex must not load once the header field after the first
+ * copy of before is changed to bytes.  The tables are indexed by it, and a
+ * loaded vfrex matches without checking the index again */
+void test_corrupt(vfrex_t vfrex, const void *before, size_t len,
+                  const void *bytes, size_t n)
+{
+    size_t at = blob_offset(vfrex, before, len) + len;
+    size_t size = vfrex_serialize(vfrex, NULL, 0);
+    uchar *blob = mmalloc(size);
+    assert(size == vfrex_serialize(vfrex, blob, size));
+    assert(at + n <= size);
+    memcpy(blob + at, bytes, n);
+
+    vfrex_t loaded;
+    assert(VFREX_INVALID_BLOB == vfrex_load(&loaded, blob, size));
+    assert(!loaded);
+    mfree(blob);
+}
+
+/* group is a list of the [left, right) of each group, -1 if unmatched.  A
+ * number of 0 means there is no match */
+void test_group(const char *regex, vfrex_match_t match, const char *text,
+                algorithm_t algorithm, size_t number, const int *group)
+{
+    printf("\nGroup case: %s <match> %s\n", regex, text);
+    vfrex_option_t option = default_option();
+    option.match = match;
+
+    vfrex_t vfrex;
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, regex, option));
+    assert(vfrex->algorithm == algorithm);
+    if (number == 0) {
+        assert(VFREX_NOT_FOUND == vfrex_object_match(vfrex, text));
+    } else {
+        assert(VFREX_SUCCESS == vfrex_object_match(vfrex, text));
+        assert(number == vfrex_group_number(vfrex));
+        for (size_t i = 0; i < number; ++i) {
+            const char *left, *right;
+            assert(0 == vfrex_group(i, &left, &right, vfrex));
+            assert(left  ? left  - text == group[2*i]   : group[2*i]   < 0);
+            assert(right ? right - text == group[2*i+1] : group[2*i+1] < 0);
+        }
+    }
+    vfrex_free(&vfrex);
+}
+
+/* literal is the index of the alternative found at [st, ed), or -1 if
+ * there is no match */
+void test_literal(const char *regex, algorithm_t algorithm,
+                  vfrex_match_t match, bool ignore_case,
+                  const char *text, int literal, int st, int ed)
+{
+    printf("\nLiteral case: %s <match> %s\n", regex, text);
+    vfrex_option_t option = default_option();
+    option.match       = match;
+    option.ignore_case = ignore_case;
+
+    vfrex_t vfrex;
+    size_t  idx;
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, regex, option));
+    assert(vfrex->algorithm == algorithm);
+    for (int k = 0; k < 2; ++k) {
+        if (literal < 0) {
+            assert(VFREX_NOT_FOUND == vfrex_object_match(vfrex, text));
+            continue;
+        }
+        assert(VFREX_SUCCESS == vfrex_object_match(vfrex, text));
+        assert(VFREX_SUCCESS == vfrex_literal(&idx, vfrex));
+        assert(idx == (size_t)literal);
+        if (match == REGEX_MATCH_PARTIAL_BOUNDARY) {
+            const char *left, *right;
+            assert(0 == vfrex_group(0, &left, &right, vfrex));
+            assert(left  == text + st);
+            assert(right == text + ed);
+        }
+    }
+    vfrex_free(&vfrex);
+}
+
+/* st is -1 if there is no match.  The loaded blob must find the same match
+ * with the same edits */
+void test_approximate(const char *regex, int max_error, vfrex_match_t match,
+                      bool ignore_case, const char *text, int st, int ed,
+                      size_t edit)
+{
+    printf("\nApproximate case: %s <match> %s\n", regex, text);
+    vfrex_option_t option = default_option();
+    option.match       = match;
+    option.ignore_case = ignore_case;
+    option.max_error   = max_error;
+
+    vfrex_t vfrex, loaded;
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, regex, option));
+    assert(vfrex->algorithm == REGEX_APPROXIMATE);
+    size_t size = vfrex_serialize(vfrex, NULL, 0);
+    void  *blob = mmalloc(size);
+    assert(size == vfrex_serialize(vfrex, blob, size));
+    assert(VFREX_SUCCESS == vfrex_load(&loaded, blob, size));
+
+    vfrex_t engine[2] = { vfrex, loaded };
+    for (int k = 0; k < 2; ++k) {
+        size_t e;
+        if (st < 0) {
+            assert(VFREX_NOT_FOUND == vfrex_object_match(engine[k], text));
+            assert(VFREX_NOT_FOUND == vfrex_edit_distance(&e, engine[k]));
+            continue;
+        }
+        assert(VFREX_SUCCESS == vfrex_object_match(engine[k], text));
+        assert(VFREX_SUCCESS == vfrex_edit_distance(&e, engine[k]));
+        assert(e == edit);
+        if (match == REGEX_MATCH_PARTIAL_BOUNDARY) {
+            const char *left, *right;
+            assert(0 == vfrex_group(0, &left, &right, engine[k]));
+            assert(left  == text + st);
+            assert(right == text + ed);
+        }
+    }
+    vfrex_free(&loaded);
+    vfrex_free(&vfrex);
+    mfree(blob);
+}
+
+/* the matches a scan has seen, and after how many of them it stops */
+typedef struct scan_t {
+    const char *text;
+    const int  *span;
+    int         number;
+    int         stop;
+} scan_t;
+
+int scan_callback(const char *left, const char *right, void *data)
+{
+    scan_t *scan = data;
+    assert(left  == scan->text + scan->span[2*scan->number]);
+    assert(right == scan->text + scan->span[2*scan->number + 1]);
+    return ++scan->number == scan->stop;
+}
+
+/* span is a list of the [left, right) of each match, which the iteration
+ * and the scan must find in order */
+void test_scan(const char *regex, vfrex_match_t match, int max_error,
+               const char *text, algorithm_t algorithm, int number,
+               const int *span)
+{
+    printf("\nScan case: %s <match> %s\n", regex, text);
+    vfrex_option_t option = default_option();
+    option.match     = match;
+    option.max_error = max_error;
+
+    vfrex_t vfrex;
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, regex, option));
+    assert(vfrex->algorithm == algorithm);
+    assert(VFREX_SUCCESS == vfrex_find_iter(vfrex, text));
+    for (int i = 0; i < number; ++i) {
+        const char *left, *right;
+        assert(VFREX_SUCCESS == vfrex_find_next(vfrex));
+        assert(0 == vfrex_group(0, &left, &right, vfrex));
+        assert(left  == text + span[2*i]);
+        assert(right == text + span[2*i + 1]);
+    }
+    assert(VFREX_NOT_FOUND == vfrex_find_next(vfrex));
+    assert(VFREX_NOT_FOUND == vfrex_find_next(vfrex));
+
+    for (int stop = 0; stop <= number; ++stop) {
+        scan_t scan = { text, span, 0, stop };
+        assert((number ? VFREX_SUCCESS : VFREX_NOT_FOUND) ==
+               vfrex_scan(vfrex, text, scan_callback, &scan));
+        assert(scan.number == (stop ? stop : number));
+    }
+    vfrex_free(&vfrex);
+}
+
+/* The len bytes of text, which holds '\0', are copied where nothing
+ * follows them, so an engine reading past len or stopping at '\0' fails.
+ * left is -1 if there is no match */
+void test_match_n(const char *regex, const char *text, size_t len,
+                  algorithm_t algorithm, int left, int right)
+{
+    printf("\nBinary case: %s <match> %zu bytes\n", regex, len);
+    vfrex_option_t option = default_option();
+    option.match = REGEX_MATCH_PARTIAL_BOUNDARY;
+
+    vfrex_t vfrex;
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, regex, option));
+    assert(vfrex->algorithm == algorithm);
+    char *buf = mmalloc(len);
+    memcpy(buf, text, len);
+    if (left < 0)
+        assert(VFREX_NOT_FOUND == vfrex_match_n(vfrex, buf, len));
+    else {
+        const char *l, *r;
+        assert(VFREX_SUCCESS == vfrex_match_n(vfrex, buf, len));
+        assert(0 == vfrex_group(0, &l, &r, vfrex));
+                assert(l == buf + left && r == buf + right);
+    }
+    mfree(buf);
+    vfrex_free(&vfrex);
+}
+
+int stream_callback(size_t left, size_t right, void *data)
+{
+    scan_t *scan = data;
+    assert(left  == (size_t)scan->span[2*scan->number]);
+    assert(right == (size_t)scan->span[2*scan->number + 1]);
+    return ++scan->number == scan->stop;
+}
+
+/* The text fed in chunks of every size, from a vfrex and from its blob,
+ * must give the matches in span as offsets */
+void test_stream(const char *regex, int max_error, const char *text,
+                 int number, const int *span)
+{
+    printf("\nStream case: %s <match> %s\n", regex, text);
+    vfrex_option_t option = default_option();
+    option.match     = REGEX_MATCH_PARTIAL_BOUNDARY;
+    option.max_error = max_error;
+
+    vfrex_t vfrex, loaded;
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, regex, option));
+    size_t size = vfrex_serialize(vfrex, NULL, 0);
+    void  *blob = mmalloc(size);
+    assert(size == vfrex_serialize(vfrex, blob, size));
+    assert(VFREX_SUCCESS == vfrex_load(&loaded, blob, size));
+
+    size_t  len       = strlen(text);
+    vfrex_t engine[2] = { vfrex, loaded };
+    for (int k = 0; k < 2; ++k)
+        for (size_t chunk = 1; chunk <= len + 1; ++chunk) {
+            scan_t         scan = { text, span, 0, 0 };
+            vfrex_stream_t stream;
+            int            ret  = vfrex_stream_open(&stream, engine[k],
+                                                    stream_callback, &scan);
+            /* a blob has no regex to tell where a match may start */
+            if (k == 1 && ret == VFREX_INVALID_STREAM) {
+                assert(vfrex->max_length == SIZE_MAX);
+                break;
+            }
+            assert(VFREX_SUCCESS == ret);
+            for (size_t i = 0; i < len; i += chunk)
+                assert(VFREX_SUCCESS ==
+                       vfrex_stream_feed(stream, text + i,
+                                         min(chunk, len - i)));
+            assert(VFREX_SUCCESS == vfrex_stream_close(&stream));
+            assert(scan.number == number);
+        }
+    vfrex_free(&loaded);
+    vfrex_free(&vfrex);
+    mfree(blob);
+}
+
+/* st is -1 if there is no match.  The DFA asked for with full_DFA must
+ * agree with the position automaton */
+void test_glushkov(const char *regex, vfrex_match_t match, bool ignore_case,
+                   const char *text, int st, int ed)
+{
+    printf("\nGlushkov case: %s <match> %s\n", regex, text);
+    vfrex_option_t option = default_option();
+    option.match       = match;
+    option.ignore_case = ignore_case;
+
+    for (int k = 0; k < 2; ++k) {
+        vfrex_t vfrex;
+        option.full_DFA = k;
+        assert(VFREX_SUCCESS == vfrex_compile(&vfrex, regex, option));
+        assert(vfrex->algorithm == (k ? REGEX_DFA : REGEX_GLUSHKOV));
+        if (st < 0) {
+            assert(VFREX_NOT_FOUND == vfrex_object_match(vfrex, text));
+        } else {
+            assert(VFREX_SUCCESS == vfrex_object_match(vfrex, text));
+            if (match == REGEX_MATCH_PARTIAL_BOUNDARY) {
+                const char *left, *right;
+                assert(0 == vfrex_group(0, &left, &right, vfrex));
+                assert(left  == text + st);
+                assert(right == text + ed);
+            }
+        }
+        vfrex_free(&vfrex);
+    }
+}
+
+/* index lists the regexes matching text in increasing order */
+void test_set(const char **regexes, size_t n, vfrex_match_t match,
+              size_t cache_size, const char *text, size_t number,
+              const size_t *index)
+{
+    printf("\nSet case: %zu regexes <match> %s\n", n, text);
+    vfrex_option_t option = default_option();
+    option.match      = match;
+    option.cache_size = cache_size;
+
+    vfrex_set_t set;
+    assert(VFREX_SUCCESS == vfrex_set_compile(&set, regexes, n, option));
+    for (int k = 0; k < 2; ++k) {
+        if (number == 0) {
+            assert(VFREX_NOT_FOUND == vfrex_set_match(set, text));
+        } else {
+            assert(VFREX_SUCCESS == vfrex_set_match(set, text));
+            assert(!set->FSM == (cache_size == 1));
+        }
+        assert(number == vfrex_set_match_number(set));
+        for (size_t i = 0; i < number; ++i)
+            assert(index[i] == vfrex_set_match_index(i, set));
+    }
+    vfrex_set_free(&set);
+}
+
 int main(void)
 {
     judge("abc", "abc", true, 1, 3);
@@ -251,5 +1338,469 @@ int main(void)
     judge("world|hello", "hello world", true, 1, 5);
     judge("hel|hello", "hello", true, 1, 3);
     judge("hello|hel", "hello", true, 1, 5);
+
+    /* the DFA cache is too small for the regex, so the engine has to fall
+     * back to the NFA simulation */
+    vfrex_option_t option = default_option();
+    option.match      = REGEX_MATCH_PARTIAL_BOUNDARY;
+    option.cache_size = 512;
+    const char *text  = "xaabbaabbaabbbaaabaaaababbbbbbabaaababbbbbbbabababaabb"
+                        "aabbababaabbbaaabbbaabaaaaabbbaabbbabbbbabbabbbbbabba"
+                        "baabbbbbbaaabbabbbbc";
+    const char *left, *right;
+    vfrex_t vfrex;
+    assert(VFREX_SUCCESS ==
+           vfrex_compile(&vfrex, "(a|b)*a(a|b)(a|b)(a|b)(a|b)c", option));
+    assert(VFREX_SUCCESS == vfrex_object_match(vfrex, text));
+    assert(vfrex_cache_reset_number(vfrex) > DFA_MAX_RESET);
+    assert(vfrex->algorithm == REGEX_NFA);
+    assert(0 == vfrex_group(0, &left, &right, vfrex));
+    assert(left == text + 1 && right == text + strlen(text));
+    assert(VFREX_NOT_FOUND == vfrex_object_match(vfrex, "abbbbbc"));
+    vfrex_free(&vfrex);
+
+    /* a cache_size of 0, like that of an option zeroed or left out of an
+     * initializer, gets the default budget, and only VFREX_UNLIMITED_CACHE
+     * lifts it */
+    {
+        vfrex_option_t zero = default_option();
+        zero.match      = REGEX_MATCH_PARTIAL_BOUNDARY;
+        zero.cache_size = 0;
+        assert(VFREX_SUCCESS ==
+               vfrex_compile(&vfrex, "(a|b)*a(a|b)(a|b)c", zero));
+        assert(vfrex->option.cache_size == VFREX_DEFAULT_CACHE_SIZE);
+        assert(vfrex->FSM[0]->cache_limit == VFREX_DEFAULT_CACHE_SIZE);
+        vfrex_free(&vfrex);
+        zero.cache_size = VFREX_UNLIMITED_CACHE;
+        assert(VFREX_SUCCESS == vfrex_compile(&vfrex, "(a|b)*a(a|b)c", zero));
+        assert(VFREX_SUCCESS == vfrex_object_match(vfrex, "xbabc"));
+        assert(vfrex->FSM[0]->cache_reset == 0);
+        vfrex_free(&vfrex);
+    }
+
+    /* a context has groups of its own, and goes on in a cache of its own
+     * once the shared one is full: the one that gives up the DFA leaves the
+     * vfrex and the other contexts with theirs */
+    {
+        vfrex_t context[2];
+        assert(VFREX_SUCCESS ==
+               vfrex_compile(&vfrex, "(a|b)*a(a|b)(a|b)(a|b)(a|b)c", option));
+        assert(VFREX_SUCCESS == vfrex_context(&context[0], vfrex));
+        assert(VFREX_SUCCESS == vfrex_context(&context[1], vfrex));
+        assert(VFREX_SUCCESS == vfrex_object_match(context[0], text));
+        assert(vfrex_cache_leave_number(context[0]) > 0);
+        assert(context[0]->algorithm == REGEX_NFA);
+        assert(vfrex->algorithm == REGEX_DFA);
+        assert(VFREX_SUCCESS == vfrex_object_match(context[1], "xabbbbc"));
+        assert(context[1]->algorithm == REGEX_DFA);
+        assert(0 == vfrex_group(0, &left, &right, context[0]));
+        assert(left == text + 1 && right == text + strlen(text));
+        assert(0 == vfrex_group(0, &left, &right, context[1]));
+        assert(right - left == 6);
+        assert(VFREX_NOT_FOUND == vfrex_object_match(context[0], "abbbbbc"));
+        vfrex_free(&context[0]);
+        vfrex_free(&context[1]);
+        vfrex_free(&vfrex);
+
+        /* otherwise the vfrex and its contexts fill one cache, so a text
+         * one of them has matched makes no state for the others */
+        const char *warm = "xxabbabbabaabbbabbc";
+        option.cache_size = VFREX_DEFAULT_CACHE_SIZE;
+        assert(VFREX_SUCCESS ==
+               vfrex_compile(&vfrex, "(a|b)*a(a|b)(a|b)c", option));
+        assert(VFREX_SUCCESS == vfrex_context(&context[0], vfrex));
+        assert(VFREX_SUCCESS == vfrex_context(&context[1], vfrex));
+        assert(VFREX_SUCCESS == vfrex_object_match(context[0], warm));
+        size_t state_number = vfrex->FSM[0]->shared->state_number;
+        assert(state_number > 1);
+        assert(VFREX_SUCCESS == vfrex_object_match(context[1], warm));
+        assert(VFREX_SUCCESS == vfrex_object_match(vfrex, warm));
+        assert(state_number == vfrex->FSM[0]->shared->state_number);
+        assert(context[1]->FSM[0]->state_number == 0);
+        assert(vfrex_cache_leave_number(context[1]) == 0);
+        assert(0 == vfrex_group(0, &left, &right, context[1]));
+        assert(left == warm + 2 && right == warm + strlen(warm));
+        vfrex_free(&context[0]);
+        vfrex_free(&context[1]);
+        vfrex_free(&vfrex);
+
+        /* the groups of a one-pass vfrex, then a vfrex loaded from a blob */
+        const char *groups = "zxxabaycc!";
+        option = default_option();
+        option.match = REGEX_MATCH_PARTIAL_SUBMATCH;
+        assert(VFREX_SUCCESS == vfrex_compile(&vfrex, "x(a|b)*y(c*)", option));
+        assert(vfrex->algorithm == REGEX_ONE_PASS);
+        assert(VFREX_SUCCESS == vfrex_context(&context[0], vfrex));
+        assert(VFREX_SUCCESS == vfrex_object_match(context[0], groups));
+        assert(VFREX_NOT_FOUND == vfrex_object_match(vfrex, "xa"));
+        assert(0 == vfrex_group(2, &left, &right, context[0]));
+        assert(left == groups + 7 && right == groups + 9);
+        vfrex_free(&context[0]);
+        vfrex_free(&vfrex);
+
+        option.match = REGEX_MATCH_PARTIAL_BOUNDARY;
+        assert(VFREX_SUCCESS == vfrex_compile(&vfrex, "\\d+ms", option));
+        size_t size = vfrex_serialize(vfrex, NULL, 0);
+        uint64_t *blob = mmalloc(size);
+        assert(size == vfrex_serialize(vfrex, blob, size));
+        vfrex_free(&vfrex);
+        assert(VFREX_SUCCESS == vfrex_load(&vfrex, blob, size));
+        assert(VFREX_SUCCESS == vfrex_context(&context[0], vfrex));
+        assert(VFREX_SUCCESS ==
+               vfrex_object_match(context[0], "ms 12 ms 3ms"));
+        assert(0 == vfrex_group(0, &left, &right, context[0]));
+        assert(right - left == 3);
+        vfrex_free(&context[0]);
+        vfrex_free(&vfrex);
+        mfree(blob);
+    }
+
+    /* a loaded blob must match like the vfrex it was made from */
+    test_blob("hello", "ahealleoahhelolhello", 16, 20, REGEX_SHIFT_OR_32);
+    test_blob("the quick brown fox", "the quick brown the quick brown fox",
+              17, 35, REGEX_BNDM);
+    /* Two-Way does not read the run again for each window */
+    test_blob("hellohellohellohellohellohellohello!",
+              "hellohellohellohellohellohellohellohellohello!", 11, 46,
+              REGEX_TWO_WAY);
+    test_blob("================FAIL", "=================PASS=========FAIL "
+              "=========================FAIL", 45, 64, REGEX_TWO_WAY);
+    test_blob("(cabde)+|c.*", "ffffcabdfcabdekkkkkkkkk", 5, 23, REGEX_GLUSHKOV);
+    test_blob("(a|b)*a(a|b)(a|b)c", "xxabbabbabaabbbabbc", 3, 19, REGEX_DFA);
+    test_blob("x", "abc", 0, 0, REGEX_SHIFT_OR_32);
+    test_blob("(GET|PUT) /(a|b)*c", "GETGET /PUT /abac", 9, 17,
+              REGEX_GLUSHKOV);
+    test_blob("\\d+ms", "ms 12 ms 3ms", 10, 12, REGEX_DFA);
+    /* classes are bits of shift-or as well, unless the DFA can skip to the
+     * few bytes the first of them matches */
+    test_blob("id=\\d\\d\\d\\d", "id=12 id=2024", 7, 13, REGEX_SHIFT_OR_32);
+    test_blob("v.\\d.", "vx v1.2 v12z", 9, 12, REGEX_DFA);
+    /* and BNDM skips over the text when neither can */
+    test_blob("\\w\\w\\w\\d\\d\\d\\d\\d", "ab 12345 abc123456789", 10, 17,
+              REGEX_BNDM);
+    test_blob("\\x\\x\\x\\x\\x\\x\\x\\x-\\x\\x\\x\\x-\\x\\x\\x\\x-"
+              "\\x\\x\\x\\x-\\x\\x\\x\\x\\x\\x\\x\\x\\x\\x\\x\\x",
+              "id 0e8a-1 id 123e4567-e89b-12d3-a456-426614174000.", 14, 49,
+              REGEX_BNDM);
+    /* a string longer than 64 with classes is shift-or in SIMD registers,
+     * Two-Way takes a literal however long that is mostly a run, and
+     * Boyer-Moore any other */
+    {
+        char long_regex[301], long_text[312];
+        for (int len = 100; len <= 300; len += 100) {
+            for (int i = 0; i < len; ++i)
+                long_regex[i] = len < 300 && i % 8 == 5 ? '.' : 'a';
+            long_regex[len - 1] = 'b';
+            long_regex[len] = 0;
+            memset(long_text, 'a', len + 10);
+            long_text[len + 9] = 'b';
+            long_text[len + 10] = 0;
+            test_blob(long_regex, long_text, 11, len + 10,
+                      len == 100 ? REGEX_SHIFT_OR_128 :
+                      len == 200 ? REGEX_SHIFT_OR_256 : REGEX_TWO_WAY);
+        }
+        for (int i = 0; i < 100; ++i)
+            long_regex[i] = (char)('a' + i * 7 % 26 + (i & 1) * ('A' - 'a'));
+        long_regex[100] = 0;
+        memset(long_text, 'z', 10);
+        memcpy(long_text + 10, long_regex, 101);
+        test_blob(long_regex, long_text, 11, 110, REGEX_BOYER_MOORE);
+    }
+
+    option = default_option();
+    option.cache_size = 512;
+    assert(VFREX_SUCCESS ==
+           vfrex_compile(&vfrex, "(a|b)*a(a|b)(a|b)(a|b)(a|b)c", option));
+    assert(0 == vfrex_serialize(vfrex, NULL, 0));
+    vfrex_free(&vfrex);
+
+    uint64_t junk[64] = { 0 };
+    assert(VFREX_INVALID_BLOB == vfrex_load(&vfrex, junk, sizeof(junk)));
+    assert(!vfrex);
+
+    /* the start state and the classes of a byte must be in the table */
+    option = default_option();
+    option.match    = REGEX_MATCH_PARTIAL_BOUNDARY;
+    option.full_DFA = 1;
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, "(a|b)*abb", option));
+    assert(vfrex->algorithm == REGEX_DFA && vfrex->FSM[0]->complete);
+    {
+        const FSM_t *FSM      = vfrex->FSM[0];
+        uint32_t     shape[4] = { (uint32_t)FSM->stride,
+                                  (uint32_t)FSM->state_number,
+                                  FSM->start,
+                                  (uint32_t)FSM->class_number };
+        uint32_t     past     = shape[0] * shape[1];
+        uchar        head[16 + 'a'];
+        uchar        wrong    = 200;
+        memcpy(head, shape, 16);
+        memcpy(head + 16, FSM->byte_class, 'a');
+        test_corrupt(vfrex, shape, 8, &past, 4);
+        test_corrupt(vfrex, head, sizeof(head), &wrong, 1);
+    }
+    vfrex_free(&vfrex);
+
+    /* and the mask of shift-or has a bit to test */
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, "hello", default_option()));
+    assert(vfrex->algorithm == REGEX_SHIFT_OR_32);
+    {
+        uint64_t head[2] = { vfrex->max_length,
+                             blob_offset(vfrex, vfrex->shift_or,
+                                         256 * sizeof(uint32_t)) };
+        uint64_t none    = 0;
+        test_corrupt(vfrex, head, sizeof(head), &none, sizeof(none));
+    }
+    vfrex_free(&vfrex);
+
+    /* a match is no longer than its regex, or a stream of the blob would
+     * keep a window of any size */
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, "hello", option));
+    {
+        uint64_t head[2] = { vfrex->regex_len,
+                             blob_offset(vfrex, vfrex->regex,
+                                         vfrex->regex_len + 1) };
+        uint64_t huge    = (uint64_t)1 << 40;
+        test_corrupt(vfrex, head, sizeof(head), &huge, sizeof(huge));
+    }
+    vfrex_free(&vfrex);
+
+    /* the groups come from the one-pass DFA when the regex allows it, and
+     * from the NFA otherwise */
+    test_group("x(a|b)*y(c*)", REGEX_MATCH_PARTIAL_SUBMATCH, "zxxabaycc!",
+               REGEX_ONE_PASS, 3, (int []){ 2, 9, 5, 6, 7, 9 });
+    test_group("x(a|b)*y(c*)", REGEX_MATCH_PARTIAL_SUBMATCH, "xyz",
+               REGEX_ONE_PASS, 3, (int []){ 0, 2, -1, -1, 2, 2 });
+    test_group("((a)|b)+", REGEX_MATCH_FULL_SUBMATCH, "abba",
+               REGEX_ONE_PASS, 3, (int []){ 0, 4, 3, 4, 3, 4 });
+    test_group("((a)|b)+", REGEX_MATCH_FULL_SUBMATCH, "abbc",
+               REGEX_ONE_PASS, 0, NULL);
+    test_group("\\d+(a|b)ms", REGEX_MATCH_PARTIAL_SUBMATCH, "ams 12bms",
+               REGEX_ONE_PASS, 2, (int []){ 4, 9, 6, 7 });
+    test_group("(a*)(a*)", REGEX_MATCH_FULL_SUBMATCH, "aaa",
+               REGEX_NFA, 3, (int []){ 0, 3, 0, 3, 3, 3 });
+    test_group("(a|ab)(c|bcd)(d*)", REGEX_MATCH_PARTIAL_SUBMATCH, "xabcd",
+               REGEX_NFA, 4, (int []){ 1, 5, 1, 2, 2, 5, 5, 5 });
+
+    /* an alternation of literals goes to Teddy, or to the Aho-Corasick
+     * automaton if it has more than TEDDY_MAX_LITERAL of them.  Both find
+     * the leftmost match and the first word starting there */
+    char       words[2][1024];
+    algorithm_t engine[2] = { REGEX_TEDDY, REGEX_AHO_CORASICK };
+    strcpy(words[0], "red|orange|yellow|green|blue|indigo|violet|black|"
+                     "white|gray|pink|brown|cyan|magenta|teal|navy|"
+                     "olive|maroon|ink|bluegreen|gold");
+    strcpy(words[1], words[0]);
+    for (int i = 0; i < TEDDY_MAX_LITERAL; ++i)
+        sprintf(words[1] + strlen(words[1]), "|x%dz", i);
+    for (int k = 0; k < 2; ++k) {
+        const char *w = words[k];
+        algorithm_t e = engine[k];
+        test_literal(w, e, REGEX_MATCH_PARTIAL_BOUNDARY, false,
+                     "a dark bluegreen sea", 4, 7, 11);
+        test_literal(w, e, REGEX_MATCH_PARTIAL_BOUNDARY, false,
+                     "pinkish", 10, 0, 4);
+        test_literal(w, e, REGEX_MATCH_PARTIAL_BOUNDARY, false,
+                     "the goldfish", 20, 4, 8);
+        test_literal(w, e, REGEX_MATCH_PARTIAL_BOUNDARY, false,
+                     "nothing here", -1, 0, 0);
+        test_literal(w, e, REGEX_MATCH_PARTIAL_BOUNDARY, true,
+                     "Deep INDIGO", 5, 5, 11);
+        test_literal(w, e, REGEX_MATCH_PARTIAL_BOOL, false,
+                     "the tealish", 14, 0, 0);
+        test_literal(w, e, REGEX_MATCH_FULL_BOOL, false,
+                     "maroon", 17, 0, 0);
+        test_literal(w, e, REGEX_MATCH_FULL_BOOL, false,
+                     "maroons", -1, 0, 0);
+        test_literal(w, e, REGEX_MATCH_FULL_BOOL, true,
+                     "BlueGreen", 19, 0, 0);
+        test_blob(w, "the goldfish", 5, 8, e);
+    }
+    /* the classes of the automaton index its rows as well */
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, words[1], option));
+    assert(vfrex->algorithm == REGEX_AHO_CORASICK);
+    {
+        const aho_t *aho = vfrex->aho;
+        uchar        head[8 + 'r'];
+        uchar        wrong = (uchar)aho->class_number;
+        uint64_t     n     = aho->class_number;
+        assert(n < 256);
+        memcpy(head, &n, 8);
+        memcpy(head + 8, aho->byte_class, 'r');
+        test_corrupt(vfrex, head, sizeof(head), &wrong, 1);
+    }
+    vfrex_free(&vfrex);
+    /* without pshufb, the ones fitting into 64 bits go to the packed
+     * shift-or instead */
+    algorithm_t small = teddy_simd() ? REGEX_TEDDY : REGEX_SHIFT_OR_MULTI;
+    test_literal("ab|cd|ef|gh|ij|kl|mn|op|qr|st|uv|wx|yz|abcdefgh|"
+                 "bcde|cdefg|de", small, REGEX_MATCH_PARTIAL_BOUNDARY,
+                 false, "xxbcdefghxx", 14, 2, 6);
+    test_literal("hel|hello", small, REGEX_MATCH_PARTIAL_BOUNDARY,
+                 false, "say hello", 0, 4, 7);
+    /* the candidates past the first 32 bytes come from the SIMD loop */
+    test_literal("error|warn|fatal|panic", small,
+                 REGEX_MATCH_PARTIAL_BOUNDARY, true,
+                 "all is well, all is fine, all is done, err... WARNING",
+                 1, 46, 50);
+    test_literal("a|b", small, REGEX_MATCH_PARTIAL_BOOL, false,
+                 "cccccccccccccccccccccccccccccccccccccccccccc", -1, 0, 0);
+    test_blob("GET|PUT|POST", "a POSTGET", 3, 6, small);
+
+    /* a small regex with operators is run on the bit set of its positions,
+     * which leaves the boundaries to the DFA */
+    test_glushkov("x(yz)*w", REGEX_MATCH_PARTIAL_BOOL, false,
+                  "xyzyw xyzyzw", 0, 0);
+    test_glushkov("x(yz)*w", REGEX_MATCH_PARTIAL_BOOL, false,
+                  "xyzyw xyzy", -1, 0);
+    test_glushkov("(ab|cd)+e?", REGEX_MATCH_FULL_BOOL, false,
+                  "abcdabe", 0, 0);
+    test_glushkov("(ab|cd)+e?", REGEX_MATCH_FULL_BOOL, false,
+                  "abcdae", -1, 0);
+    test_glushkov("(a|b)*", REGEX_MATCH_FULL_BOOL, false, "", 0, 0);
+    test_glushkov("q.*z\\d", REGEX_MATCH_PARTIAL_BOUNDARY, false,
+                  "aqqbz1z2c", 1, 8);
+    test_glushkov("(err|warn)(or|ing)? \\d+", REGEX_MATCH_PARTIAL_BOUNDARY,
+                  true, "a Warning 404 and ERROR 5", 2, 13);
+    test_glushkov("(err|warn)(or|ing)? \\d+", REGEX_MATCH_PARTIAL_BOUNDARY,
+                  false, "a Warning 404 and ERROR 5", -1, 0);
+    /* the last of the 64 positions can only be reached through the
+     * table of the 8th byte */
+    test_glushkov("abcdef(bcdefgh)+.(bcdefgh)*(bcdefgh)*(bcdefgh)*"
+                  "(bcdefgh)*(bcdefgh)*(bcdefgh)*(bcdefgh)*y",
+                  REGEX_MATCH_PARTIAL_BOOL, false,
+                  "zabcdefbcdefghxbcdefghy", 0, 0);
+
+    /* all the rules are looked for in one pass, and one by one when the
+     * union does not fit into the cache */
+    const char *rules[] = { "hello", "wor(l|k)d", "\\d+ms", "x*", "abc" };
+    test_set(rules, 5, REGEX_MATCH_PARTIAL_BOOL, VFREX_DEFAULT_CACHE_SIZE,
+             "hello world 12ms", 4, (size_t []){ 0, 1, 2, 3 });
+    test_set(rules, 5, REGEX_MATCH_PARTIAL_BOUNDARY, 1,
+             "hello world 12ms", 4, (size_t []){ 0, 1, 2, 3 });
+    test_set(rules, 5, REGEX_MATCH_FULL_BOOL, VFREX_DEFAULT_CACHE_SIZE,
+             "hello", 1, (size_t []){ 0 });
+    test_set(rules, 5, REGEX_MATCH_FULL_BOOL, VFREX_DEFAULT_CACHE_SIZE,
+             "", 1, (size_t []){ 3 });
+    test_set(rules, 5, REGEX_MATCH_FULL_BOOL, VFREX_DEFAULT_CACHE_SIZE,
+             "hello world", 0, NULL);
+    test_set(rules + 1, 2, REGEX_MATCH_PARTIAL_BOOL, VFREX_DEFAULT_CACHE_SIZE,
+             "abc 1m", 0, NULL);
+    test_set(rules, 0, REGEX_MATCH_PARTIAL_BOOL, VFREX_DEFAULT_CACHE_SIZE,
+             "abc", 0, NULL);
+
+    vfrex_set_t set;
+    const char *bad[] = { "abc", "(ab" };
+    assert(VFREX_SUCCESS != vfrex_set_compile(&set, bad, 2, default_option()));
+    assert(!set);
+
+    /* a string is matched with edits, ending where they are fewest, and
+     * starting as far as they stay that few */
+    vfrex_match_t boundary = REGEX_MATCH_PARTIAL_BOUNDARY;
+    test_approximate("connection refused", 2, boundary, false,
+                     "ERR: conection refussed by peer", 5, 23, 2);
+    test_approximate("abcd", 1, boundary, false, "xxabdxx", 2, 5, 1);
+    test_approximate("abcd", 1, boundary, false, "xxabcdxx", 2, 6, 0);
+    test_approximate("abcd", 1, boundary, false, "xxzbcdxx", 2, 6, 1);
+    test_approximate("abcdef", 2, boundary, false, "abxdxxab", -1, 0, 0);
+    test_approximate("Refused", 1, boundary, true, "a REFUSD b", 2, 8, 1);
+    test_approximate("id=\\d\\d\\d\\d", 1, boundary, false, "id:2024", 0, 7, 1);
+    test_approximate("colour", 1, REGEX_MATCH_FULL_BOOL, false, "color",
+                     0, 0, 1);
+    test_approximate("colour", 1, REGEX_MATCH_FULL_BOOL, false, "colr",
+                     -1, 0, 0);
+    test_approximate("colour", 1, REGEX_MATCH_PARTIAL_BOOL, false,
+                     "my colr", -1, 0, 0);
+
+    /* only a string with more chars than edits has an approximate match */
+    option = default_option();
+    option.max_error = 1;
+    assert(VFREX_INVALID_APPROXIMATE == vfrex_compile(&vfrex, "ab*c", option));
+    assert(VFREX_INVALID_APPROXIMATE == vfrex_compile(&vfrex, "a", option));
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, "ab", option));
+    vfrex_free(&vfrex);
+
+    /* every engine finds the matches one after another */
+    option = default_option();
+    option.match = boundary;
+    test_scan("ab", boundary, 0, "abxabab", REGEX_SHIFT_OR_32, 3,
+              (int []){0, 2, 3, 5, 5, 7});
+    test_scan("the quick brown", boundary, 0,
+              "the quick brown the quick brown fox", REGEX_BNDM, 2,
+              (int []){0, 15, 16, 31});
+    test_scan("========FAIL", boundary, 0, "========FAIL=========FAIL",
+              REGEX_TWO_WAY, 2, (int []){0, 12, 13, 25});
+    test_scan("error|warn|fatal|panic", boundary, 0, "warn: error, panic",
+              small, 3, (int []){0, 4, 6, 11, 13, 18});
+    test_scan("\\d+ms", boundary, 0, "1ms 22ms x 333ms", REGEX_DFA, 3,
+              (int []){0, 3, 4, 8, 11, 16});
+    test_scan("(a|b)*a(a|b)(a|b)c", boundary, 0, "abaac babbc aabac",
+              REGEX_DFA, 2, (int []){6, 11, 12, 17});
+    test_scan("(GET|PUT) /(a|b)*c", boundary, 0, "GET /abc PUT /c GET /x",
+              REGEX_GLUSHKOV, 2, (int []){0, 8, 9, 15});
+    test_scan("x(a|b)*y", REGEX_MATCH_PARTIAL_SUBMATCH, 0, "xaby xy xbby",
+              REGEX_ONE_PASS, 3, (int []){0, 4, 5, 7, 8, 12});
+    test_scan("abcd", boundary, 1, "abd abcd xbcd", REGEX_APPROXIMATE, 3,
+              (int []){0, 3, 4, 8, 9, 13});
+    test_scan("xyz", boundary, 0, "xy", REGEX_SHIFT_OR_32, 0, NULL);
+    /* an empty match moves the next search one byte on */
+    test_scan("a*", boundary, 0, "baab", REGEX_GLUSHKOV, 4,
+              (int []){0, 0, 1, 3, 3, 3, 4, 4});
+
+    /* the text is as long as it is said to be, '\0' and all */
+#define BINARY(s) s, sizeof(s) - 1
+    test_match_n("ab", BINARY("\0\0a\0ab"), REGEX_SHIFT_OR_32, 4, 6);
+    test_match_n("ab", BINARY("\0\0a\0a"), REGEX_SHIFT_OR_32, -1, 0);
+    test_match_n("the quick brown", BINARY("\0the quick\0brown the quick brown"),
+                 REGEX_BNDM, 17, 32);
+    test_match_n("========FAIL", BINARY("=====\0========FAIL"), REGEX_TWO_WAY,
+                 6, 18);
+    test_match_n("error|warn|fatal|panic", BINARY("warm\0panic"), small, 5,
+                 10);
+    test_match_n("\\d+ms", BINARY("12\0ms 34ms"), REGEX_DFA, 6, 10);
+    test_match_n("(GET|PUT) /(a|b)*c", BINARY("GET /a\0c PUT /bc"),
+                 REGEX_GLUSHKOV, 9, 16);
+    test_match_n("x.*y", BINARY("x\0y xay"), REGEX_GLUSHKOV, 4, 7);
+    test_match_n("abc", "abcabc", 2, REGEX_SHIFT_OR_32, -1, 0);
+#undef BINARY
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, "a\\d", option));
+    assert(VFREX_SUCCESS == vfrex_find_iter_n(vfrex, "a1\0a2\0a3", 7));
+    assert(VFREX_SUCCESS == vfrex_find_next(vfrex));
+    assert(VFREX_SUCCESS == vfrex_find_next(vfrex));
+    assert(0 == vfrex_group(0, &left, &right, vfrex));
+    assert(right[-1] == '2');
+    assert(VFREX_NOT_FOUND == vfrex_find_next(vfrex));
+    vfrex_free(&vfrex);
+
+    /* a match across chunks is found as if the stream were one text */
+    test_stream("abcab", 0, "xabcabcabcabx", 2, (int []){1, 6, 7, 12});
+    test_stream("(GET|PUT) /(a|b)?c", 0, "GET /ac PUT /c GET /x", 2,
+                (int []){0, 7, 8, 14});
+    test_stream("error|warn|fatal", 0, "warn: error, fatal", 3,
+                (int []){0, 4, 6, 11, 13, 18});
+    test_stream("========FAIL", 0, "=========FAIL===FAIL", 1,
+                (int []){1, 13});
+    test_stream("abcd", 1, "abd abcd xbcd", 3, (int []){0, 3, 4, 8, 9, 13});
+    test_stream("a?", 0, "baab", 5, (int []){0, 0, 1, 2, 2, 3, 3, 3, 4, 4});
+    test_stream("xyz", 0, "", 0, NULL);
+    test_stream("a\\db\\d", 0, "a1b2a3b4xa5b", 2, (int []){0, 4, 4, 8});
+
+    /* a match of any length, which goes on until the FSM dies */
+    test_stream("a.*b", 0, "xaxbxxbyab", 1, (int []){1, 10});
+    test_stream("\\d+ms", 0, "took 12ms, then 345ms and 7 ms", 2,
+                (int []){5, 9, 16, 21});
+    test_stream("ERROR.*timeout", 0, "ERROR a timeout b timeout ERROR", 1,
+                (int []){0, 25});
+    test_stream("(a|b)*a(a|b)(a|b)c", 0, "xbabbcyaaac", 2,
+                (int []){1, 6, 7, 11});
+    test_stream("a*", 0, "baab", 4, (int []){0, 0, 1, 3, 3, 3, 4, 4});
+    /* a literal cut by the end of a chunk, before a whole shorter one */
+    test_stream("(ab)*cc(a|b)ab(ab|c)", 0, "xxccbabcxxaccaabab", 2,
+                (int []){2, 8, 11, 18});
+
+    /* a scan needs the boundaries of the matches */
+    assert(VFREX_SUCCESS == vfrex_compile(&vfrex, "ab", default_option()));
+    assert(VFREX_INVALID_SCAN == vfrex_find_iter(vfrex, "ab"));
+    assert(VFREX_NOT_FOUND == vfrex_find_next(vfrex));
+    vfrex_free(&vfrex);
 }
 #endif
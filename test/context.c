@@ -0,0 +1,215 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2012, Yichao Zhou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Many threads match one compiled vfrex, each with a context of its own.
+ * The allocators come from vfrex.o, so unit-test.h is not included */
+#include <CUnit/Basic.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "common.h"
+#include "vfrex.h"
+
+#define N_THREAD 8
+#define N_ROUND  4
+#define N_TEXT   24
+#define N_GROUP  4
+
+/* A regex and the engine it is matched with */
+typedef struct program_t {
+    const char   *regex;
+    vfrex_match_t match;
+    size_t        cache_size;
+    /* all the matches with vfrex_find_iter instead of the first one */
+    bool          find_all;
+    algorithm_t   algorithm;
+} program_t;
+
+static const program_t program[] = {
+    /* the lazy DFA, which the threads warm together */
+    { "(a|b)*a(a|b)(a|b)c", REGEX_MATCH_PARTIAL_BOUNDARY,
+      VFREX_DEFAULT_CACHE_SIZE, false, REGEX_DFA },
+    /* the cache is too small, so the DFA gives up for the NFA */
+    { "(a|b)*a(a|b)(a|b)(a|b)(a|b)c", REGEX_MATCH_PARTIAL_BOUNDARY,
+      512, false, REGEX_DFA },
+    /* the groups of the one-pass DFA, and the matches of vfrex_find_iter */
+    { "x(a|b)*y(c*)", REGEX_MATCH_PARTIAL_SUBMATCH,
+      VFREX_DEFAULT_CACHE_SIZE, false, REGEX_ONE_PASS },
+    { "b(a|c)*b", REGEX_MATCH_PARTIAL_BOUNDARY,
+      VFREX_DEFAULT_CACHE_SIZE, true, REGEX_GLUSHKOV },
+    /* the shared cache fills up, and the threads go on in their own */
+    { "(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)c", REGEX_MATCH_PARTIAL_BOUNDARY,
+      8192, true, REGEX_DFA },
+};
+
+#define N_PROGRAM (sizeof(program)/sizeof(program_t))
+
+/* What a match gave: the error code and the groups, or the number of the
+ * matches and a hash of their boundaries */
+typedef struct result_t {
+    int    ret;
+    size_t number;
+    long   bound[2 * N_GROUP];
+} result_t;
+
+static char     *text[N_TEXT];
+static vfrex_t   compiled[N_PROGRAM];
+static result_t  reference[N_PROGRAM][N_TEXT];
+static size_t    leave[N_PROGRAM];
+static int       wrong;
+static pthread_barrier_t ready;
+
+static vfrex_option_t program_option(const program_t *p)
+{
+    vfrex_option_t option = default_option();
+    option.match      = p->match;
+    option.cache_size = p->cache_size;
+    return option;
+}
+
+static void run(vfrex_t vfrex, const program_t *p, const char *t,
+                result_t *result)
+{
+    const char *left, *right;
+    memset(result, 0, sizeof(result_t));
+    if (p->find_all) {
+        result->ret = vfrex_find_iter(vfrex, t);
+        while (!vfrex_find_next(vfrex)) {
+            vfrex_group(0, &left, &right, vfrex);
+            result->bound[0] = result->bound[0] * 31 + (left - t);
+            result->bound[1] = result->bound[1] * 31 + (right - t);
+            ++result->number;
+        }
+        return;
+    }
+    result->ret    = vfrex_object_match(vfrex, t);
+    result->number = vfrex_group_number(vfrex);
+    for (size_t i = 0; i < result->number && i < N_GROUP; ++i) {
+        vfrex_group(i, &left, &right, vfrex);
+        result->bound[2*i]   = left  ? left  - t : -1;
+        result->bound[2*i+1] = right ? right - t : -1;
+    }
+}
+
+static void *worker(void *arg)
+{
+    unsigned seed = (unsigned)(size_t)arg;
+    vfrex_t  context[N_PROGRAM];
+    for (size_t i = 0; i < N_PROGRAM; ++i)
+        vfrex_context(&context[i], compiled[i]);
+    pthread_barrier_wait(&ready);
+
+    /* the regexes and the texts in an order of the thread's own */
+    for (int round = 0; round < N_ROUND; ++round)
+        for (size_t k = 0; k < N_PROGRAM * N_TEXT; ++k) {
+            size_t   n = (k * 7 + rand_r(&seed) % 5) % (N_PROGRAM * N_TEXT);
+            size_t   i = n % N_PROGRAM;
+            size_t   j = n / N_PROGRAM;
+            result_t result;
+            run(context[i], &program[i], text[j], &result);
+            if (memcmp(&result, &reference[i][j], sizeof(result_t)))
+                __atomic_add_fetch(&wrong, 1, __ATOMIC_RELAXED);
+        }
+
+    for (size_t i = 0; i < N_PROGRAM; ++i) {
+        __atomic_add_fetch(&leave[i], vfrex_cache_leave_number(context[i]),
+                           __ATOMIC_RELAXED);
+        vfrex_free(&context[i]);
+    }
+    return NULL;
+}
+
+void context_threads(void)
+{
+    unsigned seed = 1;
+    for (size_t j = 0; j < N_TEXT; ++j) {
+        const char *alphabet = j % 3 ? "abababababababababababc"
+                                     : "abcabxy @.";
+        size_t      len      = 1 + rand_r(&seed) % (j % 4 ? 3000 : 12);
+        text[j] = malloc(len + 1);
+        for (size_t k = 0; k < len; ++k)
+            text[j][k] = alphabet[rand_r(&seed) % strlen(alphabet)];
+        text[j][len] = 0;
+    }
+
+    /* the answers of a vfrex of each regex of its own, on one thread */
+    for (size_t i = 0; i < N_PROGRAM; ++i) {
+        vfrex_t vfrex;
+        CU_ASSERT(VFREX_SUCCESS == vfrex_compile(&vfrex, program[i].regex,
+                                                 program_option(&program[i])));
+        CU_ASSERT(vfrex->algorithm == program[i].algorithm);
+        size_t found = 0;
+        for (size_t j = 0; j < N_TEXT; ++j) {
+            run(vfrex, &program[i], text[j], &reference[i][j]);
+            found += reference[i][j].number > 0;
+        }
+        CU_ASSERT(found > 0 && found < N_TEXT);
+        if (i == 1)
+            CU_ASSERT(vfrex->algorithm == REGEX_NFA);
+        vfrex_free(&vfrex);
+        CU_ASSERT(VFREX_SUCCESS == vfrex_compile(&compiled[i],
+                                                 program[i].regex,
+                                                 program_option(&program[i])));
+    }
+
+    pthread_t thread[N_THREAD];
+    pthread_barrier_init(&ready, NULL, N_THREAD);
+    for (size_t k = 0; k < N_THREAD; ++k)
+        pthread_create(&thread[k], NULL, worker, (void *)(k + 1));
+    for (size_t k = 0; k < N_THREAD; ++k)
+        pthread_join(thread[k], NULL);
+    pthread_barrier_destroy(&ready);
+
+    CU_ASSERT(wrong == 0);
+    /* a cache with room for the regex is never left, and a small one is */
+    CU_ASSERT(leave[0] == 0);
+    CU_ASSERT(leave[3] == 0);
+    CU_ASSERT(leave[4] > 0);
+
+    /* the vfrex agrees after its contexts are gone */
+    for (size_t i = 0; i < N_PROGRAM; ++i) {
+        for (size_t j = 0; j < N_TEXT; ++j) {
+            result_t result;
+            run(compiled[i], &program[i], text[j], &result);
+            CU_ASSERT(!memcmp(&result, &reference[i][j], sizeof(result_t)));
+        }
+        vfrex_free(&compiled[i]);
+    }
+    for (size_t j = 0; j < N_TEXT; ++j)
+        free(text[j]);
+}
+
+int main()
+{
+    CU_pSuite pSuite = NULL;
+
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    pSuite = CU_add_suite("context", NULL, NULL);
+    CU_ADD_TEST(pSuite, context_threads);
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+    CU_cleanup_registry();
+    return CU_get_error();
+}
@@ -24,6 +24,8 @@
 #include "substring.h"
 #include "macro.h"
 #include "substring.h"
+#include "parser.h"
+#include "prefilter.h"
 #include "unit-test.h"
 
 struct vfrex_t vfrex;
@@ -96,6 +98,10 @@ void judge(const char *text, const char *patt, fcomp compile, func run)
     vfrex.regex = (uchar *)patt;
     vfrex.regex_len = plen;
     vfrex.group_number = 0;
+    vfrex.option.match = REGEX_MATCH_PARTIAL_BOUNDARY;
+    vfrex.option.ignore_case = false;
+    /* shift-or takes the chars from the expression */
+    parser_parse(&vfrex);
     compile(&vfrex);
     CU_ASSERT(run((uchar *)text, tlen, &vfrex) == (pch != NULL));
     CU_ASSERT(vfrex.group_number == (pch != NULL));
@@ -142,6 +148,49 @@ void shift_or_32_fuzzy(void)
     }
 }
 
+/* st is the offset of the match, -1 if there is none */
+void judge_class(const char *text, const char *patt, vfrex_match_t match,
+                 bool ignore_case, fcomp compile, func run, int st)
+{
+    vfrex.regex              = (uchar *)patt;
+    vfrex.regex_len          = strlen(patt);
+    vfrex.group_number       = 0;
+    vfrex.option.match       = match;
+    vfrex.option.ignore_case = ignore_case;
+    parser_parse(&vfrex);
+    compile(&vfrex);
+    CU_ASSERT(run((uchar *)text, strlen(text), &vfrex) == (st >= 0));
+    if (st >= 0 && match != REGEX_MATCH_FULL_BOOL) {
+        CU_ASSERT(*vfrex.group_left  == (uchar *)text + st);
+        CU_ASSERT(*vfrex.group_right == (uchar *)text + st +
+                                        vfrex.shift_or_len);
+    }
+}
+
+void shift_or_class(void)
+{
+    vfrex_match_t p = REGEX_MATCH_PARTIAL_BOUNDARY;
+    vfrex_match_t f = REGEX_MATCH_FULL_BOOL;
+    judge_class("id=12 id=2024", "id=\\d\\d\\d\\d", p, false,
+                shift_or_compile_32, shift_or_match_32, 6);
+    judge_class("id=12 id=2024", "id=\\d\\d\\d\\d", p, false,
+                shift_or_compile_64, shift_or_match_64, 6);
+    judge_class("ID=2024", "id=\\d\\d\\d\\d", p, true,
+                shift_or_compile_32, shift_or_match_32, 0);
+    judge_class("ID=2024", "id=\\d\\d\\d\\d", p, false,
+                shift_or_compile_32, shift_or_match_32, -1);
+    judge_class("version v1x2", "v.x.", p, false,
+                shift_or_compile_32, shift_or_match_32, 8);
+    judge_class("v1x2", "v.x.", f, false,
+                shift_or_compile_32, shift_or_match_32, 0);
+    judge_class("v1x23", "v.x.", f, false,
+                shift_or_compile_32, shift_or_match_32, -1);
+    judge_class("", "", f, false,
+                shift_or_compile_32, shift_or_match_32, 0);
+    judge_class("a", "", f, false,
+                shift_or_compile_32, shift_or_match_32, -1);
+}
+
 void shift_or_64_fuzzy(void)
 {
     for (size_t i = 0; i < N_PATTERN; ++i) {
@@ -155,6 +204,73 @@ void shift_or_64_fuzzy(void)
     }
 }
 
+void shift_or_128_fuzzy(void)
+{
+    for (size_t i = 0; i < N_PATTERN; ++i)
+        for (size_t j = 0; j < N_TEXT; ++j)
+            judge(text[j], pattern[i],
+                  shift_or_compile_128,
+                  shift_or_match_128);
+}
+
+void shift_or_256_fuzzy(void)
+{
+    for (size_t i = 0; i < N_PATTERN; ++i)
+        for (size_t j = 0; j < N_TEXT; ++j)
+            judge(text[j], pattern[i],
+                  shift_or_compile_256,
+                  shift_or_match_256);
+}
+
+/* Repetitive strings of every length around the 64-bit lanes, in texts
+ * that nearly match them many times */
+void shift_or_wide_long(void)
+{
+    char patt[257], text[600];
+    for (size_t n = 60; n <= 256; ++n) {
+        for (size_t i = 0; i < n; ++i)
+            patt[i] = "ab"[i % 7 == 6];
+        patt[n] = 0;
+        for (size_t shift = 0; shift < 3; ++shift) {
+            size_t len = 2 * n + shift + 20;
+            for (size_t i = 0; i < len; ++i)
+                text[i] = "ab"[(i + shift) % 7 == 6];
+            text[len] = 0;
+            if (shift == 2)
+                text[len / 2] = 'c';
+            if (n <= 128)
+                judge(text, patt, shift_or_compile_128, shift_or_match_128);
+            judge(text, patt, shift_or_compile_256, shift_or_match_256);
+        }
+    }
+}
+
+void shift_or_wide_class(void)
+{
+    vfrex_match_t p = REGEX_MATCH_PARTIAL_BOUNDARY;
+    vfrex_match_t f = REGEX_MATCH_FULL_BOOL;
+    /* a digit class in every 4 of the 80 positions */
+    char patt[200] = "", text[300] = "", full[100] = "";
+    for (int i = 0; i < 20; ++i) {
+        strcat(patt, "abc\\d");
+        strcat(text, i == 13 ? "abcx" : "abc7");
+    }
+    for (int i = 0; i < 20; ++i)
+        strcat(text, "abc1");
+    for (int i = 0; i < 20; ++i)
+        strcat(full, "ABC5");
+    judge_class(text, patt, p, false,
+                shift_or_compile_128, shift_or_match_128, 56);
+    judge_class(text, patt, p, false,
+                shift_or_compile_256, shift_or_match_256, 56);
+    judge_class(full, patt, f, true,
+                shift_or_compile_128, shift_or_match_128, 0);
+    judge_class(full, patt, f, false,
+                shift_or_compile_256, shift_or_match_256, -1);
+    judge_class(text, patt, f, false,
+                shift_or_compile_256, shift_or_match_256, -1);
+}
+
 void shift_or_BM_1(void)
 {
     judge("AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
@@ -167,6 +283,15 @@ void shift_or_BM_2(void)
     judge(", ", "A", boyer_moore_compile, boyer_moore_match);
 }
 
+/* The good suffix table of a string with runs in it, and a failed match
+ * which must not be taken for one */
+void shift_or_BM_3(void)
+{
+    judge("baabaaabaa", "aaabaa", boyer_moore_compile, boyer_moore_match);
+    judge("aabaaba", "baba", boyer_moore_compile, boyer_moore_match);
+    judge("xyzabcabcabd", "abcabd", boyer_moore_compile, boyer_moore_match);
+}
+
 void shift_or_BM_fuzzy(void)
 {
     for (size_t i = 0; i < N_PATTERN; ++i) {
@@ -179,6 +304,262 @@ void shift_or_BM_fuzzy(void)
     }
 }
 
+void bndm_1(void)
+{
+    judge("AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
+          "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
+          bndm_compile, bndm_match);
+    judge("abaababaabaababaababa", "abaababaab", bndm_compile, bndm_match);
+    judge("abaababaabaababaababa", "babab", bndm_compile, bndm_match);
+}
+
+void bndm_fuzzy(void)
+{
+    for (size_t i = 0; i < N_PATTERN; ++i)
+        for (size_t j = 0; j < N_TEXT; ++j)
+            judge(text[j], pattern[i], bndm_compile, bndm_match);
+}
+
+void bndm_class(void)
+{
+    vfrex_match_t p = REGEX_MATCH_PARTIAL_BOUNDARY;
+    vfrex_match_t f = REGEX_MATCH_FULL_BOOL;
+    judge_class("id=12 id=2024", "id=\\d\\d\\d\\d", p, false,
+                bndm_compile, bndm_match, 6);
+    judge_class("ID=2024", "id=\\d\\d\\d\\d", p, true,
+                bndm_compile, bndm_match, 0);
+    judge_class("ID=2024", "id=\\d\\d\\d\\d", p, false,
+                bndm_compile, bndm_match, -1);
+    judge_class("version v1x2", "v.x.", p, false,
+                bndm_compile, bndm_match, 8);
+    judge_class("vvvx2", "v.x.", p, false,
+                bndm_compile, bndm_match, 1);
+    judge_class("v1x2", "v.x.", f, false,
+                bndm_compile, bndm_match, 0);
+    judge_class("v1x23", "v.x.", f, false,
+                bndm_compile, bndm_match, -1);
+    judge_class("", "", f, false,
+                bndm_compile, bndm_match, 0);
+    judge_class("a", "", p, false,
+                bndm_compile, bndm_match, 0);
+}
+
+/* Literals whose critical factorization is worth a look: a single repeated
+ * byte, the Fibonacci word, a long run of one period ending in a different
+ * suffix, which keeps the matched prefix across a shift by the period, and
+ * a literal that is periodic all through, with ignore_case folding on top */
+void two_way_1(void)
+{
+    judge("AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
+          "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
+          two_way_compile, two_way_match);
+    judge("abaababaabaababaababa", "abaababaab", two_way_compile,
+          two_way_match);
+    judge("abaababaabaababaababa", "babab", two_way_compile, two_way_match);
+    judge("=========PASS=====FAIL============FAIL", "========FAIL",
+          two_way_compile, two_way_match);
+    judge("abababababababababababababababc", "abababababc",
+          two_way_compile, two_way_match);
+    judge("abcabcabcabdabcabcabcabc", "abcabcabcabc", two_way_compile,
+          two_way_match);
+    judge_class("hellohellohello!", "HELLOhelloHELLO!", REGEX_MATCH_FULL_BOOL,
+                true, two_way_compile, two_way_match, 0);
+    judge_class("hellohellohello!", "HELLOhelloHELLO!", REGEX_MATCH_FULL_BOOL,
+                false, two_way_compile, two_way_match, -1);
+
+    const char *t = "xxHeLLoHeLLoHELLOhello!";
+    vfrex.regex              = (uchar *)"hellohellohello!";
+    vfrex.regex_len          = 16;
+    vfrex.option.match       = REGEX_MATCH_PARTIAL_BOUNDARY;
+    vfrex.option.ignore_case = true;
+    parser_parse(&vfrex);
+    two_way_compile(&vfrex);
+    CU_ASSERT(two_way_match((uchar *)t, strlen(t), &vfrex));
+    CU_ASSERT(*vfrex.group_left  == (uchar *)t + 7);
+    CU_ASSERT(*vfrex.group_right == (uchar *)t + 23);
+    judge_class("xhellohellohello!", "hellohellohello!", REGEX_MATCH_FULL_BOOL,
+                false, two_way_compile, two_way_match, -1);
+}
+
+void two_way_fuzzy(void)
+{
+    for (size_t i = 0; i < N_PATTERN; ++i)
+        for (size_t j = 0; j < N_TEXT; ++j)
+            judge(text[j], pattern[i], two_way_compile, two_way_match);
+}
+
+/* every string of a and b up to 8 bytes in texts that repeat */
+void two_way_binary(void)
+{
+    char patt[9], text[65];
+    for (int len = 1; len <= 8; ++len)
+        for (int bits = 0; bits < 1 << len; ++bits) {
+            for (int i = 0; i < len; ++i)
+                patt[i] = bits >> i & 1 ? 'b' : 'a';
+            patt[len] = 0;
+            for (int seed = 0; seed < 8; ++seed) {
+                for (int i = 0; i < 64; ++i)
+                    text[i] = (i * (seed + 3) + (i >> seed)) % 5 < 3 ? 'a'
+                                                                     : 'b';
+                text[64] = 0;
+                judge(text, patt, two_way_compile, two_way_match);
+            }
+        }
+}
+
+/* The leftmost match of the alternation of the n literals, then the first
+ * literal starting there */
+void judge_multi(const char *text, const char **literal, size_t n,
+                 vfrex_match_t match)
+{
+    struct vfrex_t v;
+    char   regex[256] = "";
+    size_t tlen       = strlen(text);
+    for (size_t i = 0; i < n; ++i) {
+        if (i)
+            strcat(regex, "|");
+        strcat(regex, literal[i]);
+    }
+
+    /* result */
+    const char *pch   = NULL;
+    size_t      found = n;
+    for (const char *s = text; *s && !pch; ++s)
+        for (size_t i = 0; i < n && !pch; ++i)
+            if (!strncmp(s, literal[i], strlen(literal[i]))) {
+                pch   = s;
+                found = i;
+            }
+    if (match == REGEX_MATCH_FULL_BOOL) {
+        pch = NULL;
+        for (size_t i = n; i-- > 0; )
+            if (!strcmp(text, literal[i])) {
+                pch   = text;
+                found = i;
+            }
+    }
+
+    memset(&v, 0, sizeof(v));
+    v.regex        = (uchar *)regex;
+    v.regex_len    = strlen(regex);
+    v.option.match = match;
+    parser_parse(&v);
+    shift_or_compile_multi(&v);
+    CU_ASSERT(v.algorithm == REGEX_SHIFT_OR_MULTI);
+    CU_ASSERT(shift_or_match_multi((uchar *)text, tlen, &v) == (pch != NULL));
+    if (pch)
+        CU_ASSERT(v.literal == found);
+    if (pch && match == REGEX_MATCH_PARTIAL_BOUNDARY) {
+        CU_ASSERT(v.group_number == 1);
+        CU_ASSERT(*v.group_left  == (uchar *)pch);
+        CU_ASSERT(*v.group_right == (uchar *)pch + strlen(literal[found]));
+    }
+    mfree(v.shift_or);
+    mfree(v.group_left);
+    mfree(v.group_right);
+}
+
+void shift_or_multi_1(void)
+{
+    const char *literal[] = { "hel", "hello", "lo w", "world" };
+    judge_multi("say hello world", literal, 4, REGEX_MATCH_PARTIAL_BOUNDARY);
+    judge_multi("say hello world", literal + 1, 3,
+                REGEX_MATCH_PARTIAL_BOUNDARY);
+    judge_multi("hello", literal, 4, REGEX_MATCH_FULL_BOOL);
+    judge_multi("hell", literal, 4, REGEX_MATCH_FULL_BOOL);
+    judge_multi("a world", literal, 4, REGEX_MATCH_PARTIAL_BOOL);
+}
+
+void shift_or_multi_fuzzy(void)
+{
+    for (size_t i = 1; i < N_PATTERN; ++i)
+        for (size_t j = 1; j < N_PATTERN; ++j) {
+            const char *literal[] = { pattern[i], pattern[j], "B" };
+            if (strlen(pattern[i]) + strlen(pattern[j]) + 1 > 64)
+                continue;
+            for (size_t k = 0; k < N_TEXT; ++k) {
+                judge_multi(text[k], literal, 3,
+                            REGEX_MATCH_PARTIAL_BOUNDARY);
+                judge_multi(text[k], literal, 2, REGEX_MATCH_FULL_BOOL);
+            }
+        }
+}
+
+/* The first end of a match of patt in text with at most k edits and the
+ * fewest edits there, by the table of Sellers */
+int approximate_end(const char *text, const char *patt, size_t k,
+                    size_t *edit)
+{
+    size_t m = strlen(patt);
+    size_t col[65];
+    for (size_t i = 0; i <= m; ++i)
+        col[i] = i;
+    for (size_t j = 0; ; ++j) {
+        if (col[m] <= k) {
+            *edit = col[m];
+            return (int)j;
+        }
+        if (!text[j])
+            return -1;
+        size_t diag = col[0];
+        col[0] = 0;
+        for (size_t i = 1; i <= m; ++i) {
+            size_t c = diag + (patt[i-1] != text[j]);
+            if (col[i] + 1 < c)
+                c = col[i] + 1;
+            if (col[i-1] + 1 < c)
+                c = col[i-1] + 1;
+            diag   = col[i];
+            col[i] = c;
+        }
+    }
+}
+
+/* The match may move past the first end to fewer edits, by no more bytes
+ * than the edits */
+void judge_approximate(const char *text, const char *patt, int k)
+{
+    vfrex.regex              = (uchar *)patt;
+    vfrex.regex_len          = strlen(patt);
+    vfrex.group_number       = 0;
+    vfrex.option.match       = REGEX_MATCH_PARTIAL_BOUNDARY;
+    vfrex.option.ignore_case = false;
+    vfrex.option.max_error   = k;
+    parser_parse(&vfrex);
+    approximate_compile(&vfrex);
+
+    size_t edit;
+    int    end   = approximate_end(text, patt, (size_t)k, &edit);
+    bool   found = approximate_match((uchar *)text, strlen(text), &vfrex);
+    CU_ASSERT(found == (end >= 0));
+    if (found && end >= 0) {
+        CU_ASSERT(vfrex.edit <= edit);
+        CU_ASSERT(*vfrex.group_right >= (uchar *)text + end);
+        CU_ASSERT(*vfrex.group_right <= (uchar *)text + end + edit);
+        CU_ASSERT(*vfrex.group_left  <= *vfrex.group_right);
+    }
+    vfrex.option.max_error = 0;
+    prefilter_free(&vfrex.prefilter);
+}
+
+void approximate_1(void)
+{
+    judge_approximate("ERR: conection refussed by peer", "connection refused",
+                      2);
+    judge_approximate("xxabdxx", "abcd", 1);
+    judge_approximate("xxabcdxx", "abcd", 1);
+    judge_approximate("abxdxxab", "abcdef", 2);
+    judge_approximate("", "abcdef", 2);
+}
+
+void approximate_fuzzy(void)
+{
+    for (size_t i = 0; i < N_PATTERN; ++i)
+        for (size_t j = 0; j < N_TEXT; ++j)
+            for (int k = 1; (size_t)k < strlen(pattern[i]) && k <= 3; ++k)
+                judge_approximate(text[j], pattern[i], k);
+}
+
 int main()
 {
     CU_pSuite pSuite = NULL;
@@ -193,12 +574,33 @@ int main()
     CU_ADD_TEST(pSuite, shift_or_32_4);
     CU_ADD_TEST(pSuite, shift_or_32_5);
     CU_ADD_TEST(pSuite, shift_or_32_fuzzy);
+    CU_ADD_TEST(pSuite, shift_or_class);
     pSuite = CU_add_suite("shift_or_64", NULL, NULL);
     CU_ADD_TEST(pSuite, shift_or_64_fuzzy);
+    pSuite = CU_add_suite("shift_or_wide", NULL, NULL);
+    CU_ADD_TEST(pSuite, shift_or_128_fuzzy);
+    CU_ADD_TEST(pSuite, shift_or_256_fuzzy);
+    CU_ADD_TEST(pSuite, shift_or_wide_long);
+    CU_ADD_TEST(pSuite, shift_or_wide_class);
+    pSuite = CU_add_suite("shift_or_multi", NULL, NULL);
+    CU_ADD_TEST(pSuite, shift_or_multi_1);
+    CU_ADD_TEST(pSuite, shift_or_multi_fuzzy);
     pSuite = CU_add_suite("BM", NULL, NULL);
     CU_ADD_TEST(pSuite, shift_or_BM_1);
     CU_ADD_TEST(pSuite, shift_or_BM_2);
+    CU_ADD_TEST(pSuite, shift_or_BM_3);
     CU_ADD_TEST(pSuite, shift_or_BM_fuzzy);
+    pSuite = CU_add_suite("BNDM", NULL, NULL);
+    CU_ADD_TEST(pSuite, bndm_1);
+    CU_ADD_TEST(pSuite, bndm_fuzzy);
+    CU_ADD_TEST(pSuite, bndm_class);
+    pSuite = CU_add_suite("two_way", NULL, NULL);
+    CU_ADD_TEST(pSuite, two_way_1);
+    CU_ADD_TEST(pSuite, two_way_fuzzy);
+    CU_ADD_TEST(pSuite, two_way_binary);
+    pSuite = CU_add_suite("approximate", NULL, NULL);
+    CU_ADD_TEST(pSuite, approximate_1);
+    CU_ADD_TEST(pSuite, approximate_fuzzy);
 
     CU_basic_set_mode(CU_BRM_VERBOSE);
     CU_basic_run_tests();
@@ -23,6 +23,8 @@
 #ifndef __VFREX_OPTION_H
 #define __VFREX_OPTION_H
 
+#include <stddef.h>
+
 typedef enum vfrex_style_t {
     REGEX_STYLE_POSIX,
     REGEX_STYLE_POSIX_GNU,
@@ -42,10 +44,27 @@ typedef enum vfrex_match_t {
     REGEX_MATCH_PARTIAL_SUBMATCH,
 } vfrex_match_t;
 
+/* The cache size default_option() gives to the lazy DFA, and the one a
+ * cache_size of 0 stands for */
+#define VFREX_DEFAULT_CACHE_SIZE (2 << 20)
+/* The cache size that puts no limit on the lazy DFA */
+#define VFREX_UNLIMITED_CACHE    ((size_t)-1)
+
 typedef struct vfrex_option_t {
     vfrex_style_t style;
     vfrex_match_t match;
     int ignore_case;
+    /* Bytes the lazy DFA of each direction may use.  When it is full, the
+     * cache is cleared and rebuilt from the current state.  0 for
+     * VFREX_DEFAULT_CACHE_SIZE, VFREX_UNLIMITED_CACHE for no limit */
+    size_t cache_size;
+    /* Build the whole DFA when compiling, minimize it and match with a flat
+     * table.  The lazy DFA is used if the table would exceed cache_size */
+    int full_DFA;
+    /* Match a string of at most 64 chars and classes with at most this many
+     * edits: bytes inserted, deleted or substituted.  It must be less than
+     * the length of the string.  0 for exact matching */
+    int max_error;
 } vfrex_option_t;
 
 typedef enum vfrex_error_t {
@@ -57,6 +76,10 @@ typedef enum vfrex_error_t {
     VFREX_INVALID_QUESTION_MARK,
     VFREX_INVALID_UTF8,
     VFREX_INVALID_COMPLIATION,
+    VFREX_INVALID_BLOB,
+    VFREX_INVALID_APPROXIMATE,
+    VFREX_INVALID_SCAN,
+    VFREX_INVALID_STREAM,
 } vfrex_error_t;
 
 #endif